@@ -1,7 +1,7 @@
 #compiler makefile
 DEFAULT_CC=g++
 CC_FLAGS=-static-libgcc -static-libstdc++ -Wall -std=c++11 -g
-LD=-Ipcre -Lpcre -lpcre -lpcrecpp
+LD=-Ipcre -Lpcre -lpcre -lpcrecpp -pthread -ldl
 GNU_CONFIGURE=yes
 
 all: llace-ebnf
@@ -0,0 +1,402 @@
+#ifndef BINARY_TREE_HPP
+#define BINARY_TREE_HPP
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "generic-btree.hpp"
+#include "BuildSyntaxTree.hpp"
+
+#define BINTREE_OUT std::cout << "(Binary tree) "
+#define BINTREE_ERROUT std::cerr << "(Binary tree) Error: "
+
+namespace bintree {
+
+    /*
+        File layout, all integers in host byte order (checked on load through the
+        byte_order field):
+
+            Header
+            Node[node_count]            pre-order, the root is node 0
+            uint64_t[name_count + 1]    offsets of each rule name in the name blob
+            char[names_size]            rule names, not null terminated
+            char[source_size]           the source, only if flag_source is set
+
+        A node's children follow it directly, and its next sibling is found at
+        its own index plus subtree_size, so walking needs no pointers.
+    */
+
+    const char magic[8] = {'L','L','A','C','E','T','R','E'};
+    const uint32_t version = 1;
+    const uint32_t byte_order = 0x01020304;
+    const uint32_t flag_source = 0b1;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t flags;
+        uint32_t reserved;
+        uint64_t node_count;
+        uint64_t name_count;
+        uint64_t nodes_offset;
+        uint64_t names_offset;
+        uint64_t names_size;
+        uint64_t source_offset;
+        uint64_t source_size;
+    };
+
+    struct Node {
+        uint32_t rule;
+        uint32_t child_count;
+        uint64_t offset;
+        uint64_t length;
+        uint64_t subtree_size;
+    };
+
+    struct Slice {
+        /*
+            Non-owning view into a loaded tree.
+        */
+        const char* data;
+        uint_type size;
+
+        Slice() : data(nullptr), size(0) {
+        }
+
+        Slice(const char* data, uint_type size) : data(data), size(size) {
+        }
+
+        std::string str() const {
+            return std::string(this->data, this->size);
+        }
+
+        bool operator== (const std::string& compare) const {
+            return compare.size() == this->size && std::memcmp(compare.data(), this->data, this->size) == 0;
+        }
+    };
+
+    class Flattener {
+        /*
+            Turns a Trie into the node array and interned rule name table in one
+            pre-order walk.
+        */
+        private:
+            std::map<std::string,uint32_t> name_ids;
+
+            void flatten(const Trie<syntree::SyntaxElement>& tree) {
+                /*
+                    Subtree sizes are filled in on the way back up, the walk keeps its
+                    own stack of the nodes it is inside.
+                */
+                std::vector<uint_type> open;
+                walk(tree, [&](const Trie<syntree::SyntaxElement>& item, size_t) {
+                    Node node;
+                    auto found = this->name_ids.find(item.self.identifier);
+                    if (found == this->name_ids.end()) {
+                        node.rule = this->names.size();
+                        this->name_ids[item.self.identifier] = node.rule;
+                        this->names.push_back(item.self.identifier);
+                    }
+                    else node.rule = found->second;
+                    node.child_count = item.data.size();
+                    node.offset = item.self.index;
+                    node.length = item.self.content.size();
+                    node.subtree_size = 1;
+                    open.push_back(this->nodes.size());
+                    this->nodes.push_back(node);
+                }, [&](const Trie<syntree::SyntaxElement>&, size_t) {
+                    this->nodes[open.back()].subtree_size = this->nodes.size() - open.back();
+                    open.pop_back();
+                });
+            }
+
+        public:
+            std::vector<Node> nodes;
+            std::vector<std::string> names;
+
+            Flattener(const Trie<syntree::SyntaxElement>& tree) : name_ids(), nodes(), names() {
+                this->flatten(tree);
+            }
+    };
+
+    bool write(std::ostream& out, const Trie<syntree::SyntaxElement>& tree, const std::string* source = nullptr) {
+        /*
+            Serialises a tree in a single sequential pass over the output. If source
+            is given it is embedded so node contents can be recovered on load.
+        */
+        Flattener flat(tree);
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, magic, sizeof(header.magic));
+        header.version = version;
+        header.byte_order = byte_order;
+        header.flags = (source != nullptr) ? flag_source : 0;
+        header.node_count = flat.nodes.size();
+        header.name_count = flat.names.size();
+        header.nodes_offset = sizeof(Header);
+        header.names_offset = header.nodes_offset + flat.nodes.size() * sizeof(Node);
+        std::vector<uint64_t> name_offsets(flat.names.size() + 1, 0);
+        for (uint_type i = 0; i < flat.names.size(); i++) {
+            name_offsets[i + 1] = name_offsets[i] + flat.names[i].size();
+        }
+        header.names_size = name_offsets.back();
+        header.source_offset = header.names_offset + name_offsets.size() * sizeof(uint64_t) + header.names_size;
+        header.source_size = (source != nullptr) ? source->size() : 0;
+        out.write((const char*)&header, sizeof(header));
+        out.write((const char*)flat.nodes.data(), flat.nodes.size() * sizeof(Node));
+        out.write((const char*)name_offsets.data(), name_offsets.size() * sizeof(uint64_t));
+        for (uint_type i = 0; i < flat.names.size(); i++) {
+            out.write(flat.names[i].data(), flat.names[i].size());
+        }
+        if (source != nullptr) out.write(source->data(), source->size());
+        return out.good();
+    }
+
+    bool write(const std::string& filename, const Trie<syntree::SyntaxElement>& tree, const std::string* source = nullptr) {
+        std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            BINTREE_ERROUT << "was not able to open " << filename << " for writing." << std::endl;
+            return false;
+        }
+        return write(out,tree,source);
+    }
+
+    class MappedTree {
+        /*
+            Read-only view of a serialised tree. Files are mapped rather than read,
+            and every accessor points straight into the mapping, so loading costs
+            the same no matter how many nodes the tree has.
+        */
+        private:
+            void* mapping;
+            uint_type mapping_size;
+            const char* base;
+            uint_type base_size;
+            const Header* header;
+            const Node* node_array;
+            const uint64_t* name_offsets;
+            const char* name_blob;
+
+            static bool fits(uint64_t offset, uint64_t size, uint64_t limit) {
+                return offset <= limit && size <= limit - offset;
+            }
+
+            bool validate() {
+                /*
+                    Checks everything the accessors rely on before the view becomes
+                    valid, so a corrupt or truncated file is rejected here rather
+                    than read out of bounds later: every section lies in the
+                    buffer, name offsets rise to names_size, every node names a
+                    rule and (with an embedded source) a range inside it, and each
+                    subtree holds exactly its children.
+                */
+                if (this->base_size < sizeof(Header)) return false;
+                const Header* header = (const Header*)this->base;
+                if (std::memcmp(header->magic, magic, sizeof(magic)) != 0) return false;
+                if (header->version != version) return false;
+                if (header->byte_order != byte_order) return false;
+                if (header->nodes_offset < sizeof(Header) || header->nodes_offset % alignof(Node) != 0) return false;
+                if (header->names_offset % alignof(uint64_t) != 0 || header->names_offset > this->base_size) return false;
+                if (header->node_count == 0 || header->node_count > (this->base_size - std::min<uint64_t>(header->nodes_offset, this->base_size)) / sizeof(Node)) return false;
+                if (!fits(header->nodes_offset, header->node_count * sizeof(Node), header->names_offset)) return false;
+                if (header->name_count >= (this->base_size - header->names_offset) / sizeof(uint64_t)) return false;
+                uint64_t blob_offset = header->names_offset + (header->name_count + 1) * sizeof(uint64_t);
+                if (!fits(blob_offset, header->names_size, this->base_size)) return false;
+                if ((header->flags & flag_source) != 0 && !fits(header->source_offset, header->source_size, this->base_size)) return false;
+                const Node* nodes = (const Node*)(this->base + header->nodes_offset);
+                const uint64_t* offsets = (const uint64_t*)(this->base + header->names_offset);
+                if (offsets[0] != 0 || offsets[header->name_count] != header->names_size) return false;
+                for (uint_type i = 0; i < header->name_count; i++) {
+                    if (offsets[i + 1] < offsets[i]) return false;
+                }
+                if (nodes[0].subtree_size != header->node_count) return false;
+                for (uint_type i = 0; i < header->node_count; i++) {
+                    if (nodes[i].rule >= header->name_count) return false;
+                    if (nodes[i].subtree_size == 0 || nodes[i].subtree_size > header->node_count - i) return false;
+                    if ((header->flags & flag_source) != 0 && !fits(nodes[i].offset, nodes[i].length, header->source_size)) return false;
+                }
+                /*
+                    Every node is some node's child once, so this is linear.
+                */
+                for (uint_type i = 0; i < header->node_count; i++) {
+                    uint_type end = i + nodes[i].subtree_size;
+                    uint_type child = i + 1;
+                    for (uint_type count = 0; count < nodes[i].child_count; count++) {
+                        if (child >= end) return false;
+                        child += nodes[child].subtree_size;
+                    }
+                    if (child != end) return false;
+                }
+                this->node_array = nodes;
+                this->name_offsets = offsets;
+                this->name_blob = this->base + blob_offset;
+                this->header = header;
+                return true;
+            }
+
+            void reset() {
+                if (this->mapping != nullptr) munmap(this->mapping, this->mapping_size);
+                this->mapping = nullptr;
+                this->mapping_size = 0;
+                this->base = nullptr;
+                this->base_size = 0;
+                this->header = nullptr;
+                this->node_array = nullptr;
+                this->name_offsets = nullptr;
+                this->name_blob = nullptr;
+            }
+
+        public:
+            MappedTree() : mapping(nullptr), mapping_size(0), base(nullptr), base_size(0), header(nullptr),
+                           node_array(nullptr), name_offsets(nullptr), name_blob(nullptr) {
+            }
+
+            MappedTree(const MappedTree& copy) = delete;
+
+            MappedTree(MappedTree&& move) : MappedTree() {
+                std::swap(this->mapping, move.mapping);
+                std::swap(this->mapping_size, move.mapping_size);
+                std::swap(this->base, move.base);
+                std::swap(this->base_size, move.base_size);
+                std::swap(this->header, move.header);
+                std::swap(this->node_array, move.node_array);
+                std::swap(this->name_offsets, move.name_offsets);
+                std::swap(this->name_blob, move.name_blob);
+            }
+
+            MappedTree(const std::string& filename) : MappedTree() {
+                this->open(filename);
+            }
+
+            ~MappedTree() {
+                this->reset();
+            }
+
+            MappedTree& operator= (const MappedTree& copy) = delete;
+
+            bool open(const std::string& filename) {
+                this->reset();
+                int fd = ::open(filename.c_str(), O_RDONLY);
+                if (fd < 0) {
+                    BINTREE_ERROUT << "was not able to open " << filename << std::endl;
+                    return false;
+                }
+                struct stat info;
+                if (fstat(fd, &info) != 0 || info.st_size == 0) {
+                    ::close(fd);
+                    BINTREE_ERROUT << "was not able to stat " << filename << std::endl;
+                    return false;
+                }
+                void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                ::close(fd);
+                if (mapped == MAP_FAILED) {
+                    BINTREE_ERROUT << "was not able to map " << filename << std::endl;
+                    return false;
+                }
+                this->mapping = mapped;
+                this->mapping_size = info.st_size;
+                if (!this->view((const char*)mapped, info.st_size)) {
+                    BINTREE_ERROUT << filename << " is not a valid version " << version << " syntax tree." << std::endl;
+                    this->reset();
+                    return false;
+                }
+                return true;
+            }
+
+            bool view(const char* buffer, uint_type size) {
+                /*
+                    Uses an existing buffer instead of a mapped file. The buffer must
+                    outlive the view and be suitably aligned.
+                */
+                this->header = nullptr;
+                this->base = buffer;
+                this->base_size = size;
+                return this->validate();
+            }
+
+            bool valid() const {
+                return this->header != nullptr;
+            }
+
+            uint_type size() const {
+                return this->valid() ? this->header->node_count : 0;
+            }
+
+            bool hasSource() const {
+                return this->valid() && (this->header->flags & flag_source) != 0;
+            }
+
+            const Node& node(uint_type index) const {
+                return this->node_array[index];
+            }
+
+            uint_type firstChild(uint_type index) const {
+                return index + 1;
+            }
+
+            uint_type nextSibling(uint_type index) const {
+                return index + this->node_array[index].subtree_size;
+            }
+
+            uint_type rules() const {
+                return this->valid() ? this->header->name_count : 0;
+            }
+
+            Slice ruleName(uint_type rule) const {
+                return Slice(this->name_blob + this->name_offsets[rule], this->name_offsets[rule + 1] - this->name_offsets[rule]);
+            }
+
+            Slice identifier(uint_type index) const {
+                return this->ruleName(this->node_array[index].rule);
+            }
+
+            Slice source() const {
+                if (!this->hasSource()) return Slice();
+                return Slice(this->base + this->header->source_offset, this->header->source_size);
+            }
+
+            Slice content(uint_type index) const {
+                /*
+                    Content of a node, empty if the source was not embedded.
+                */
+                if (!this->hasSource()) return Slice();
+                const Node& node = this->node_array[index];
+                return Slice(this->base + this->header->source_offset + node.offset, node.length);
+            }
+
+            Trie<syntree::SyntaxElement> toTrie(uint_type index = 0) const {
+                /*
+                    Rebuilds an owning tree for code that still needs one. Children are
+                    created in their parent before being queued, so the queued pointers
+                    stay valid.
+                */
+                Trie<syntree::SyntaxElement> tree;
+                std::vector<std::pair<uint_type,Trie<syntree::SyntaxElement>*> > work;
+                work.push_back(std::make_pair(index, &tree));
+                while (!work.empty()) {
+                    uint_type at = work.back().first;
+                    Trie<syntree::SyntaxElement>* node = work.back().second;
+                    work.pop_back();
+                    node->self = syntree::SyntaxElement(this->node_array[at].offset, this->identifier(at).str(), this->content(at).str());
+                    node->data.resize(this->node_array[at].child_count);
+                    uint_type end = at + this->node_array[at].subtree_size;
+                    uint_type slot = 0;
+                    for (uint_type child = this->firstChild(at); child < end && slot < node->data.size(); child = this->nextSibling(child)) {
+                        work.push_back(std::make_pair(child, &node->data[slot++]));
+                    }
+                }
+                return tree;
+            }
+    };
+};
+
+#endif
@@ -8,32 +8,49 @@
 #include <vector>
 #include <pcrecpp.h>
 #include <tuple>
+#include <map>
+#include <algorithm>
 #include "generic-btree.hpp"
 #include "EBNF.hpp"
+#include "Lexer.hpp"
+#include "RuleProfiler.hpp"
 
 #define PARSE_OUT std::cout << "(Parsing) "
 #define PARSE_ERROUT std::cerr << "(Parsing) Error: "
 
 namespace syntree {
+
+    /*
+        Whether this build gives up on a level at the first stretch no rule
+        matches, the trees of the two builds differ.
+    */
+    #ifdef EBNF_GIVE_UP_EASILY
+    const bool give_up_easily = true;
+    #else
+    const bool give_up_easily = false;
+    #endif
     
     struct SyntaxElement {
         uint_type index;
         std::string identifier;
         std::string content;
+        uint64_t hash;          //Structural hash, 0 unless the tree was hashed
         
-        SyntaxElement() : index(0), identifier(), content() {
+        SyntaxElement() : index(0), identifier(), content(), hash(0) {
         }
 
         SyntaxElement(const SyntaxElement& copy) : SyntaxElement() {
             this->index = copy.index;
             this->identifier = copy.identifier;
             this->content = copy.content;
+            this->hash = copy.hash;
         }
         
         SyntaxElement(SyntaxElement&& move) : SyntaxElement() {
             std::swap(this->index,move.index);
             std::swap(this->identifier,move.identifier);
             std::swap(this->content,move.content);
+            std::swap(this->hash,move.hash);
         }
         
         SyntaxElement(uint_type index, const std::string& identifier, const std::string& content) : SyntaxElement() {
@@ -57,84 +74,443 @@ namespace syntree {
             this->index = copy.index;
             this->identifier = copy.identifier;
             this->content = copy.content;
+            this->hash = copy.hash;
             return *this;
         }
     };
     
-    std::vector<SyntaxElement> largestMatches(const EBNF& grammar,const std::string& content, const SyntaxElement& previous) {
+    struct Diagnostic {
+        uint_type offset;
+        uint_type length;
+        uint_type line;
+        uint_type column;
+        std::string message;
+
+        Diagnostic() : offset(0), length(0), line(0), column(0), message() {
+        }
+
+        Diagnostic(uint_type offset, uint_type length, const std::string& message) : Diagnostic() {
+            this->offset = offset;
+            this->length = length;
+            this->message = message;
+        }
+    };
+
+    bool isRoot(const SyntaxElement& element) {
+        /*
+            The whole source (or a streamed construct) rather than a rule match.
+        */
+        return element.identifier.compare(0, 14, "__syntax_tree_") == 0;
+    }
+
+    uint_type skipTrivia(const std::string& source, uint_type from) {
+        /*
+            End of the run of whitespace and comments starting at from, from itself
+            if there is none.
+        */
+        uint_type i = from;
+        while (i < source.size()) {
+            if (isspace((unsigned char)source[i])) i++;
+            else if (source.compare(i, 2, "/*") == 0) {
+                uint_type end = source.find("*/", i + 2);
+                i = (end == std::string::npos) ? source.size() : end + 2;
+            }
+            else if (source.compare(i, 2, "//") == 0) {
+                uint_type end = source.find('\n', i);
+                i = (end == std::string::npos) ? source.size() : end + 1;
+            }
+            else break;
+        }
+        return i;
+    }
+
+    std::vector<std::string> syncTokens(const EBNF& grammar) {
+        /*
+            Terminals that end a construct in the grammar, used to resynchronise
+            after input no rule matches. Falls back to ';' and '}' for grammars
+            that declare none of them.
+        */
+        std::vector<std::string> sync;
+        const char* candidates[] = {";", "}", ")", "]"};
+        for (auto candidate : candidates) {
+            if (oneOf(std::string(candidate), grammar.string_table)) sync.push_back(candidate);
+        }
+        if (sync.empty()) {
+            sync.push_back(";");
+            sync.push_back("}");
+        }
+        return sync;
+    }
+
+    struct ParseContext {
+        /*
+            State shared by every level of a parse. When a token array is given the
+            builder tries rules where the walk over it goes instead of listing every
+            match of every rule. Tokens are then the unit of the parse: a level
+            starts at its first significant token and gaps are crossed a token at a
+            time, so nothing is found that starts in leading trivia or inside a
+            string or comment token, such as an identifier in a comment. This is
+            intended, the tree equals the one built without tokens only where every
+            match starts on a token boundary. When diagnostics are given the builder
+            recovers from input no rule matches at the top level by skipping to the
+            next sync token, rather than giving up or stepping through it. When a
+            profiler is given every rule is matched through it (profilers are not
+            thread safe). When hashing is set buildTree fills in every node's
+            structural hash.
+        */
+        const lexer::TokenArray* tokens;
+        std::vector<Diagnostic>* diagnostics;
+        std::vector<std::string> sync_tokens;
+        profile::RuleProfiler* profiler;
+        bool hashing;
+
+        ParseContext() : tokens(nullptr), diagnostics(nullptr), sync_tokens(), profiler(nullptr), hashing(false) {
+        }
+
+        ParseContext(const lexer::TokenArray& tokens) : ParseContext() {
+            this->tokens = &tokens;
+        }
+
+        void recoverWith(const EBNF& grammar, std::vector<Diagnostic>& diagnostics) {
+            this->diagnostics = &diagnostics;
+            this->sync_tokens = syncTokens(grammar);
+        }
+
+        bool recovering() const {
+            return this->diagnostics != nullptr;
+        }
+
+        uint_type firstPosition(const SyntaxElement& previous) const {
+            /*
+                First index (relative to previous.content) worth trying, skipping any
+                leading whitespace and comments.
+            */
+            if (this->tokens == nullptr) return 0;
+            uint_type limit = previous.index + previous.content.size();
+            uint_type first = this->tokens->firstStart(previous.index, limit);
+            if (first == limit) return 0;
+            return first - previous.index;
+        }
+
+        uint_type nextPosition(const SyntaxElement& previous, uint_type index) const {
+            /*
+                Next index (relative to previous.content) worth trying after index,
+                the next token boundary. Inside a single token there are no
+                boundaries to jump to, so sub-token rules still step byte by byte.
+            */
+            if (this->tokens == nullptr) return index + 1;
+            uint_type limit = previous.index + previous.content.size();
+            uint_type next = this->tokens->nextBoundary(previous.index + index, limit);
+            if (next == limit && this->tokens->nextBoundary(previous.index, limit) == limit) return index + 1;
+            return next - previous.index;
+        }
+
+        bool byToken(const SyntaxElement& previous) const {
+            /*
+                Whether the builder walks the token array. The profiler times whole
+                searches, and recovery needs to know where the next match is, so
+                both keep listing every match up front.
+            */
+            return this->tokens != nullptr && this->profiler == nullptr && !(this->recovering() && isRoot(previous));
+        }
+    };
+
+    struct Candidate {
+        /*
+            Largest match found so far starting at a position.
+        */
+        const std::string* rule_id;
+        uint_type match;
+        uint_type rule;
+    };
+
+    const uint_type anchored_misses = 2;
+
+    std::vector<SyntaxElement> tokenMatches(const EBNF& grammar, const std::string& content, const SyntaxElement& previous, const ParseContext& context) {
+        /*
+            largestMatches over a token array. Every rule is tried anchored at the
+            first token, then wherever the walk goes next, instead of every rule
+            listing every match in the content up front. A rule that misses
+            anchored_misses times searches ahead for its next match instead and
+            waits there, so a regex that is slow to fail does not fail again at
+            every position. As with a full listing, a rule's matches never
+            overlap, taken or not. Gaps are crossed to the next token boundary,
+            so unlike a full listing nothing starting inside a token is tried, see
+            ParseContext. Ties go to the rule that comes first.
+        */
+        std::vector<SyntaxElement> matches;
+        std::vector<std::pair<std::string,uint_type> > found(grammar.tree_rules.size(), std::pair<std::string,uint_type>(std::string(), 0));
+        std::vector<uint_type> misses(grammar.tree_rules.size(), 0);
+        uint_type index = context.firstPosition(previous);
+        while (index < content.size()) {
+            const std::pair<std::string,uint_type>* largest = nullptr;
+            const std::string* largest_rule = nullptr;
+            for (uint_type rule = 0; rule < grammar.tree_rules.size(); rule++) {
+                /*
+                    found holds the rule's last match, or where it last missed.
+                    Before that match or inside it the rule is not tried again,
+                    but the match itself counts where it starts.
+                */
+                std::pair<std::string,uint_type>& next = found[rule];
+                if (index < next.second + next.first.size() || index < next.second) {
+                    if (index != next.second) continue;
+                }
+                else {
+                    const std::string& rule_id = grammar.tree_rules[rule];
+                    const EvalEBNF::KeywordMatcher* keywords = grammar.optimizing() ? grammar.keywords(rule_id) : nullptr;
+                    if (misses[rule] < anchored_misses) {
+                        uint32_t literal = (keywords != nullptr) ? keywords->matchAt(content, index) : EvalEBNF::no_keyword;
+                        next.first = (keywords == nullptr) ? RegexHelper::matchAt(grammar.compiled(rule_id), content, index)
+                                   : (literal != EvalEBNF::no_keyword) ? keywords->literal(literal) : std::string();
+                        next.second = index;
+                        if (next.first.empty()) misses[rule]++;
+                    }
+                    else next = (keywords != nullptr) ? keywords->nextMatch(content, index) : RegexHelper::nextMatch(grammar.compiled(rule_id), content, index);
+                    if (next.second != index) continue;
+                }
+                if (next.first.empty() || next.first == content) continue;
+                if (largest == nullptr || next.first.size() > largest->first.size()) {
+                    largest = &next;
+                    largest_rule = &grammar.tree_rules[rule];
+                }
+            }
+            if (largest != nullptr) {
+                matches.push_back(SyntaxElement(index + previous.index, *largest_rule, largest->first));
+                index += largest->first.size();
+                continue;
+            }
+            #ifdef EBNF_GIVE_UP_EASILY
+            break;
+            #else
+            index = context.nextPosition(previous,index);
+            #endif
+        }
+        return matches;
+    }
+
+    std::vector<SyntaxElement> largestMatches(const EBNF& grammar,const std::string& content, const SyntaxElement& previous, const ParseContext& context = ParseContext()) {
         /*
             Function that returns a vector of the largest, first occuring matches
             for further processing.
         */
         
+        if (context.byToken(previous)) return tokenMatches(grammar, content, previous, context);
         std::vector<SyntaxElement> matches;
         std::vector<std::pair<std::string,std::vector<std::pair<std::string,uint_type> > > > all_matches;
-        uint_type index = 0;
+        uint_type index = context.firstPosition(previous);
         /*
-            Find all matches for all regular expressions.
+            Find all matches for the regular expressions of every rule that can be
+            a tree node. Rules that are only literal alternatives are matched by
+            their keyword trie instead, unless regexes are left unoptimized or
+            every rule goes through the profiler.
         */
-        for (auto& elem : grammar.regex_map) {
-            PARSE_OUT << "Finding matches for: " << elem.second.rule_id << std::endl;
-            auto regex_matches = RegexHelper::getListOfMatches(elem.second.assemble(grammar.regex_map),content);
-            all_matches.push_back(std::pair<std::string,std::vector<std::pair<std::string,uint_type> > >(elem.second.rule_id,regex_matches));
+        for (auto& rule_id : grammar.tree_rules) {
+            PARSE_OUT << "Finding matches for: " << rule_id << std::endl;
+            const EvalEBNF::KeywordMatcher* keywords = (context.profiler == nullptr && grammar.optimizing()) ? grammar.keywords(rule_id) : nullptr;
+            auto regex_matches = (context.profiler != nullptr) ? context.profiler->match(rule_id,content)
+                               : (keywords != nullptr) ? keywords->matches(content)
+                                                       : RegexHelper::getListOfMatches(grammar.compiled(rule_id),content);
+            all_matches.push_back(std::pair<std::string,std::vector<std::pair<std::string,uint_type> > >(rule_id,regex_matches));
         }
         /*
-            Find the  largest match by checking all matches.
+            Index the largest match at every position once, so each step below is a
+            lookup rather than a sweep over every match list. Ties go to the rule
+            that comes first, as before.
         */
-        #ifndef EBNF_GIVE_UP_EASILY
+        std::map<uint_type,Candidate> largest_at;
+        for (uint_type iter_all = 0; iter_all < all_matches.size(); iter_all++) {
+            for (uint_type iter = 0; iter < all_matches[iter_all].second.size(); iter++) {
+                const std::pair<std::string,uint_type>& match = all_matches[iter_all].second[iter];
+                if (match.first.empty() || match.first == content) continue;
+                auto found = largest_at.find(match.second);
+                if (found == largest_at.end() || match.first.size() > all_matches[found->second.rule].second[found->second.match].first.size()) {
+                    Candidate candidate = {&all_matches[iter_all].first, iter, iter_all};
+                    largest_at[match.second] = candidate;
+                }
+            }
+        }
+        bool recover = context.recovering() && isRoot(previous);
+        std::vector<uint_type> next_sync(context.sync_tokens.size(), 0);
+        std::vector<bool> sync_valid(context.sync_tokens.size(), false);
         while (index < content.size()) {
-        #endif
-            bool are_matches = true;
-            while(index < content.size() && are_matches) {
-                std::pair<std::string,uint_type> largest("",0);
-                std::string type_string;
-                are_matches = false;
-                for (uint_type iter_all = 0; iter_all < all_matches.size(); iter_all++) {
-                    for (uint_type iter = 0; iter < all_matches[iter_all].second.size(); iter++) {
-                        if (all_matches[iter_all].second[iter].second == index 
-                         && all_matches[iter_all].second[iter].first.size() > largest.first.size()
-                         && all_matches[iter_all].second[iter].first != content) {
-                             type_string = all_matches[iter_all].first;
-                             largest = all_matches[iter_all].second[iter];
-                             are_matches |= true;
-                        }
-                    }
+            auto found = largest_at.find(index);
+            if (found != largest_at.end()) {
+                const std::pair<std::string,uint_type>& largest = all_matches[found->second.rule].second[found->second.match];
+                matches.push_back(SyntaxElement(largest.second + previous.index, *found->second.rule_id, largest.first));
+                index = largest.first.size() + largest.second;
+                continue;
+            }
+            auto next_match = largest_at.upper_bound(index);
+            uint_type next_index = (next_match == largest_at.end()) ? content.size() : next_match->first;
+            if (recover) {
+                /*
+                    Nothing matches here. Whitespace up to the next match is not an
+                    error, anything else is reported and skipped up to the end of the
+                    next sync token. The next sync token position is cached per token
+                    so the whole scan stays linear.
+                */
+                if (content.find_first_not_of(" \t\r\n", index) >= next_index) {
+                    index = next_index;
+                    continue;
                 }
-                if (are_matches) {
-                    index = largest.first.size() + largest.second;
-                    matches.push_back(SyntaxElement(largest.second + previous.index, type_string, largest.first));
+                uint_type resume = content.size();
+                for (uint_type i = 0; i < context.sync_tokens.size(); i++) {
+                    if (!sync_valid[i] || (next_sync[i] != std::string::npos && next_sync[i] < index)) {
+                        next_sync[i] = content.find(context.sync_tokens[i], index);
+                        sync_valid[i] = true;
+                    }
+                    if (next_sync[i] != std::string::npos) resume = std::min(resume, next_sync[i] + context.sync_tokens[i].size());
                 }
+                auto resume_match = largest_at.lower_bound(resume);
+                resume = (resume_match == largest_at.end()) ? content.size() : resume_match->first;
+                if (resume <= index) resume = index + 1;
+                std::stringstream message;
+                message << "no rule matches \"" << content.substr(index, std::min<uint_type>(resume - index, 32))
+                        << (resume - index > 32 ? "..." : "") << "\", skipped " << (resume - index) << " bytes";
+                context.diagnostics->push_back(Diagnostic(index + previous.index, resume - index, message.str()));
+                index = resume;
+                continue;
             }
-        #ifndef EBNF_GIVE_UP_EASILY
-            index++;
+            #ifdef EBNF_GIVE_UP_EASILY
+            break;
+            #else
+            /*
+                Stepping forward one position at a time would land on the next match
+                anyway, so jump straight to it.
+            */
+            index = next_index;
+            #endif
         }
-        #endif
         return matches;
     }
     
-    Trie<SyntaxElement> recurseParse(const EBNF& grammar, const SyntaxElement& previous) {
+    Trie<SyntaxElement> recurseParse(const EBNF& grammar, const SyntaxElement& previous, const ParseContext& context = ParseContext()) {
+        /*
+            Expands nodes from an explicit work stack instead of recursing, so the
+            nesting depth of a source is only limited by memory. Children are pushed
+            in reverse to expand them in the same order recursion would. A node's
+            child vector is filled completely before any child is pushed, so the
+            pointers on the stack stay valid.
+        */
         Trie<SyntaxElement> tree(previous);
-        auto large_matches = largestMatches(grammar,previous.content,previous);
-        for (uint_type iter = 0; iter < large_matches.size(); iter++) {
-            tree.data.push_back(recurseParse(grammar,large_matches[iter]));
+        std::vector<Trie<SyntaxElement>*> work;
+        work.push_back(&tree);
+        while (!work.empty()) {
+            Trie<SyntaxElement>* node = work.back();
+            work.pop_back();
+            auto large_matches = largestMatches(grammar,node->self.content,node->self,context);
+            node->data.reserve(large_matches.size());
+            for (uint_type iter = 0; iter < large_matches.size(); iter++) {
+                node->data.push_back(Trie<SyntaxElement>(std::move(large_matches[iter])));
+            }
+            for (uint_type iter = node->data.size(); iter > 0; iter--) {
+                work.push_back(&node->data[iter - 1]);
+            }
         }
         return tree;
     }
     
+    void locate(const std::string& source, std::vector<Diagnostic>& diagnostics) {
+        /*
+            Fills in the 1-based line and column of each diagnostic in one pass over
+            the source.
+        */
+        std::vector<Diagnostic*> ordered;
+        for (uint_type i = 0; i < diagnostics.size(); i++) ordered.push_back(&diagnostics[i]);
+        std::sort(ordered.begin(), ordered.end(), [](const Diagnostic* lhs, const Diagnostic* rhs) {
+            return lhs->offset < rhs->offset;
+        });
+        uint_type line = 1;
+        uint_type line_start = 0;
+        uint_type cursor = 0;
+        for (uint_type i = 0; i < ordered.size(); i++) {
+            for (; cursor < ordered[i]->offset && cursor < source.size(); cursor++) {
+                if (source[cursor] == '\n') {
+                    line++;
+                    line_start = cursor + 1;
+                }
+            }
+            ordered[i]->line = line;
+            ordered[i]->column = ordered[i]->offset - line_start + 1;
+        }
+    }
+
+    void hashText(uint64_t& hash, const std::string& content, uint_type begin, uint_type end) {
+        /*
+            Feeds content[begin, end) to a 64-bit FNV-1a hash with every run of
+            whitespace and comments counted as one space, so only edits that change
+            the tokens change the hash. Strings are fed as they are.
+        */
+        uint_type i = begin;
+        while (i < end) {
+            uint_type run = skipTrivia(content, i);
+            if (run > i) {
+                hash = (hash ^ ' ') * 0x100000001b3ULL;
+                i = run;
+                continue;
+            }
+            uint_type stop = i + 1;
+            if (content[i] == '"') {
+                stop = content.find('"', i + 1);
+                stop = (stop == std::string::npos) ? end : stop + 1;
+            }
+            for (; i < stop && i < end; i++) hash = (hash ^ (unsigned char)content[i]) * 0x100000001b3ULL;
+        }
+    }
+
+    void hashTree(Trie<SyntaxElement>& tree) {
+        /*
+            Gives every node a hash of its rule and of its content with offsets left
+            out, children by their own hashes and the text between them normalized
+            by hashText. Equal hashes mean equal structure up to whitespace and
+            comments. Children are hashed before their parents from an explicit
+            stack, so depth is only limited by memory.
+        */
+        std::vector<std::pair<Trie<SyntaxElement>*,bool> > work;
+        work.push_back(std::make_pair(&tree, false));
+        while (!work.empty()) {
+            Trie<SyntaxElement>* node = work.back().first;
+            if (!work.back().second) {
+                work.back().second = true;
+                for (auto& child : node->data) work.push_back(std::make_pair(&child, false));
+                continue;
+            }
+            work.pop_back();
+            uint64_t hash = 0xcbf29ce484222325ULL;
+            for (uint_type i = 0; i <= node->self.identifier.size(); i++) hash = (hash ^ (unsigned char)node->self.identifier.c_str()[i]) * 0x100000001b3ULL;
+            const std::string& content = node->self.content;
+            uint_type at = 0;
+            for (auto& child : node->data) {
+                uint_type begin = std::min(std::max(child.self.index, node->self.index) - node->self.index, uint_type(content.size()));
+                if (begin > at) hashText(hash, content, at, begin);
+                for (uint_type shift = 0; shift < 64; shift += 8) hash = (hash ^ ((child.self.hash >> shift) & 0xff)) * 0x100000001b3ULL;
+                at = std::max(at, std::min(begin + child.self.content.size(), uint_type(content.size())));
+            }
+            if (at < content.size()) hashText(hash, content, at, content.size());
+            node->self.hash = (hash == 0) ? 1 : hash;
+        }
+    }
+
+    Trie<SyntaxElement> buildTree(const EBNF& grammar, const std::string& source, const ParseContext& context) {
+        Trie<SyntaxElement> tree = recurseParse(grammar,SyntaxElement(0,"__syntax_tree_whole__",source),context);
+        if (context.recovering()) locate(source,*context.diagnostics);
+        if (context.hashing) hashTree(tree);
+        return tree;
+    }
+
     Trie<SyntaxElement> buildTree(const EBNF& grammar, const std::string& source) {
         return recurseParse(grammar,SyntaxElement(0,"__syntax_tree_whole__",source));
     }
     
-    void treeSummary(const Trie<SyntaxElement>& tree, uint_type depth = 0) {
-        std::string ws_str;
-        for (uint_type i = 0; i < depth; i++) ws_str += "\t";
-        std::cout << ws_str << "depth:" << depth << " type:" << tree.self.identifier << " index:" << tree.self.index <<  " content:" << std::endl;
-        std::cout << ws_str << "\"" << tree.self.content << "\"" << std::endl;
-        for (uint_type iter = 0; iter < tree.data.size(); iter++) {
-            treeSummary(tree.data[iter],depth + 1);
-        }
+    Trie<SyntaxElement> buildTree(const EBNF& grammar, const std::string& source, const lexer::TokenArray& tokens) {
+        /*
+            Builds the tree over a token array produced by lexer::Lexer::tokenize for
+            the same source.
+        */
+        return recurseParse(grammar,SyntaxElement(0,"__syntax_tree_whole__",source),ParseContext(tokens));
     }
     
+    
 };
 
 #endif
@@ -0,0 +1,320 @@
+#ifndef COMPILE_SERVER_HPP
+#define COMPILE_SERVER_HPP
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "generic-btree.hpp"
+#include "EBNF.hpp"
+#include "BuildSyntaxTree.hpp"
+#include "Lexer.hpp"
+#include "TreeWriter.hpp"
+
+#define SERVER_OUT std::cout << "(Compile server) "
+#define SERVER_ERROUT std::cerr << "(Compile server) Error: "
+
+namespace server {
+
+    /*
+        Framed protocol over a Unix domain stream socket. Every message is a 32-bit
+        big-endian length followed by that many bytes of payload. A connection may
+        carry any number of request/response pairs.
+
+        Request payload:   kind (1 byte) | flags (1 byte) | grammar name | '\0' | body
+        Response payload:  status (1 byte) | text
+
+        An empty grammar name selects the first grammar the server loaded.
+    */
+
+    const char request_path = 'P';      //Body is a path readable by the server
+    const char request_text = 'T';      //Body is the source itself
+    const char request_shutdown = 'Q';  //Stop accepting connections
+    const char status_ok = 'O';
+    const char status_error = 'E';
+    const uint8_t flag_lex = 0b1;
+    const uint32_t max_frame = 1u << 30;
+
+    bool writeAll(int fd, const char* data, uint_type size) {
+        /*
+            A peer that has gone away gives EPIPE rather than SIGPIPE, which
+            would end the whole server, and counts as a dropped connection.
+        */
+        while (size > 0) {
+            ssize_t done = ::send(fd, data, size, MSG_NOSIGNAL);
+            if (done < 0 && errno == EINTR) continue;
+            if (done <= 0) return false;
+            data += done;
+            size -= done;
+        }
+        return true;
+    }
+
+    bool readAll(int fd, char* data, uint_type size) {
+        while (size > 0) {
+            ssize_t done = ::read(fd, data, size);
+            if (done < 0 && errno == EINTR) continue;
+            if (done <= 0) return false;
+            data += done;
+            size -= done;
+        }
+        return true;
+    }
+
+    bool writeFrame(int fd, const std::string& payload) {
+        uint32_t length = htonl(uint32_t(payload.size()));
+        return writeAll(fd, (const char*)&length, sizeof(length)) && writeAll(fd, payload.data(), payload.size());
+    }
+
+    bool readFrame(int fd, std::string& payload) {
+        uint32_t length = 0;
+        if (!readAll(fd, (char*)&length, sizeof(length))) return false;
+        length = ntohl(length);
+        if (length > max_frame) return false;
+        payload.resize(length);
+        return length == 0 || readAll(fd, &payload[0], length);
+    }
+
+    bool socketAddress(const std::string& socket_path, sockaddr_un& address) {
+        /*
+            False if the path does not fit, rather than binding or connecting to
+            a truncated one.
+        */
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path)) return false;
+        std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+        return true;
+    }
+
+    class CompileServer {
+        /*
+            Keeps grammars loaded and their patterns compiled between parses. Each
+            connection is served by its own thread, grammars are only ever read
+            once loaded so parses run concurrently without locking. Open
+            connections are tracked so stop() can end idle ones and serve() can
+            sleep until the last one closes.
+        */
+        private:
+            std::string socket_path;
+            std::vector<std::string> grammar_order;
+            std::map<std::string,std::shared_ptr<const EBNF> > grammars;
+            std::map<std::string,std::shared_ptr<const lexer::Lexer> > lexers;
+            std::atomic<bool> running;
+            std::atomic<int> listen_fd;
+            std::mutex clients_lock;
+            std::condition_variable clients_done;
+            std::set<int> clients;
+
+            std::string handle(const std::string& request) {
+                if (request.size() < 2) return std::string(1,status_error) + "malformed request";
+                char kind = request[0];
+                uint8_t flags = request[1];
+                uint_type name_end = request.find('\0', 2);
+                if (name_end == std::string::npos) return std::string(1,status_error) + "malformed request";
+                std::string name = request.substr(2, name_end - 2);
+                std::string body = request.substr(name_end + 1);
+                if (kind == request_shutdown) {
+                    this->stop();
+                    return std::string(1,status_ok) + "shutting down";
+                }
+                if (name.empty() && this->grammar_order.size() > 0) name = this->grammar_order[0];
+                auto grammar = this->grammars.find(name);
+                if (grammar == this->grammars.end()) return std::string(1,status_error) + "no grammar loaded as \"" + name + "\"";
+                std::string source;
+                if (kind == request_path) {
+                    struct stat info;
+                    if (stat(body.c_str(), &info) != 0 || !S_ISREG(info.st_mode) || ::access(body.c_str(), R_OK) != 0) {
+                        return std::string(1,status_error) + "was not able to read " + body;
+                    }
+                    source = loadIntoString(body);
+                }
+                else if (kind == request_text) source = body;
+                else return std::string(1,status_error) + "unknown request kind";
+                Trie<syntree::SyntaxElement> tree;
+                if ((flags & flag_lex) != 0) tree = syntree::buildTree(*grammar->second,source,this->lexers.at(name)->tokenize(source));
+                else tree = syntree::buildTree(*grammar->second,source);
+                std::stringstream out;
+                out << status_ok << "Parsing complete. Size of tree is: " << tree.size() << '\n';
+                syntree::treeSummary(tree,0,out);
+                return out.str();
+            }
+
+            void serveConnection(int fd) {
+                std::string request;
+                while (readFrame(fd, request)) {
+                    if (!writeFrame(fd, this->handle(request))) break;
+                }
+                std::lock_guard<std::mutex> guard(this->clients_lock);
+                this->clients.erase(fd);
+                ::close(fd);
+                if (this->clients.empty()) this->clients_done.notify_all();
+            }
+
+        public:
+            CompileServer(const std::string& socket_path) : socket_path(socket_path), grammar_order(), grammars(), lexers(),
+                                                              running(false), listen_fd(-1), clients_lock(), clients_done(), clients() {
+            }
+
+            ~CompileServer() {
+                this->stop();
+            }
+
+            bool addGrammar(const std::string& name, const std::string& filename, uint_type grammar_flags = EBNF::flag_file,
+                            const std::vector<std::string>& start_rules = std::vector<std::string>(), uint_type threads = 1) {
+                /*
+                    Must be called before serve(), grammars are not locked.
+                */
+                std::shared_ptr<EBNF> grammar = std::make_shared<EBNF>(filename, grammar_flags & ~EBNF::flag_string, start_rules, threads);
+                if (grammar->size() == 0) {
+                    SERVER_ERROUT << "grammar " << filename << " has no rules." << std::endl;
+                    return false;
+                }
+                if (this->grammars.find(name) == this->grammars.end()) this->grammar_order.push_back(name);
+                this->grammars[name] = grammar;
+                this->lexers[name] = std::make_shared<const lexer::Lexer>(*grammar);
+                return true;
+            }
+
+            bool serve() {
+                /*
+                    Accepts connections until a shutdown request arrives or stop() is
+                    called, then waits for in flight requests to finish.
+                */
+                sockaddr_un address;
+                if (!socketAddress(this->socket_path, address)) {
+                    SERVER_ERROUT << "socket path " << this->socket_path << " is longer than the " << sizeof(address.sun_path) - 1 << " bytes allowed." << std::endl;
+                    return false;
+                }
+                int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+                if (fd < 0) {
+                    SERVER_ERROUT << "was not able to create a socket." << std::endl;
+                    return false;
+                }
+                ::unlink(this->socket_path.c_str());
+                if (::bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(fd, 64) != 0) {
+                    SERVER_ERROUT << "was not able to listen on " << this->socket_path << std::endl;
+                    ::close(fd);
+                    return false;
+                }
+                this->listen_fd = fd;
+                this->running = true;
+                SERVER_OUT << "listening on " << this->socket_path << " with " << this->grammars.size() << " grammar(s)." << std::endl;
+                while (this->running) {
+                    int connection = ::accept(fd, nullptr, nullptr);
+                    if (connection < 0) {
+                        if (errno == EINTR) continue;
+                        break;
+                    }
+                    {
+                        /*
+                            A connection accepted while stop() runs would miss its
+                            shutdown, so it is ended here instead.
+                        */
+                        std::lock_guard<std::mutex> guard(this->clients_lock);
+                        this->clients.insert(connection);
+                        if (!this->running) ::shutdown(connection, SHUT_RD);
+                    }
+                    std::thread(&CompileServer::serveConnection, this, connection).detach();
+                }
+                std::unique_lock<std::mutex> guard(this->clients_lock);
+                this->clients_done.wait(guard, [this]() {
+                    return this->clients.empty();
+                });
+                guard.unlock();
+                ::unlink(this->socket_path.c_str());
+                return true;
+            }
+
+            void stop() {
+                /*
+                    Connections are only shut down for reading: a request being
+                    handled, the shutdown request included, still gets its
+                    response, and idle connections see the end of their input.
+                */
+                bool was_running = this->running.exchange(false);
+                int fd = this->listen_fd.exchange(-1);
+                if (was_running && fd >= 0) {
+                    ::shutdown(fd, SHUT_RDWR);
+                    ::close(fd);
+                }
+                std::lock_guard<std::mutex> guard(this->clients_lock);
+                for (int client : this->clients) ::shutdown(client, SHUT_RD);
+            }
+    };
+
+    class Client {
+        /*
+            Thin client forwarding requests to a running CompileServer.
+        */
+        private:
+            int fd;
+
+        public:
+            Client() : fd(-1) {
+            }
+
+            Client(const std::string& socket_path) : Client() {
+                this->connect(socket_path);
+            }
+
+            ~Client() {
+                if (this->fd >= 0) ::close(this->fd);
+            }
+
+            bool connect(const std::string& socket_path) {
+                if (this->fd >= 0) ::close(this->fd);
+                this->fd = -1;
+                sockaddr_un address;
+                if (!socketAddress(socket_path, address)) return false;
+                this->fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+                if (this->fd < 0 || ::connect(this->fd, (sockaddr*)&address, sizeof(address)) != 0) {
+                    if (this->fd >= 0) ::close(this->fd);
+                    this->fd = -1;
+                    return false;
+                }
+                return true;
+            }
+
+            bool connected() const {
+                return this->fd >= 0;
+            }
+
+            bool request(char kind, const std::string& grammar, const std::string& body, std::string& response, uint8_t flags = 0) {
+                /*
+                    Sends one request and waits for its response. Returns true only if
+                    the server reported success, response holds the text either way.
+                */
+                std::string payload;
+                payload.reserve(body.size() + grammar.size() + 3);
+                payload += kind;
+                payload += char(flags);
+                payload += grammar;
+                payload += '\0';
+                payload += body;
+                std::string reply;
+                if (!this->connected() || !writeFrame(this->fd, payload) || !readFrame(this->fd, reply) || reply.empty()) {
+                    response = "no response from compile server";
+                    return false;
+                }
+                response = reply.substr(1);
+                return reply[0] == status_ok;
+            }
+    };
+};
+
+#endif
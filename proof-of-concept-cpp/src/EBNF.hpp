@@ -12,9 +12,15 @@
 #include <cstdlib>
 #include <cstring>
 #include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
 #include "RegexHelpers.hpp"
 #include "generic-btree.hpp"
 #include "EvalEBNF.hpp"
+#include "RegexOptimizer.hpp"
 
 #ifndef PARSE_TYPE_DEFAULTS
 #define PARSE_TYPE_DEFAULTS
@@ -47,6 +53,10 @@ class EBNF {
     private:
 
         std::string loaded_grammar;
+        bool optimize_regexes;
+        std::vector<std::string> start_rules;
+        uint_type threads;
+        mutable std::mutex lazy_lock;
 
         bool fetchRules(const std::string& content) {
             /*
@@ -91,48 +101,144 @@ class EBNF {
             return true;
         }
 
+        void evaluateFrom(std::vector<std::string> pending) const {
+            /*
+                Evaluates the given rules and every rule they depend on that hasn't
+                been evaluated yet, a wave of newly found dependencies at a time.
+            */
+            while (!pending.empty()) {
+                std::vector<std::string> wave;
+                for (auto& rule_id : pending) {
+                    if (this->regex_map.find(rule_id) == this->regex_map.end() && !oneOf(rule_id,wave)) wave.push_back(rule_id);
+                }
+                pending.clear();
+                std::vector<EvalEBNF::EvaluatedRule> rules = EvalEBNF::evaluateAll(wave,this->id_rule_map,this->string_table,this->threads);
+                for (uint_type i = 0; i < wave.size(); i++) {
+                    for (auto& dependency : rules[i].dependencies) {
+                        if (this->regex_map.find(dependency) == this->regex_map.end() && this->id_rule_map.find(dependency) != this->id_rule_map.end()) {
+                            pending.push_back(dependency);
+                        }
+                    }
+                    this->regex_map[wave[i]] = std::move(rules[i]);
+                }
+            }
+        }
+
         void evaluateRules() {
             /*
-                Evaluate rules into regexes, todo
+                Evaluate rules into regexes. Given start rules only the rules they
+                reach are evaluated, and only the start rules are tried as tree nodes.
             */
             if (this->id_rule_map.size() > 0) {
                 EBNF_OUT << "beginning evaluation of rules..." << std::endl;
-                for (auto& elem : this->id_rule_map) {
-                    this->regex_map[elem.first] = EvalEBNF::evaluate(elem.first,this->id_rule_map,this->string_table);
+                this->regex_map.clear();
+                this->tree_rules.clear();
+                if (this->start_rules.empty()) {
+                    for (auto& elem : this->id_rule_map) this->tree_rules.push_back(elem.first);
+                    std::vector<EvalEBNF::EvaluatedRule> rules = EvalEBNF::evaluateAll(this->tree_rules,this->id_rule_map,this->string_table,this->threads);
+                    for (uint_type i = 0; i < rules.size(); i++) this->regex_map[this->tree_rules[i]] = std::move(rules[i]);
+                }
+                else {
+                    for (auto& rule_id : this->start_rules) {
+                        if (this->id_rule_map.find(rule_id) == this->id_rule_map.end()) {
+                            EBNF_ERROUT << "start rule \"" << rule_id << "\" is not defined." << std::endl;
+                        }
+                        else if (!oneOf(rule_id,this->tree_rules)) this->tree_rules.push_back(rule_id);
+                    }
+                    /*
+                        Rule order decides ties between equally long matches, keep it.
+                    */
+                    std::sort(this->tree_rules.begin(), this->tree_rules.end());
+                    this->evaluateFrom(this->tree_rules);
                 }
+                this->compileRules();
             }
             else {
                 EBNF_ERROUT << "there are no rules to evaluate." << std::endl;
             }
         }
 
+        std::shared_ptr<const pcrecpp::RE> compileRule(const std::string& rule_id) const {
+            std::string assembled = this->regex_map.at(rule_id).assemble(this->regex_map);
+            if (this->optimize_regexes) assembled = regexopt::optimize(assembled);
+            return std::make_shared<const pcrecpp::RE>(assembled);
+        }
+
+        void compileRules() {
+            /*
+                Assemble and compile every tree rule's full regex once, so parses (and
+                every parse served by a long running process) reuse the compiled
+                patterns. Compiled patterns are immutable and shared between copies.
+                Only the assembled pattern is optimized, regex_map keeps what the
+                rules evaluated to. Patterns are independent of each other and are
+                compiled on as many threads as rules are evaluated on.
+            */
+            this->compiled_map.clear();
+            std::vector<std::shared_ptr<const pcrecpp::RE> > compiled(this->tree_rules.size());
+            std::atomic<uint_type> next(0);
+            auto work = [&]() {
+                for (uint_type i = next++; i < this->tree_rules.size(); i = next++) compiled[i] = this->compileRule(this->tree_rules[i]);
+            };
+            std::vector<std::thread> workers;
+            for (uint_type i = 1; i < std::min<uint_type>(this->threads, this->tree_rules.size()); i++) workers.push_back(std::thread(work));
+            work();
+            for (auto& worker : workers) worker.join();
+            for (uint_type i = 0; i < this->tree_rules.size(); i++) this->compiled_map[this->tree_rules[i]] = compiled[i];
+        }
+
     public:
 
+        /*
+            With start rules, rules out of their reach are only evaluated (and any
+            rule not among them only compiled) on first reference through
+            compiled(), so regex_map and compiled_map may grow after loading.
+        */
         EvalEBNF::Ruleset id_rule_map;
-        std::map<std::string,EvalEBNF::EvaluatedRule> regex_map;
+        mutable std::map<std::string,EvalEBNF::EvaluatedRule> regex_map;
+        mutable std::map<std::string,std::shared_ptr<const pcrecpp::RE> > compiled_map;
         std::vector<std::string> string_table;
+        std::vector<std::string> tree_rules;    //Rules tried as syntax tree nodes, in rule order
 
-        EBNF() : id_rule_map(), regex_map() {
+        EBNF() : optimize_regexes(true), start_rules(), threads(1), lazy_lock(), id_rule_map(), regex_map(), compiled_map(), string_table(), tree_rules() {
         }
 
         EBNF(const EBNF& copy) : EBNF() {
             this->id_rule_map = copy.id_rule_map;
             this->regex_map = copy.regex_map;
+            this->compiled_map = copy.compiled_map;
             this->loaded_grammar = copy.loaded_grammar;
+            this->optimize_regexes = copy.optimize_regexes;
+            this->start_rules = copy.start_rules;
+            this->threads = copy.threads;
             this->string_table = copy.string_table;
+            this->tree_rules = copy.tree_rules;
         }
 
         EBNF(EBNF&& move) : EBNF() {
             std::swap(this->id_rule_map, move.id_rule_map);
             std::swap(this->regex_map, move.regex_map);
+            std::swap(this->compiled_map, move.compiled_map);
             std::swap(this->loaded_grammar, move.loaded_grammar);
+            std::swap(this->optimize_regexes, move.optimize_regexes);
+            std::swap(this->start_rules, move.start_rules);
+            std::swap(this->threads, move.threads);
             std::swap(this->string_table, move.string_table);
+            std::swap(this->tree_rules, move.tree_rules);
         }
 
         const static uint_type flag_file = 0b0;
         const static uint_type flag_string = 0b1;
+        const static uint_type flag_no_regex_opt = 0b10;   //Compile assembled patterns exactly as evaluated
 
-        EBNF(const std::string& content, uint_type stringtype_flag = flag_string) : EBNF() {
+        EBNF(const std::string& content, uint_type stringtype_flag = flag_string,
+             const std::vector<std::string>& start_rules = std::vector<std::string>(), uint_type threads = 1) : EBNF() {
+            /*
+                threads is the number of rules evaluated and compiled at once, 0 for
+                one per hardware thread. The result doesn't depend on it.
+            */
+            this->optimize_regexes = (stringtype_flag & flag_no_regex_opt) == 0;
+            this->start_rules = start_rules;
+            this->threads = (threads > 0) ? threads : std::max<uint_type>(1, std::thread::hardware_concurrency());
             if ((stringtype_flag & flag_string) != 0) {
                 /*
                     The string provided is a grammar in string form
@@ -208,6 +314,36 @@ class EBNF {
             return tree_new;
         }
 
+        const pcrecpp::RE& compiled(const std::string& rule_id) const {
+            /*
+                Returns the compiled, assembled regex for a rule. Rules left out when
+                loading from start rules are evaluated and compiled here, under a
+                lock as grammars are shared between threads.
+            */
+            if (this->start_rules.empty()) return *this->compiled_map.at(rule_id);
+            std::lock_guard<std::mutex> guard(this->lazy_lock);
+            auto found = this->compiled_map.find(rule_id);
+            if (found != this->compiled_map.end()) return *found->second;
+            if (this->id_rule_map.find(rule_id) == this->id_rule_map.end()) throw std::out_of_range("no rule named " + rule_id);
+            this->evaluateFrom(std::vector<std::string>(1, rule_id));
+            std::shared_ptr<const pcrecpp::RE> regex = this->compileRule(rule_id);
+            this->compiled_map[rule_id] = regex;
+            return *regex;
+        }
+
+        const EvalEBNF::KeywordMatcher* keywords(const std::string& rule_id) const {
+            /*
+                The keyword trie of a rule that is only literal alternatives, nullptr
+                for any other rule. Like compiled(), evaluates the rule first if
+                it was left out when loading.
+            */
+            this->compiled(rule_id);
+            std::unique_lock<std::mutex> guard(this->lazy_lock, std::defer_lock);
+            if (!this->start_rules.empty()) guard.lock();
+            const EvalEBNF::KeywordMatcher& matcher = this->regex_map.at(rule_id).keywords;
+            return matcher.empty() ? nullptr : &matcher;
+        }
+
         uint_type size() {
             /*
                 Returns the number of rules.
@@ -215,7 +351,15 @@ class EBNF {
             return this->id_rule_map.size();
         }
 
-        std::string grammar() {
+        bool optimizing() const {
+            return this->optimize_regexes;
+        }
+
+        const std::vector<std::string>& startRules() const {
+            return this->start_rules;
+        }
+
+        std::string grammar() const {
             return this->loaded_grammar;
         }
 
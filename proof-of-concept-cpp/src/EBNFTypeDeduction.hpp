@@ -36,6 +36,19 @@ namespace EvalEBNF {
             Main type deduction happens here, with each type requiring a number
         */
         if (segment.empty()) return false;
+        /*
+            Patterns are compiled once, deduction runs for every segment of every
+            rule while a grammar loads.
+        */
+        static const pcrecpp::RE alternation_regex("(\\|)");
+        static const pcrecpp::RE group_regex(genRegexBetweenStrings("(",")",true));
+        static const pcrecpp::RE option_regex(genRegexBetweenStrings("[","]",true));
+        static const pcrecpp::RE repeat_regex(genRegexBetweenStrings("{","}",true));
+        static const pcrecpp::RE concatination_regex("(,)");
+        static const pcrecpp::RE terminal_regex(genRegexBetweenStrings("str@<",">",true));
+        static const pcrecpp::RE nonspace_regex("(\\S)");
+        static const pcrecpp::RE identifier_regex(EBNF_REGEX_ID_LONE);
+        static const pcrecpp::RE setrepeat_regex("((\\*(\\s*)[0-9]+)|([0-9]+\\s*\\*))");
         switch (type) {
             case types::alternation:
                 /*
@@ -46,18 +59,18 @@ namespace EvalEBNF {
                      && !(isType(segment,types::option))
                      && !(isType(segment,types::repeat))
                      && !(isType(segment,types::concatination))
-                     && !(RegexHelper::firstMatch("(\\|)",segment).empty()));
+                     && !(RegexHelper::firstMatch(alternation_regex,segment).empty()));
             case types::group:
                 /*
                     Container types. A segment is only considered to be a container
                     type if the first match for that container is equal to the entire
                     original segment.
                 */
-                return (RegexHelper::firstMatch(genRegexBetweenStrings("(",")",true),segment) == segment);
+                return (RegexHelper::firstMatch(group_regex,segment) == segment);
             case types::option:
-                return (RegexHelper::firstMatch(genRegexBetweenStrings("[","]",true),segment) == segment);
+                return (RegexHelper::firstMatch(option_regex,segment) == segment);
             case types::repeat:
-                return (RegexHelper::firstMatch(genRegexBetweenStrings("{","}",true),segment) == segment);
+                return (RegexHelper::firstMatch(repeat_regex,segment) == segment);
             case types::concatination:
                 /*
                     Concatination type. Concatinations are only considered such if they
@@ -66,7 +79,7 @@ namespace EvalEBNF {
                 return (!(isType(segment, types::group))
                      && !(isType(segment, types::option))
                      && !(isType(segment, types::repeat))
-                     && !(RegexHelper::firstMatch("(,)",segment).empty()));
+                     && !(RegexHelper::firstMatch(concatination_regex,segment).empty()));
             case types::terminal:
                 /*
                     Terminal type. As strings are stripped from the source before processing
@@ -75,7 +88,7 @@ namespace EvalEBNF {
                     testing for container types in that the index is contained by the strings
                     "str@<" and ">".
                 */
-                return ((RegexHelper::firstMatch(genRegexBetweenStrings("str@<",">",true),segment) == segment));
+                return ((RegexHelper::firstMatch(terminal_regex,segment) == segment));
             case types::special:
                 /*
                     Special type. Checked for by seeing if it's neither a concatination or an
@@ -84,15 +97,15 @@ namespace EvalEBNF {
                 return (segment.size() > 1
                      && !(isType(segment, types::concatination))
                      && !(isType(segment, types::alternation))
-                     && RegexHelper::firstMatch("(\\S)",segment) == "?"
-                     && RegexHelper::lastMatch("(\\S)",segment) == "?");
+                     && RegexHelper::firstMatch(nonspace_regex,segment) == "?"
+                     && RegexHelper::lastMatch(nonspace_regex,segment) == "?");
             case types::identifier:
                 /*
                     Identifier type. Checked for with the same regex used to pull the identifier
                     from the grammar. If it's the same as the whole segment, then it matches an
                     identifier.
                 */
-                return (RegexHelper::firstMatch(EBNF_REGEX_ID_LONE,segment) == segment);
+                return (RegexHelper::firstMatch(identifier_regex,segment) == segment);
             case types::negation:
                 /*
                     Negation type. If the segment is neither a concatination or an alternation
@@ -101,7 +114,7 @@ namespace EvalEBNF {
                 */
                 return (!(isType(segment, types::concatination))
                      && !(isType(segment, types::alternation))
-                     && (RegexHelper::firstMatch("(\\S)",segment) == "-"));
+                     && (RegexHelper::firstMatch(nonspace_regex,segment) == "-"));
             case types::setrepeat:
                 /*
                     Set repeat type. This type denotes a set number of repetitions for a match.
@@ -113,7 +126,7 @@ namespace EvalEBNF {
                      && !(isType(segment, types::group))
                      && !(isType(segment, types::option))
                      && !(isType(segment, types::repeat))
-                     && !(RegexHelper::firstMatch("((\\*(\\s*)[0-9]+)|([0-9]+\\s*\\*))",segment).empty());
+                     && !(RegexHelper::firstMatch(setrepeat_regex,segment).empty()));
             default:
                 /*
                     Unnknown type check, always return false.
@@ -137,6 +150,25 @@ namespace EvalEBNF {
         return (types::typelist[types::typelist.size() - 1]) + 1;
     }
 
+    std::string typeName(uint_type segment_type) {
+        /*
+            Returns a string descriptor for a type constant from type().
+        */
+        switch (segment_type) {
+            case types::alternation:   return "alternation";
+            case types::group:         return "group";
+            case types::option:        return "option";
+            case types::repeat:        return "repeat";
+            case types::concatination: return "concatination";
+            case types::terminal:      return "terminal";
+            case types::special:       return "special";
+            case types::identifier:    return "identifier";
+            case types::negation:      return "negation";
+            case types::setrepeat:     return "setrepeat";
+            default:                   return "notype";
+        }
+    }
+
     std::string typeStr(const std::string& segment) {
         /*
             Returns a string descriptor for the type of a segment.
@@ -12,8 +12,13 @@
 #include <cstdlib>
 #include <cstring>
 #include <stdexcept>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <algorithm>
 #include "RegexHelpers.hpp"
 #include "EBNFTypeDeduction.hpp"
+#include "KeywordTrie.hpp"
 
 
 const std::vector<std::pair<std::string, std::string> >ebnf_cont_str = {
@@ -37,14 +42,41 @@ const std::vector<std::pair<std::string, std::string> >ebnf_cont_str = {
 #define EBNF_S_ALL ebnf_cont_str
 
 
-#define EBNF_EVAL_OUT std::cout << "(EBNF Evaluation) "
-#define EBNF_EVAL_ERROUT std::cerr << "(EBNF Evaluation) Error: "
-#define EBNF_EVAL_WARNOUT std::cout << "(EBNF Evaluation) Warning: "
+#define EBNF_EVAL_OUT EvalEBNF::logStream() << "(EBNF Evaluation) "
+#define EBNF_EVAL_ERROUT EvalEBNF::errorStream() << "(EBNF Evaluation) Error: "
+#define EBNF_EVAL_WARNOUT EvalEBNF::logStream() << "(EBNF Evaluation) Warning: "
 
 namespace EvalEBNF {
 
     typedef std::map<std::string,std::string> Ruleset;
 
+    /*
+        Evaluation output goes through per thread streams, so rules evaluated in
+        parallel can have theirs buffered and written out in rule order.
+    */
+    thread_local std::ostream* log_stream = nullptr;
+    thread_local std::ostream* error_stream = nullptr;
+
+    std::ostream& logStream() {
+        return (log_stream != nullptr) ? *log_stream : std::cout;
+    }
+
+    std::ostream& errorStream() {
+        return (error_stream != nullptr) ? *error_stream : std::cerr;
+    }
+
+    struct FatalEvaluation {
+    };
+
+    void fatal() {
+        /*
+            A buffered evaluation unwinds to evaluateAll instead, which writes out
+            every log up to the failing rule's before exiting the same way.
+        */
+        if (log_stream != nullptr) throw FatalEvaluation();
+        exit(-1);
+    }
+
 
     std::string stripComments(const std::string& content) {
         /*
@@ -54,87 +86,220 @@ namespace EvalEBNF {
         return RegexHelper::strip(genRegexBetweenStrings("(*","*)"),content);
     }
 
-    std::vector<std::string> splitSeperators(const std::string& between, const std::string segment) {
+    class ScratchArena {
+        /*
+            Bump allocator for the temporary segment strings made while evaluating
+            rules. Slots are handed out in stack order and keep their capacity when
+            the arena is rewound, so once the first few rules have been evaluated
+            no further allocation happens. Everything is released in one step by
+            clear(). Slots live in a deque so handing out more never moves them.
+        */
+        private:
+            std::deque<std::string> slots;
+            uint_type top;
+
+        public:
+            ScratchArena() : slots(), top(0) {
+            }
+
+            std::string& acquire() {
+                if (this->top == this->slots.size()) this->slots.emplace_back();
+                std::string& slot = this->slots[this->top++];
+                slot.clear();
+                return slot;
+            }
+
+            std::string& at(uint_type slot) {
+                return this->slots[slot];
+            }
+
+            uint_type mark() const {
+                return this->top;
+            }
+
+            void rewind(uint_type mark) {
+                this->top = mark;
+            }
+
+            void clear() {
+                std::deque<std::string>().swap(this->slots);
+                this->top = 0;
+            }
+    };
+
+    void trimInto(const std::string& segment, std::string& out) {
+        /*
+            Copies segment without surrounding whitespace, the same text the regex
+            "((\S+(\s|\S)*\S+)|\S)" would pick out, without compiling it.
+        */
+        const char* whitespace = " \t\n\r\f\v";
+        uint_type first = segment.find_first_not_of(whitespace);
+        if (first == std::string::npos) return;
+        uint_type last = segment.find_last_not_of(whitespace);
+        out.append(segment, first, last - first + 1);
+    }
+
+    void quoteMetaInto(const std::string& unquoted, std::string& out) {
+        /*
+            Appends unquoted with every character escaped the way
+            pcrecpp::RE::QuoteMeta escapes it.
+        */
+        for (uint_type i = 0; i < unquoted.size(); i++) {
+            unsigned char c = unquoted[i];
+            if ((c < 'a' || c > 'z') && (c < 'A' || c > 'Z') && (c < '0' || c > '9') && c != '_' && !(c & 128)) {
+                if (c == '\0') {
+                    out += "\\x00";
+                    continue;
+                }
+                out += '\\';
+            }
+            out += char(c);
+        }
+    }
+
+    uint_type splitSeperators(const std::string& between, const std::string& segment, ScratchArena& arena) {
+        /*
+            Splits segment on the separator characters in between, stitching back
+            together pieces that fall inside containers. The pieces are placed in
+            consecutive arena slots starting at the arena's mark on entry, and the
+            number of pieces is returned.
+        */
+        uint_type first_slot = arena.mark();
         auto results = RegexHelper::splitBetweenCharRaw(between,segment);
-        std::vector<std::string> stiched;
-        if (results.size() == 0) return stiched;
-        stiched.push_back(results[0].first);
-        if (results.size() > 1) for (uint_type iter = 1; iter < results.size(); iter++) {
+        if (results.size() == 0) return 0;
+        arena.acquire() = results[0].first;
+        if (results.size() > 1) {
             /*
-                Stitch together any matches that occured between containers.
+                Container matches don't depend on the piece being looked at, so they
+                are found once up front.
             */
-            bool collided = false;
-            for (auto& elem : EBNF_S_ALL) {
-                std::string regex = genRegexBetweenStrings(elem.first,elem.second,true);
-                auto between_matches = RegexHelper::getListOfMatches(regex,segment);
-                if (between_matches.size() == 0) continue;
-                for (uint_type iter_coll = 0; iter_coll < between.size() && !collided; iter_coll++) {
-                    collided = (results[iter].second >= between_matches[iter_coll].second
-                             && results[iter].second + results[iter].first.size() - 1
-                             <= between_matches[iter_coll].second + between_matches[iter_coll].first.size() - 1);
+            static const std::vector<pcrecpp::RE> container_regexes = []() {
+                std::vector<pcrecpp::RE> regexes;
+                for (auto& elem : EBNF_S_ALL) regexes.push_back(pcrecpp::RE(genRegexBetweenStrings(elem.first,elem.second,true)));
+                return regexes;
+            }();
+            std::vector<std::vector<std::pair<std::string,uint_type> > > container_matches;
+            container_matches.reserve(container_regexes.size());
+            for (auto& regex : container_regexes) container_matches.push_back(RegexHelper::getListOfMatches(regex,segment));
+            for (uint_type iter = 1; iter < results.size(); iter++) {
+                /*
+                    Stitch together any matches that occured between containers.
+                */
+                bool collided = false;
+                for (auto& between_matches : container_matches) {
+                    if (between_matches.size() == 0) continue;
+                    for (uint_type iter_coll = 0; iter_coll < between.size() && !collided; iter_coll++) {
+                        collided = (results[iter].second >= between_matches[iter_coll].second
+                                 && results[iter].second + results[iter].first.size() - 1
+                                 <= between_matches[iter_coll].second + between_matches[iter_coll].first.size() - 1);
+                    }
+                }
+                if (!collided) {
+                    arena.acquire() = results[iter].first;
+                }
+                else {
+                    std::string& end = arena.at(arena.mark() - 1);
+                    EBNF_EVAL_OUT << "End is currently: " << end << ", stiching: " << results[iter].first << std::endl;
+                    end += results[iter].first;
                 }
-            }
-            if (!collided) {
-                stiched.push_back(results[iter].first);
-            }
-            else {
-                EBNF_EVAL_OUT << "End is currently: " << stiched[stiched.size() - 1] << ", stiching: " << results[iter].first << std::endl;
-                stiched[stiched.size() - 1] += results[iter].first;
             }
         }
+        return arena.mark() - first_slot;
+    }
+
+    std::vector<std::string> splitSeperators(const std::string& between, const std::string segment) {
+        ScratchArena arena;
+        uint_type count = splitSeperators(between,segment,arena);
+        std::vector<std::string> stiched;
+        for (uint_type i = 0; i < count; i++) stiched.push_back(std::move(arena.at(i)));
         return stiched;
     }
 
-    std::string evaluateSegment(const std::string& given_segment,
-                                const Ruleset& ruleset,
-                                const std::vector<std::string>& string_table,
-                                Stack<std::string>& id_stack,
-                                Stack<std::string>& depends_stack) {
-        std::string segment = RegexHelper::firstMatch("((\\S+(\\s|\\S)*\\S+)|\\S)",given_segment);
-        std::string regex = "(";
+    bool terminalIndex(const std::string& segment, int& index) {
+        /*
+            Terminals are "str@<index>", read the digits directly.
+        */
+        uint_type count = 0;
+        index = 0;
+        for (uint_type i = 0; i < segment.size(); i++) {
+            if (segment[i] >= '0' && segment[i] <= '9') {
+                index = index * 10 + (segment[i] - '0');
+                count++;
+            }
+        }
+        return count > 0;
+    }
+
+    void evaluateSegment(const std::string& given_segment,
+                         const Ruleset& ruleset,
+                         const std::vector<std::string>& string_table,
+                         std::vector<std::string>& id_stack,
+                         std::vector<std::string>& depends_stack,
+                         std::string& regex,
+                         ScratchArena& arena) {
+        /*
+            Appends the regex for a segment to the end of regex. Temporary text is
+            taken from the arena, which is rewound to where it was on return.
+        */
+        uint_type arena_mark = arena.mark();
+        uint_type regex_start = regex.size();
+        std::string& segment = arena.acquire();
+        trimInto(given_segment,segment);
         std::string match;
         std::string temp;
         int temp_num = 0;
-        std::vector<std::string> rules;
-        EBNF_EVAL_OUT << "segment type for: " << segment << " is " << typeStr(segment) << std::endl;
-        if (segment.size() == 0) return "";
-        switch(type(segment)) {
+        uint_type count = 0;
+        uint_type first = 0;
+        uint_type inner = 0;
+        uint_type segment_type = type(segment);
+        EBNF_EVAL_OUT << "segment type for: " << segment << " is " << typeName(segment_type) << std::endl;
+        if (segment.size() == 0) {
+            arena.rewind(arena_mark);
+            return;
+        }
+        regex += '(';
+        switch(segment_type) {
             case types::alternation:
-                rules = splitSeperators("|",segment);
-                for (uint_type iter = 0; iter < rules.size(); iter++) {
-                    regex += evaluateSegment(rules[iter],ruleset,string_table,id_stack,depends_stack);
-                    if (iter < rules.size() - 1) regex += "|";
+                first = arena.mark();
+                count = splitSeperators("|",segment,arena);
+                for (uint_type iter = 0; iter < count; iter++) {
+                    evaluateSegment(arena.at(first + iter),ruleset,string_table,id_stack,depends_stack,regex,arena);
+                    if (iter < count - 1) regex += '|';
                 }
                 break;
             case types::group:
-                regex += "(";
-                regex += evaluateSegment(segment.substr(1,segment.size() - 2),ruleset,string_table,id_stack,depends_stack);
-                regex += ")";
+                regex += '(';
+                inner = arena.mark();
+                arena.acquire().assign(segment, 1, segment.size() - 2);
+                evaluateSegment(arena.at(inner),ruleset,string_table,id_stack,depends_stack,regex,arena);
+                regex += ')';
                 break;
             case types::option:
                 regex += "(?:";
-                regex += evaluateSegment(segment.substr(1,segment.size() - 2),ruleset,string_table,id_stack,depends_stack);
+                inner = arena.mark();
+                arena.acquire().assign(segment, 1, segment.size() - 2);
+                evaluateSegment(arena.at(inner),ruleset,string_table,id_stack,depends_stack,regex,arena);
                 regex += ")?";
                 break;
             case types::repeat:
-                regex += "(";
-                regex += evaluateSegment(segment.substr(1,segment.size() - 2),ruleset,string_table,id_stack,depends_stack);
+                regex += '(';
+                inner = arena.mark();
+                arena.acquire().assign(segment, 1, segment.size() - 2);
+                evaluateSegment(arena.at(inner),ruleset,string_table,id_stack,depends_stack,regex,arena);
                 regex += ")+";
                 break;
             case types::concatination:
-                rules = splitSeperators(",",segment);
-                for (uint_type iter = 0; iter < rules.size(); iter++) {
-                    regex += evaluateSegment(rules[iter],ruleset,string_table,id_stack,depends_stack);
+                first = arena.mark();
+                count = splitSeperators(",",segment,arena);
+                for (uint_type iter = 0; iter < count; iter++) {
+                    evaluateSegment(arena.at(first + iter),ruleset,string_table,id_stack,depends_stack,regex,arena);
                 }
                 break;
             case types::terminal:
-                try {
-                    temp_num = std::stoi(RegexHelper::strip("([^0-9]+)",segment));
-                }
-                catch (std::invalid_argument& err) {
+                if (!terminalIndex(segment,temp_num)) {
                     EBNF_EVAL_ERROUT << "Could not load number from: " << segment << std::endl;
                 }
-                regex += pcrecpp::RE::QuoteMeta(string_table[temp_num]);
+                quoteMetaInto(string_table[temp_num],regex);
                 break;
             case types::special:
                 /*
@@ -162,46 +327,89 @@ namespace EvalEBNF {
                         generated_id.clear();
                         generated_id << id_stack[0] << "_" << id_num;
                         id_num--;
-                    } while (id_stack.contains(generated_id.str()) && id_num != 0);
+                    } while (oneOf(generated_id.str(),id_stack) && id_num != 0);
                     /*
                         A unique ID has been generated and must be pushed to the stack to prevent
                         a duplicate.
                     */
-                    id_stack.push(generated_id.str());
+                    id_stack.push_back(generated_id.str());
                     /*
                         Replace all instances of "(?R)" with \g'generated_id'
                     */
                     std::string replace_with = "\\g'" + generated_id.str() + "'";
                     pcrecpp::RE(pcrecpp::RE::QuoteMeta("(?R)")).GlobalReplace(replace_with.c_str(),&match);
-                    regex = std::string("((?P<") + generated_id.str() + ">(" + match + ")){0})" + regex;
+                    regex.insert(regex_start, std::string("((?P<") + generated_id.str() + ">(" + match + ")){0})");
                 }
                 else {
                     /*
                         Regex contains no instance of "(?R)" self-recursion, and needs no further
                         processing.
                     */
-                    regex += match.substr(1,match.size() - 2);
+                    regex.append(match, 1, match.size() - 2);
                 }
                 break;
             case types::identifier:
-                temp = RegexHelper::firstMatch(EBNF_REGEX_ID_LONE,segment);
-                if (!depends_stack.contains(temp)) depends_stack.push(temp);
-                else EBNF_EVAL_WARNOUT << "Circular dependancy on type \"" << temp << "\"" << std::endl;
-                regex += ("\\g'" + temp + "'");
+                /*
+                    The segment only has this type if it is exactly an identifier.
+                */
+                if (!oneOf(segment,depends_stack)) depends_stack.push_back(segment);
+                else EBNF_EVAL_WARNOUT << "Circular dependancy on type \"" << segment << "\"" << std::endl;
+                regex += "\\g'";
+                regex += segment;
+                regex += '\'';
                 break;
             case types::negation:
                 break;
             case types::setrepeat:
-                temp_num = std::stoi(lastMatch("([0-9]+)",segment));
+                temp_num = std::stoi(RegexHelper::lastMatch("([0-9]+)",segment));
 
                 break;
             default:
                 EBNF_EVAL_ERROUT << "rule segment \"" << segment << "\" has no known evaluation type." << std::endl;
-                exit(-1);
+                fatal();
                 break;
         }
-        regex += ")";
-        return regex;
+        regex += ')';
+        arena.rewind(arena_mark);
+    }
+
+    bool literalAlternatives(const std::string& given_segment,
+                             const Ruleset& ruleset,
+                             const std::vector<std::string>& string_table,
+                             std::vector<std::string>& id_stack,
+                             std::vector<std::string>& literals) {
+        /*
+            Whether a segment is an ordered alternation of nothing but non-empty
+            terminals, appending them in order to literals if so. Groups are looked
+            through and rules made of literals are spliced in where they are
+            named, PCRE tries their alternatives in that same order.
+        */
+        std::string segment;
+        trimInto(given_segment,segment);
+        int index = 0;
+        switch (type(segment)) {
+            case types::terminal:
+                if (!terminalIndex(segment,index) || uint_type(index) >= string_table.size() || string_table[index].empty()) return false;
+                literals.push_back(string_table[index]);
+                return true;
+            case types::alternation:
+                for (auto& alternative : splitSeperators("|",segment)) {
+                    if (!literalAlternatives(alternative,ruleset,string_table,id_stack,literals)) return false;
+                }
+                return true;
+            case types::group:
+                return literalAlternatives(segment.substr(1, segment.size() - 2),ruleset,string_table,id_stack,literals);
+            case types::identifier: {
+                auto found = ruleset.find(segment);
+                if (found == ruleset.end() || oneOf(segment,id_stack)) return false;
+                id_stack.push_back(segment);
+                bool literal = literalAlternatives(found->second,ruleset,string_table,id_stack,literals);
+                id_stack.pop_back();
+                return literal;
+            }
+            default:
+                return false;
+        }
     }
 
     struct EvaluatedRule {
@@ -209,8 +417,9 @@ namespace EvalEBNF {
         std::string original;
         std::string regex;
         std::vector<std::string> dependencies;
+        KeywordMatcher keywords;    //Empty unless the rule is only literal alternatives
 
-        EvaluatedRule() : rule_id(), original(), regex(), dependencies() {
+        EvaluatedRule() : rule_id(), original(), regex(), dependencies(), keywords() {
         }
 
         EvaluatedRule(const EvaluatedRule& copy) : EvaluatedRule() {
@@ -218,6 +427,7 @@ namespace EvalEBNF {
             this->regex = copy.regex;
             this->dependencies = copy.dependencies;
             this->rule_id = copy.rule_id;
+            this->keywords = copy.keywords;
         }
 
         EvaluatedRule(EvaluatedRule&& move) : EvaluatedRule() {
@@ -225,16 +435,17 @@ namespace EvalEBNF {
             std::swap(this->original,move.original);
             std::swap(this->regex,move.regex);
             std::swap(this->dependencies,move.dependencies);
+            std::swap(this->keywords,move.keywords);
         }
 
         EvaluatedRule(const std::string rule_id,
                       const std::string original,
                       const std::string regex,
-                      const Stack<std::string> dependencies) : EvaluatedRule() {
+                      const std::vector<std::string> dependencies) : EvaluatedRule() {
             this->rule_id = rule_id;
             this->original = original;
             this->regex = regex;
-            this->dependencies = std::vector<std::string>(dependencies);
+            this->dependencies = dependencies;
         }
 
         ~EvaluatedRule() {
@@ -245,72 +456,150 @@ namespace EvalEBNF {
             this->original = copy.original;
             this->regex = copy.regex;
             this->dependencies = copy.dependencies;
+            this->keywords = copy.keywords;
+            return *this;
+        }
+
+        EvaluatedRule& operator= (EvaluatedRule&& move) {
+            std::swap(this->rule_id,move.rule_id);
+            std::swap(this->original,move.original);
+            std::swap(this->regex,move.regex);
+            std::swap(this->dependencies,move.dependencies);
+            std::swap(this->keywords,move.keywords);
             return *this;
         }
 
         std::string assemble(const std::map<std::string,EvaluatedRule>& rules) const {
-            Stack<std::string> depends_stack;
-            depends_stack.push(this->rule_id);
-            std::string regex = ("(" + this->assembleNocall(rules,depends_stack) + "\\g'" + this->rule_id + "')");
+            std::vector<std::string> depends_stack;
+            std::string regex;
+            regex += '(';
+            this->assembleNocall(rules,depends_stack,regex);
+            regex += "\\g'";
+            regex += this->rule_id;
+            regex += "')";
             return regex;
         }
 
-        std::string assembleNocall(const std::map<std::string,EvaluatedRule>& rules, Stack<std::string>& depends_stack) const {
-            std::string assembled;
-            depends_stack.push(this->rule_id);
+        void assembleNocall(const std::map<std::string,EvaluatedRule>& rules, std::vector<std::string>& depends_stack, std::string& assembled) const {
+            /*
+                Appends the definitions of every rule this one depends on, each only
+                once, followed by this rule's own definition.
+            */
+            depends_stack.push_back(this->rule_id);
             for (uint_type i = 0; i < this->dependencies.size(); i++) {
                 try {
                     /*
                         Add dependency only if it's not already in the stack
                     */
-                    if (!depends_stack.contains(dependencies[i])) assembled += rules.at(dependencies[i]).assembleNocall(rules,depends_stack);
+                    if (!oneOf(dependencies[i],depends_stack)) rules.at(dependencies[i]).assembleNocall(rules,depends_stack,assembled);
                 }
                 catch (const std::out_of_range& oor) {
                     EBNF_EVAL_ERROUT << "fetching rule with ID " << dependencies[i] << " for assembly threw out of range error with: " << oor.what() << std::endl;
                     exit(0);
-                    return "";
+                    return;
                 }
             }
             assembled += this->regex;
-            return assembled;
         }
     };
 
-    EvaluatedRule evaluate(const std::string& rule_id, const Ruleset& ruleset, const std::vector<std::string>& string_table) {
+    EvaluatedRule evaluate(const std::string& rule_id, const Ruleset& ruleset, const std::vector<std::string>& string_table, ScratchArena& arena) {
         /*
             Note: declaring a named expression as ((?P<name>(group)){0}) essentially works
             as a function declaration, able to be called later with \g'name' ect.
         */
+        EvaluatedRule rule;
+        auto found = ruleset.find(rule_id);
+        if (found == ruleset.end()) {
+            EBNF_EVAL_ERROUT << "fetching ID " << rule_id << " from ruleset failed, there is no such rule." << std::endl;
+            return rule;
+        }
         /*
-            Declare regex header.
+            Declare regex header. The rule's own regex is the output buffer for the
+            whole evaluation, sized up front from the rule's text.
         */
-        std::string regex = "((?P<" + rule_id + ">(";
+        rule.regex.reserve(rule_id.size() + 4 * found->second.size() + 16);
+        rule.regex += "((?P<";
+        rule.regex += rule_id;
+        rule.regex += ">(";
         /*
-            The ID stack just acts as a container for what IDs are currently declared. A stack
-            seems like an illogical choice but it's the easiest declared type with a contained.
+            The ID stack just acts as a container for what IDs are currently declared.
         */
-        Stack<std::string> depends_stack;
-        Stack<std::string> id_stack;
+        std::vector<std::string> id_stack;
         /*
             Push the given ID on to the stack.
         */
-        id_stack.push(rule_id);
-        try {
-            regex += evaluateSegment(ruleset.at(rule_id),ruleset,string_table,id_stack,depends_stack) + ")){0})";
-        }
-        catch (const std::out_of_range& oor) {
-            EBNF_EVAL_ERROUT << "fetching ID " << rule_id << " from ruleset threw out of range error: " << oor.what() << std::endl;
-            return EvaluatedRule();
-        }
-        EvaluatedRule rule;
+        id_stack.push_back(rule_id);
+        evaluateSegment(found->second,ruleset,string_table,id_stack,rule.dependencies,rule.regex,arena);
+        rule.regex += ")){0})";
+        rule.rule_id = rule_id;
+        rule.original = found->second;
         /*
-            Manually copy data to the rule.
+            Alternations of two or more literals are also given a keyword trie for
+            the tree builder, the regex stays for rules that call this one.
         */
-        rule.rule_id = rule_id;
-        rule.original = ruleset.at(rule_id);
-        rule.regex = regex;
-        rule.dependencies = depends_stack;
+        std::vector<std::string> literals;
+        id_stack.assign(1, rule_id);
+        if (literalAlternatives(found->second,ruleset,string_table,id_stack,literals) && literals.size() > 1) {
+            rule.keywords = KeywordMatcher(literals);
+            EBNF_EVAL_OUT << "rule " << rule_id << " is " << literals.size() << " literals, matched by a keyword trie of "
+                          << rule.keywords.nodes() << " nodes" << std::endl;
+        }
         return rule;
     }
+
+    EvaluatedRule evaluate(const std::string& rule_id, const Ruleset& ruleset, const std::vector<std::string>& string_table) {
+        ScratchArena arena;
+        return evaluate(rule_id,ruleset,string_table,arena);
+    }
+
+    std::vector<EvaluatedRule> evaluateAll(const std::vector<std::string>& rule_ids,
+                                           const Ruleset& ruleset,
+                                           const std::vector<std::string>& string_table,
+                                           uint_type threads = 1) {
+        /*
+            Evaluates each rule in rule_ids, returning them in the same order.
+            Evaluation only reads the ruleset and string table, so with more than
+            one thread rules are handed out to workers with an arena of their own.
+            Each rule's log is buffered and written out in order afterwards, which
+            leaves the output byte for byte what a serial evaluation prints.
+        */
+        std::vector<EvaluatedRule> rules(rule_ids.size());
+        threads = std::min<uint_type>(threads, rule_ids.size());
+        if (threads <= 1) {
+            ScratchArena arena;
+            for (uint_type i = 0; i < rule_ids.size(); i++) rules[i] = evaluate(rule_ids[i],ruleset,string_table,arena);
+            return rules;
+        }
+        std::vector<std::stringstream> logs(rule_ids.size());
+        std::vector<std::stringstream> errors(rule_ids.size());
+        std::vector<uint8_t> failed(rule_ids.size(), 0);
+        std::atomic<uint_type> next(0);
+        auto work = [&]() {
+            ScratchArena arena;
+            for (uint_type i = next++; i < rule_ids.size(); i = next++) {
+                log_stream = &logs[i];
+                error_stream = &errors[i];
+                try {
+                    rules[i] = evaluate(rule_ids[i],ruleset,string_table,arena);
+                }
+                catch (const FatalEvaluation&) {
+                    failed[i] = 1;
+                    arena.rewind(0);
+                }
+            }
+            log_stream = nullptr;
+            error_stream = nullptr;
+        };
+        std::vector<std::thread> workers;
+        for (uint_type i = 0; i < threads; i++) workers.push_back(std::thread(work));
+        for (auto& worker : workers) worker.join();
+        for (uint_type i = 0; i < rule_ids.size(); i++) {
+            logStream() << logs[i].str();
+            errorStream() << errors[i].str();
+            if (failed[i]) fatal();
+        }
+        return rules;
+    }
 };
 #endif
@@ -0,0 +1,306 @@
+#ifndef IMPORT_RESOLVER_HPP
+#define IMPORT_RESOLVER_HPP
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "generic-btree.hpp"
+#include "EBNF.hpp"
+#include "BuildSyntaxTree.hpp"
+#include "Lexer.hpp"
+
+#define IMPORT_OUT std::cout << "(Imports) "
+#define IMPORT_ERROUT std::cerr << "(Imports) Error: "
+
+namespace imports {
+
+    struct ImportStatement {
+        std::string name;       //As written between the quotes
+        uint_type offset;       //Offset of the import keyword in the importing source
+    };
+
+    std::vector<ImportStatement> findImports(const std::string& source) {
+        /*
+            Finds every import "name"; statement outside comments and string
+            literals.
+        */
+        std::vector<ImportStatement> found;
+        const std::string keyword = "import";
+        uint_type i = 0;
+        while (i < source.size()) {
+            if (source.compare(i, 2, "/*") == 0) {
+                uint_type end = source.find("*/", i + 2);
+                i = (end == std::string::npos) ? source.size() : end + 2;
+                continue;
+            }
+            if (source.compare(i, 2, "//") == 0) {
+                uint_type end = source.find('\n', i);
+                i = (end == std::string::npos) ? source.size() : end + 1;
+                continue;
+            }
+            if (source[i] == '"') {
+                uint_type end = source.find('"', i + 1);
+                i = (end == std::string::npos) ? source.size() : end + 1;
+                continue;
+            }
+            bool word_start = i == 0 || !(isalnum((unsigned char)source[i - 1]) || source[i - 1] == '_');
+            if (!word_start || source.compare(i, keyword.size(), keyword) != 0) {
+                i++;
+                continue;
+            }
+            uint_type at = i + keyword.size();
+            while (at < source.size() && isspace((unsigned char)source[at])) at++;
+            if (at == i + keyword.size() || at >= source.size() || source[at] != '"') {
+                i = at;
+                continue;
+            }
+            uint_type close = source.find('"', at + 1);
+            if (close == std::string::npos) break;
+            uint_type semicolon = close + 1;
+            while (semicolon < source.size() && isspace((unsigned char)source[semicolon])) semicolon++;
+            if (semicolon < source.size() && source[semicolon] == ';') {
+                found.push_back(ImportStatement{source.substr(at + 1, close - at - 1), i});
+            }
+            i = close + 1;
+        }
+        return found;
+    }
+
+    struct Module {
+        std::string name;
+        std::string path;       //Canonical, modules are told apart by it
+        std::string source;
+        Trie<syntree::SyntaxElement> tree;
+        std::vector<std::shared_ptr<const Module> > imports;
+    };
+
+    class ImportResolver {
+        /*
+            Resolves the import graph of a source file. Every module reachable
+            through imports is loaded and parsed exactly once, however many files
+            import it, and is shared read-only between its importers. Parsing a
+            module doesn't depend on its imports, so all modules are parsed
+            concurrently once the graph is known to be acyclic; the grammar is
+            only read while parsing.
+        */
+        private:
+            struct Node {
+                std::string name;
+                std::string path;
+                std::string source;
+                std::vector<uint_type> edges;
+                std::vector<uint_type> edge_offsets;    //Offset of the import statement behind each edge
+                std::shared_ptr<Module> module;
+            };
+
+            const EBNF* grammar;
+            const lexer::Lexer* lexer;
+            uint_type threads;
+            std::vector<std::string> search_paths;
+            std::vector<Node> nodes;
+            std::map<std::string,uint_type> by_path;
+            std::vector<std::shared_ptr<const Module> > ordered;
+
+            static std::string canonical(const std::string& path) {
+                char* resolved = realpath(path.c_str(), nullptr);
+                if (resolved == nullptr) return std::string();
+                std::string result(resolved);
+                free(resolved);
+                return result;
+            }
+
+            static std::string directoryOf(const std::string& path) {
+                uint_type slash = path.find_last_of('/');
+                return (slash == std::string::npos) ? std::string(".") : path.substr(0, slash + 1);
+            }
+
+            static uint_type lineOf(const std::string& source, uint_type offset) {
+                return 1 + std::count(source.begin(), source.begin() + std::min<uint_type>(offset, source.size()), '\n');
+            }
+
+            std::string locate(const std::string& name, const std::string& importer) const {
+                /*
+                    Next to the importing file first, then each search path in the
+                    order given, with the name as is or with a .txt extension. Only
+                    regular files count, so a directory named like a module does
+                    not hide the file next to it.
+                */
+                std::vector<std::string> directories;
+                if (!name.empty() && name[0] == '/') directories.push_back("");
+                else {
+                    directories.push_back(directoryOf(importer));
+                    for (auto& directory : this->search_paths) directories.push_back(directory + "/");
+                }
+                const char* extensions[] = {"", ".txt"};
+                for (auto& directory : directories) {
+                    for (auto extension : extensions) {
+                        std::string path = canonical(directory + name + extension);
+                        struct stat info;
+                        if (path.size() > 0 && stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode)) return path;
+                    }
+                }
+                return std::string();
+            }
+
+            bool discover() {
+                /*
+                    Breadth first from the root, loading every file once.
+                */
+                bool ok = true;
+                for (uint_type current = 0; current < this->nodes.size(); current++) {
+                    std::vector<ImportStatement> statements = findImports(this->nodes[current].source);
+                    for (auto& statement : statements) {
+                        std::string path = this->locate(statement.name, this->nodes[current].path);
+                        if (path.empty()) {
+                            IMPORT_ERROUT << this->nodes[current].path << ":" << lineOf(this->nodes[current].source, statement.offset)
+                                          << ": cannot find module \"" << statement.name << "\"." << std::endl;
+                            ok = false;
+                            continue;
+                        }
+                        auto known = this->by_path.find(path);
+                        if (known == this->by_path.end()) {
+                            if (::access(path.c_str(), R_OK) != 0) {
+                                IMPORT_ERROUT << this->nodes[current].path << ":" << lineOf(this->nodes[current].source, statement.offset)
+                                              << ": cannot read module \"" << statement.name << "\" from " << path << "." << std::endl;
+                                ok = false;
+                                continue;
+                            }
+                            Node node;
+                            node.name = statement.name;
+                            node.path = path;
+                            node.source = loadIntoString(path);
+                            known = this->by_path.insert(std::make_pair(path, this->nodes.size())).first;
+                            this->nodes.push_back(node);
+                        }
+                        std::vector<uint_type>& edges = this->nodes[current].edges;
+                        if (std::find(edges.begin(), edges.end(), known->second) != edges.end()) continue;
+                        edges.push_back(known->second);
+                        this->nodes[current].edge_offsets.push_back(statement.offset);
+                    }
+                }
+                return ok;
+            }
+
+            bool order(std::vector<uint_type>& dependencies_first) {
+                /*
+                    Depth first from the root with an explicit stack. Reaching a
+                    module that is still on the stack closes a cycle, which is
+                    reported along the stack.
+                */
+                enum { unseen, open, done };
+                std::vector<uint8_t> state(this->nodes.size(), unseen);
+                std::vector<std::pair<uint_type,uint_type> > stack;
+                stack.push_back(std::make_pair(0, 0));
+                state[0] = open;
+                while (!stack.empty()) {
+                    uint_type node = stack.back().first;
+                    uint_type edge = stack.back().second;
+                    if (edge == this->nodes[node].edges.size()) {
+                        state[node] = done;
+                        dependencies_first.push_back(node);
+                        stack.pop_back();
+                        continue;
+                    }
+                    stack.back().second++;
+                    uint_type next = this->nodes[node].edges[edge];
+                    if (state[next] == done) continue;
+                    if (state[next] == open) {
+                        std::string cycle;
+                        bool on_cycle = false;
+                        for (auto& frame : stack) {
+                            if (frame.first == next) on_cycle = true;
+                            if (on_cycle) cycle += this->nodes[frame.first].path + " -> ";
+                        }
+                        IMPORT_ERROUT << this->nodes[node].path << ":" << lineOf(this->nodes[node].source, this->nodes[node].edge_offsets[edge])
+                                      << ": import cycle " << cycle << this->nodes[next].path << std::endl;
+                        return false;
+                    }
+                    state[next] = open;
+                    stack.push_back(std::make_pair(next, 0));
+                }
+                return true;
+            }
+
+            void parse(const std::vector<uint_type>& modules) {
+                /*
+                    Workers take modules off a shared counter in dependency order, so
+                    independent branches of the graph are parsed side by side.
+                */
+                std::atomic<uint_type> next(0);
+                auto work = [&]() {
+                    for (uint_type i = next++; i < modules.size(); i = next++) {
+                        Module& module = *this->nodes[modules[i]].module;
+                        if (this->lexer != nullptr) {
+                            module.tree = syntree::buildTree(*this->grammar, module.source, this->lexer->tokenize(module.source));
+                        }
+                        else module.tree = syntree::buildTree(*this->grammar, module.source);
+                    }
+                };
+                uint_type count = std::min<uint_type>(std::max<uint_type>(1, this->threads), modules.size());
+                std::vector<std::thread> workers;
+                for (uint_type i = 1; i < count; i++) workers.push_back(std::thread(work));
+                work();
+                for (auto& worker : workers) worker.join();
+            }
+
+        public:
+            ImportResolver(const EBNF& grammar, uint_type threads = 0, const lexer::Lexer* lexer = nullptr)
+                : grammar(&grammar), lexer(lexer), threads(threads), search_paths(), nodes(), by_path(), ordered() {
+                if (this->threads == 0) this->threads = std::max<uint_type>(1, std::thread::hardware_concurrency());
+            }
+
+            void addSearchPath(const std::string& directory) {
+                this->search_paths.push_back(directory);
+            }
+
+            bool resolve(const std::string& filename, const std::string& source) {
+                /*
+                    source is the already loaded and parsed content of filename, the
+                    root itself isn't parsed again.
+                */
+                this->nodes.clear();
+                this->by_path.clear();
+                this->ordered.clear();
+                Node root;
+                root.name = filename;
+                root.path = canonical(filename);
+                if (root.path.empty()) root.path = filename;
+                root.source = source;
+                this->by_path[root.path] = 0;
+                this->nodes.push_back(root);
+                if (!this->discover()) return false;
+                std::vector<uint_type> dependencies_first;
+                if (!this->order(dependencies_first)) return false;
+                dependencies_first.pop_back();      //The root comes last
+                for (auto node : dependencies_first) {
+                    this->nodes[node].module = std::make_shared<Module>();
+                    this->nodes[node].module->name = this->nodes[node].name;
+                    this->nodes[node].module->path = this->nodes[node].path;
+                    this->nodes[node].module->source.swap(this->nodes[node].source);
+                }
+                this->parse(dependencies_first);
+                for (auto node : dependencies_first) {
+                    for (auto edge : this->nodes[node].edges) this->nodes[node].module->imports.push_back(this->nodes[edge].module);
+                    this->ordered.push_back(this->nodes[node].module);
+                }
+                return true;
+            }
+
+            const std::vector<std::shared_ptr<const Module> >& modules() const {
+                /*
+                    Every imported module, each after the modules it imports.
+                */
+                return this->ordered;
+            }
+    };
+};
+
+#endif
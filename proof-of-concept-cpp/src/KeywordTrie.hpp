@@ -0,0 +1,106 @@
+#ifndef KEYWORD_TRIE_HPP
+#define KEYWORD_TRIE_HPP
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include "RegexHelpers.hpp"
+
+namespace EvalEBNF {
+
+    const uint32_t no_keyword = 0xffffffff;
+
+    class KeywordMatcher {
+        /*
+            Matches an ordered alternation of literals exactly as PCRE does: at the
+            leftmost position any literal matches, the first literal in order that
+            matches there. A byte trie finds it in one walk per position, however
+            many literals there are. Every node has a full table of 256 children,
+            grammars only ever have a few hundred bytes of keywords.
+        */
+        private:
+            std::vector<uint32_t> children;     //256 per node, 0 for none, the root is never a child
+            std::vector<uint32_t> first;        //Lowest literal ending at a node, or no_keyword
+            std::vector<std::string> literals;
+
+        public:
+            KeywordMatcher() : children(), first(), literals() {
+            }
+
+            KeywordMatcher(const std::vector<std::string>& literals) : children(256, 0), first(1, no_keyword), literals(literals) {
+                for (uint32_t literal = 0; literal < this->literals.size(); literal++) {
+                    uint32_t node = 0;
+                    for (unsigned char byte : this->literals[literal]) {
+                        if (this->children[node * 256 + byte] == 0) {
+                            this->children[node * 256 + byte] = this->first.size();
+                            this->first.push_back(no_keyword);
+                            this->children.resize(this->children.size() + 256, 0);
+                        }
+                        node = this->children[node * 256 + byte];
+                    }
+                    if (node != 0) this->first[node] = std::min(this->first[node], literal);
+                }
+            }
+
+            bool empty() const {
+                return this->literals.empty();
+            }
+
+            uint_type size() const {
+                return this->literals.size();
+            }
+
+            uint_type nodes() const {
+                return this->first.size();
+            }
+
+            const std::string& literal(uint32_t index) const {
+                return this->literals[index];
+            }
+
+            uint32_t matchAt(const std::string& content, uint_type at) const {
+                /*
+                    The first literal in order matching at a position, or no_keyword.
+                */
+                uint32_t node = 0;
+                uint32_t best = no_keyword;
+                for (uint_type i = at; i < content.size(); i++) {
+                    node = this->children[node * 256 + (unsigned char)content[i]];
+                    if (node == 0) break;
+                    best = std::min(best, this->first[node]);
+                }
+                return best;
+            }
+
+            std::pair<std::string,uint_type> nextMatch(const std::string& content, uint_type at) const {
+                /*
+                    The first match at or after at and where it starts, in the
+                    layout RegexHelper::nextMatch returns.
+                */
+                for (; at < content.size() && !this->empty(); at++) {
+                    if (this->children[(unsigned char)content[at]] == 0) continue;
+                    uint32_t literal = this->matchAt(content, at);
+                    if (literal != no_keyword) return std::make_pair(this->literals[literal], at);
+                }
+                return std::make_pair(std::string(), uint_type(content.size()));
+            }
+
+            std::vector<std::pair<std::string,uint_type> > matches(const std::string& content) const {
+                /*
+                    Every match from left to right, each search resuming where the
+                    last match ended, in the layout RegexHelper::getListOfMatches
+                    returns.
+                */
+                std::vector<std::pair<std::string,uint_type> > found;
+                if (this->empty()) return found;
+                for (auto next = this->nextMatch(content, 0); next.second < content.size(); next = this->nextMatch(content, next.second + next.first.size())) {
+                    found.push_back(next);
+                }
+                return found;
+            }
+    };
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef LAZY_PARSE_HPP
+#define LAZY_PARSE_HPP
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include "generic-btree.hpp"
+#include "EBNF.hpp"
+#include "BuildSyntaxTree.hpp"
+
+namespace syntree {
+
+    uint_type matchingDelimiter(const std::string& content, uint_type from, char open = '{', char close = '}') {
+        /*
+            Index of the close matching the open at from, found by delimiter
+            matching alone and ignoring strings and comments, or content.size()
+            if it is never closed.
+        */
+        uint_type depth = 0;
+        for (uint_type i = from; i < content.size(); i++) {
+            char c = content[i];
+            if (c == '"') {
+                while (++i < content.size() && content[i] != '"') {
+                    if (content[i] == '\\') i++;
+                }
+            }
+            else if (c == '/' && i + 1 < content.size() && content[i + 1] == '*') {
+                uint_type end = content.find("*/", i + 2);
+                if (end == std::string::npos) break;
+                i = end + 1;
+            }
+            else if (c == open) depth++;
+            else if (c == close && --depth == 0) return i;
+        }
+        return content.size();
+    }
+
+    bool isBody(const std::string& content, char open = '{', char close = '}') {
+        /*
+            Whether content is exactly one balanced body.
+        */
+        return content.size() >= 2 && content[0] == open && matchingDelimiter(content, 0, open, close) == content.size() - 1;
+    }
+
+    class LazyTree {
+        /*
+            A syntax tree whose bracketed bodies are only parsed when asked for.
+            A match whose content is one balanced body, told by delimiter matching
+            rather than by its rule, becomes a placeholder node holding the body's
+            text but no children until children() or expand() is called on it.
+            That parses it exactly as recurseParse would, leaving the bodies
+            nested in it as new placeholders, so expanding everything builds the
+            same tree as a full parse. Each level of nesting costs a pass of every
+            rule over the body, which is what a signature scan saves.
+
+            Expanding only ever fills the empty child vector of a placeholder, so
+            references to nodes stay valid while the tree grows.
+        */
+        private:
+            const EBNF* grammar;
+            ParseContext context;
+            char open;
+            char close;
+            Trie<SyntaxElement> root;
+            std::unordered_map<const Trie<SyntaxElement>*,Trie<SyntaxElement>*> parents;
+            std::unordered_map<const Trie<SyntaxElement>*,Trie<SyntaxElement>*> pending;
+            uint_type expansions;
+
+            void parseLevel(Trie<SyntaxElement>* top) {
+                /*
+                    The same steps as recurseParse, except that children which are
+                    bodies are left as placeholders rather than pushed.
+                */
+                std::vector<Trie<SyntaxElement>*> work;
+                work.push_back(top);
+                while (!work.empty()) {
+                    Trie<SyntaxElement>* node = work.back();
+                    work.pop_back();
+                    auto large_matches = largestMatches(*this->grammar,node->self.content,node->self,this->context);
+                    node->data.reserve(large_matches.size());
+                    for (uint_type iter = 0; iter < large_matches.size(); iter++) {
+                        node->data.push_back(Trie<SyntaxElement>(std::move(large_matches[iter])));
+                    }
+                    for (uint_type iter = node->data.size(); iter > 0; iter--) {
+                        Trie<SyntaxElement>* child = &node->data[iter - 1];
+                        this->parents[child] = node;
+                        if (isBody(child->self.content,this->open,this->close)) this->pending[child] = child;
+                        else work.push_back(child);
+                    }
+                }
+            }
+
+        public:
+            LazyTree(const EBNF& grammar, const std::string& source, const ParseContext& context = ParseContext(), char open = '{', char close = '}')
+                : grammar(&grammar), context(context), open(open), close(close), root(SyntaxElement(0,"__syntax_tree_whole__",source)), parents(), pending(), expansions(0) {
+                this->parseLevel(&this->root);
+                if (this->context.recovering()) locate(source,*this->context.diagnostics);
+            }
+
+            LazyTree(const LazyTree& copy) = delete;
+
+            const Trie<SyntaxElement>& tree() const {
+                /*
+                    The tree as expanded so far, placeholders have no children.
+                */
+                return this->root;
+            }
+
+            bool isPlaceholder(const Trie<SyntaxElement>& node) const {
+                return this->pending.count(&node) > 0;
+            }
+
+            uint_type placeholders() const {
+                return this->pending.size();
+            }
+
+            uint_type expanded() const {
+                return this->expansions;
+            }
+
+            void expand(const Trie<SyntaxElement>& node) {
+                /*
+                    node must be in this tree. Parses a placeholder's body, its own
+                    and its ancestors' cached sizes are reset since they grew.
+                */
+                auto found = this->pending.find(&node);
+                if (found == this->pending.end()) return;
+                Trie<SyntaxElement>* target = found->second;
+                this->pending.erase(found);
+                this->expansions++;
+                this->parseLevel(target);
+                for (Trie<SyntaxElement>* at = target; at != nullptr; ) {
+                    at->invalidateSize();
+                    auto parent = this->parents.find(at);
+                    at = (parent == this->parents.end()) ? nullptr : parent->second;
+                }
+            }
+
+            const std::vector<Trie<SyntaxElement> >& children(const Trie<SyntaxElement>& node) {
+                this->expand(node);
+                return node.data;
+            }
+
+            void expandAll() {
+                /*
+                    Expands every placeholder, including the ones expanding creates.
+                */
+                while (!this->pending.empty()) this->expand(*this->pending.begin()->first);
+            }
+    };
+};
+
+#endif
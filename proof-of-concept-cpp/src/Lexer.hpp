@@ -0,0 +1,357 @@
+#ifndef LLACE_LEXER_HPP
+#define LLACE_LEXER_HPP
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdint>
+#include "EBNF.hpp"
+
+#ifndef PARSE_TYPE_DEFAULTS
+#define PARSE_TYPE_DEFAULTS
+typedef uintmax_t uint_type;
+typedef double prec_type;
+#endif
+
+#define LEX_OUT std::cout << "(Lexer) "
+#define LEX_ERROUT std::cerr << "(Lexer) Error: "
+
+namespace lexer {
+
+    namespace kinds {
+        enum Kinds {
+            unknown,
+            whitespace,
+            comment,
+            identifier,
+            number,
+            string,
+            /*
+                Literal terminals from the grammar's string table are given kinds
+                from literal_base upwards, in the order they were added to the lexer.
+            */
+            literal_base
+        };
+    };
+
+    struct Token {
+        uint32_t kind;
+        uint32_t offset;
+        uint32_t length;
+
+        Token() : kind(kinds::unknown), offset(0), length(0) {
+        }
+
+        Token(uint32_t kind, uint32_t offset, uint32_t length) : kind(kind), offset(offset), length(length) {
+        }
+
+        bool trivia() const {
+            return this->kind == kinds::whitespace || this->kind == kinds::comment;
+        }
+
+        uint_type end() const {
+            return uint_type(this->offset) + this->length;
+        }
+    };
+
+    class TokenArray {
+        private:
+            /*
+                Offsets of every token that is not whitespace or a comment, kept
+                sorted so the tree builder can binary search for the next position
+                worth trying.
+            */
+            std::vector<uint_type> starts;
+
+        public:
+            std::vector<Token> tokens;
+
+            TokenArray() : starts(), tokens() {
+            }
+
+            void push(const Token& token) {
+                this->tokens.push_back(token);
+                if (!token.trivia()) this->starts.push_back(token.offset);
+            }
+
+            uint_type size() const {
+                return this->tokens.size();
+            }
+
+            const Token& operator[] (uint_type index) const {
+                return this->tokens[index];
+            }
+
+            uint_type nextStart(uint_type offset, uint_type limit) const {
+                /*
+                    Returns the first significant token offset strictly after offset
+                    and before limit, or limit if there is none.
+                */
+                auto found = std::upper_bound(this->starts.begin(), this->starts.end(), offset);
+                if (found == this->starts.end() || *found >= limit) return limit;
+                return *found;
+            }
+
+            uint_type firstStart(uint_type offset, uint_type limit) const {
+                /*
+                    As nextStart, but a token starting at offset itself counts.
+                */
+                auto found = std::lower_bound(this->starts.begin(), this->starts.end(), offset);
+                if (found == this->starts.end() || *found >= limit) return limit;
+                return *found;
+            }
+
+            uint_type nextBoundary(uint_type offset, uint_type limit) const {
+                /*
+                    As nextStart, but whitespace and comment tokens count too, so
+                    rules matching trivia still get their turn.
+                */
+                auto found = std::upper_bound(this->tokens.begin(), this->tokens.end(), offset, [](uint_type lhs, const Token& rhs) {
+                    return lhs < rhs.offset;
+                });
+                if (found == this->tokens.end() || found->offset >= limit) return limit;
+                return found->offset;
+            }
+
+            std::string text(const std::string& source, uint_type index) const {
+                return source.substr(this->tokens[index].offset, this->tokens[index].length);
+            }
+    };
+
+    class Lexer {
+        private:
+            /*
+                Fixed character-class automaton states. The table generated for a
+                grammar starts with these, then appends one state per trie node of
+                the grammar's literal terminals.
+            */
+            enum ClassStates {
+                s_dead,
+                s_ident,
+                s_number,
+                s_ws,
+                s_str_body,
+                s_str_esc,
+                s_str_end,
+                s_slash,
+                s_cmt_body,
+                s_cmt_star,
+                s_cmt_end,
+                s_class_count
+            };
+
+            std::vector<int32_t> table;
+            std::vector<uint32_t> accepting;
+            std::vector<std::string> literals;
+            int32_t start_state;
+
+            static bool identStart(unsigned char c) {
+                return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+            }
+
+            static bool identPart(unsigned char c) {
+                return identStart(c) || (c >= '0' && c <= '9');
+            }
+
+            static bool digit(unsigned char c) {
+                return c >= '0' && c <= '9';
+            }
+
+            static bool space(unsigned char c) {
+                return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+            }
+
+            static int32_t classStep(int32_t state, unsigned char c) {
+                /*
+                    Transition function of the built in lexical classes (identifiers,
+                    numbers, whitespace, string literals and block comments). Only used
+                    while generating the table, never while lexing.
+                */
+                switch (state) {
+                    case s_ident:
+                        return identPart(c) ? s_ident : s_dead;
+                    case s_number:
+                        return digit(c) ? s_number : s_dead;
+                    case s_ws:
+                        return space(c) ? s_ws : s_dead;
+                    case s_str_body:
+                        if (c == '\\') return s_str_esc;
+                        if (c == '"') return s_str_end;
+                        if (c == '\n') return s_dead;
+                        return s_str_body;
+                    case s_str_esc:
+                        return s_str_body;
+                    case s_slash:
+                        return c == '*' ? s_cmt_body : s_dead;
+                    case s_cmt_body:
+                        return c == '*' ? s_cmt_star : s_cmt_body;
+                    case s_cmt_star:
+                        if (c == '/') return s_cmt_end;
+                        return c == '*' ? s_cmt_star : s_cmt_body;
+                    default:
+                        return s_dead;
+                }
+            }
+
+            static int32_t classStart(unsigned char c) {
+                if (identStart(c)) return s_ident;
+                if (digit(c)) return s_number;
+                if (space(c)) return s_ws;
+                if (c == '"') return s_str_body;
+                if (c == '/') return s_slash;
+                return s_dead;
+            }
+
+            static uint32_t classAccepts(int32_t state) {
+                switch (state) {
+                    case s_ident:   return kinds::identifier;
+                    case s_number:  return kinds::number;
+                    case s_ws:      return kinds::whitespace;
+                    case s_str_end: return kinds::string;
+                    case s_cmt_end: return kinds::comment;
+                    default:        return kinds::unknown;
+                }
+            }
+
+            int32_t newState(uint32_t accept) {
+                this->table.resize(this->table.size() + 256, s_dead);
+                this->accepting.push_back(accept);
+                return int32_t(this->accepting.size() - 1);
+            }
+
+            void generate() {
+                /*
+                    Builds the transition table as the product of a trie over the literal
+                    terminals and the built in class automaton. Every trie node remembers
+                    which class state its path leads to, so when the trie runs out the
+                    table falls through into that class (so "components" still lexes as
+                    an identifier even though "component" is a keyword).
+                */
+                this->table.clear();
+                this->accepting.clear();
+                for (int32_t state = 0; state < s_class_count; state++) {
+                    this->newState(classAccepts(state));
+                    for (uint_type c = 0; c < 256; c++) {
+                        this->table[state * 256 + c] = classStep(state, (unsigned char)c);
+                    }
+                }
+                this->start_state = this->newState(kinds::unknown);
+                std::vector<int32_t> shadow(s_class_count + 1, s_dead);
+                for (uint_type c = 0; c < 256; c++) {
+                    this->table[this->start_state * 256 + c] = classStart((unsigned char)c);
+                }
+                for (uint_type lit = 0; lit < this->literals.size(); lit++) {
+                    int32_t state = this->start_state;
+                    const std::string& literal = this->literals[lit];
+                    for (uint_type i = 0; i < literal.size(); i++) {
+                        unsigned char c = (unsigned char)literal[i];
+                        int32_t next = this->table[state * 256 + c];
+                        if (next < this->start_state) {
+                            /*
+                                The trie has no node for this path yet, split it off
+                                from the class automaton.
+                            */
+                            int32_t class_state = (state == this->start_state) ? classStart(c) : classStep(shadow[state], c);
+                            next = this->newState(classAccepts(class_state));
+                            shadow.push_back(class_state);
+                            for (uint_type k = 0; k < 256; k++) {
+                                this->table[next * 256 + k] = classStep(class_state, (unsigned char)k);
+                            }
+                            this->table[state * 256 + c] = next;
+                        }
+                        state = next;
+                    }
+                    this->accepting[state] = kinds::literal_base + lit;
+                }
+            }
+
+        public:
+
+            Lexer() : table(), accepting(), literals(), start_state(s_class_count) {
+                this->generate();
+            }
+
+            Lexer(const std::vector<std::string>& terminals) : Lexer() {
+                for (uint_type i = 0; i < terminals.size(); i++) this->addLiteral(terminals[i]);
+                this->generate();
+            }
+
+            Lexer(const EBNF& grammar) : Lexer(grammar.string_table) {
+            }
+
+            void addLiteral(const std::string& literal) {
+                /*
+                    Adds a terminal without regenerating the table, duplicates and empty
+                    strings are ignored.
+                */
+                if (literal.empty()) return;
+                if (std::find(this->literals.begin(), this->literals.end(), literal) != this->literals.end()) return;
+                this->literals.push_back(literal);
+            }
+
+            uint_type states() const {
+                return this->accepting.size();
+            }
+
+            std::string kindStr(uint32_t kind) const {
+                switch (kind) {
+                    case kinds::unknown:    return "unknown";
+                    case kinds::whitespace: return "whitespace";
+                    case kinds::comment:    return "comment";
+                    case kinds::identifier: return "identifier";
+                    case kinds::number:     return "number";
+                    case kinds::string:     return "string";
+                    default:
+                        if (kind - kinds::literal_base < this->literals.size()) {
+                            return "\"" + this->literals[kind - kinds::literal_base] + "\"";
+                        }
+                        return "notype";
+                }
+            }
+
+            uint32_t literalKind(const std::string& literal) const {
+                /*
+                    Kind assigned to a literal terminal, or unknown if the lexer does
+                    not know of it.
+                */
+                for (uint_type i = 0; i < this->literals.size(); i++) {
+                    if (this->literals[i] == literal) return kinds::literal_base + i;
+                }
+                return kinds::unknown;
+            }
+
+            TokenArray tokenize(const std::string& source) const {
+                /*
+                    Single pass maximal munch over the source. Bytes that start no token
+                    at all are emitted as single byte unknown tokens so the array always
+                    covers the whole source.
+                */
+                TokenArray tokens;
+                tokens.tokens.reserve(source.size() / 4 + 1);
+                const unsigned char* data = (const unsigned char*)source.data();
+                const int32_t* table = this->table.data();
+                uint_type index = 0;
+                while (index < source.size()) {
+                    int32_t state = this->start_state;
+                    uint_type cursor = index;
+                    uint_type last_end = index;
+                    uint32_t last_kind = kinds::unknown;
+                    while (cursor < source.size()) {
+                        state = table[state * 256 + data[cursor]];
+                        if (state == s_dead) break;
+                        cursor++;
+                        if (this->accepting[state] != kinds::unknown) {
+                            last_end = cursor;
+                            last_kind = this->accepting[state];
+                        }
+                    }
+                    if (last_end == index) last_end = index + 1;
+                    tokens.push(Token(last_kind, uint32_t(index), uint32_t(last_end - index)));
+                    index = last_end;
+                }
+                return tokens;
+            }
+    };
+};
+#endif
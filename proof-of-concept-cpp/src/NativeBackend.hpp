@@ -0,0 +1,377 @@
+#ifndef NATIVE_BACKEND_HPP
+#define NATIVE_BACKEND_HPP
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+#include <dlfcn.h>
+#include "Netlist.hpp"
+#include "Simulator.hpp"
+
+namespace sim {
+
+    /*
+        The interface between the simulator and generated code. Only this table
+        is looked up in a generated library, so libraries built by any compiler
+        stay loadable as long as the version matches. State is one array of
+        64-bit words, one bit per lane. The struct is written once, here, and
+        both declared for the host and pasted into generated code from it.
+    */
+    #define NATIVE_ABI_STRUCT \
+        struct llace_native_v1 { \
+            uint32_t abi_version; \
+            uint32_t inputs; \
+            uint32_t outputs; \
+            uint32_t registers; \
+            uint32_t domains; \
+            uint64_t state_words; \
+            const uint32_t* input_slots; \
+            const uint32_t* output_slots; \
+            void (*reset)(uint64_t* state); \
+            void (*evaluate)(uint64_t* state); \
+            int (*settle)(uint64_t* state); \
+        };
+    #define NATIVE_STRINGIFY(text) #text
+    #define NATIVE_STRING(text) NATIVE_STRINGIFY(text)
+
+    const uint32_t native_abi_version = 1;
+    const char* const native_abi = "extern \"C\" {\n" NATIVE_STRING(NATIVE_ABI_STRUCT) "\n}\n";
+
+    extern "C" {
+        NATIVE_ABI_STRUCT
+    }
+
+    class NativeSimulator {
+        /*
+            Simulates a netlist as generated C++ compiled into a shared library.
+            Cells become straight-line statements in levelized order over a
+            packed array of nets, inputs first, then constants, register outputs
+            and cell outputs in the order they are computed. Registers are grouped
+            into one sampling function per clock net, after which the previous
+            clock is kept once per domain rather than per register. Behaves
+            exactly like LevelizedSimulator<1>.
+
+            Statements are split into functions of chunk statements, since
+            compilers take far longer over one huge function than over many
+            small ones. The compiler is $CXX, or c++ if it isn't set.
+        */
+        private:
+            std::vector<uint32_t> slots;            //Packed slot of every net
+            std::vector<Instruction> program;
+            std::vector<netlist::Handle> constant_ones;
+            std::vector<netlist::Handle> clocks;    //Clock net of every domain
+            std::vector<std::vector<std::pair<netlist::Handle,netlist::Handle> > > domains;    //(q, d) per register
+            std::vector<netlist::Handle> input_nets;
+            std::vector<netlist::Handle> output_nets;
+            uint_type registers;
+            uint_type chunk;
+            void* library;
+            const llace_native_v1* entry;
+            std::vector<uint64_t> state;
+            std::string error;
+            bool levelized;
+
+            void pack(const netlist::Netlist& design) {
+                /*
+                    Nets read but never driven hold 0 in LevelizedSimulator. They
+                    get slots of their own after everything else, which reset
+                    clears and nothing writes, so every net the generated code
+                    touches has a slot.
+                */
+                uint32_t next = 0;
+                this->slots.assign(design.nets(), no_slot);
+                for (auto net : this->input_nets) this->slots[net] = next++;
+                for (netlist::Handle cell = 0; cell < design.cells(); cell++) {
+                    uint8_t kind = design.cell_kind[cell];
+                    if (kind == netlist::cells::constant0 || kind == netlist::cells::constant1) this->slots[design.cell_out[cell]] = next++;
+                }
+                for (auto& domain : this->domains) {
+                    for (auto& reg : domain) this->slots[reg.first] = next++;
+                }
+                for (auto& instruction : this->program) this->slots[instruction.out] = next++;
+                auto read = [&](netlist::Handle net) {
+                    if (net != netlist::none && this->slots[net] == no_slot) this->slots[net] = next++;
+                };
+                for (auto& instruction : this->program) {
+                    read(instruction.a);
+                    if (instruction.op != netlist::cells::inverter) read(instruction.b);
+                }
+                for (uint_type d = 0; d < this->domains.size(); d++) {
+                    read(this->clocks[d]);
+                    for (auto& reg : this->domains[d]) read(reg.second);
+                }
+                for (auto net : this->output_nets) read(net);
+            }
+
+            std::string slot(netlist::Handle net) const {
+                return "s[" + std::to_string(this->slots[net]) + "]";
+            }
+
+            bool compile(const std::string& code) {
+                char directory[] = "/tmp/llace-native-XXXXXX";
+                if (mkdtemp(directory) == nullptr) {
+                    this->error = "cannot create a build directory";
+                    return false;
+                }
+                std::string source = std::string(directory) + "/design.cpp";
+                std::string object = std::string(directory) + "/design.so";
+                std::string log = std::string(directory) + "/compile.log";
+                {
+                    std::fstream out(source.c_str(), std::ios::out | std::ios::trunc);
+                    out << code;
+                }
+                const char* compiler = getenv("CXX");
+                std::string command = std::string((compiler != nullptr && compiler[0] != '\0') ? compiler : "c++")
+                                    + " -std=c++11 -O1 -shared -fPIC -o " + object + " " + source + " > " + log + " 2>&1";
+                int status = std::system(command.c_str());
+                if (status == 0) {
+                    this->library = dlopen(object.c_str(), RTLD_NOW | RTLD_LOCAL);
+                    if (this->library == nullptr) this->error = dlerror();
+                }
+                else this->error = "compiling generated code failed:\n" + loadIntoString(log);
+                unlink(source.c_str());
+                unlink(object.c_str());
+                unlink(log.c_str());
+                rmdir(directory);
+                if (this->library == nullptr) return false;
+                typedef const llace_native_v1* (*Entry)();
+                Entry lookup = (Entry)dlsym(this->library, "llace_native_entry");
+                if (lookup == nullptr || (this->entry = lookup()) == nullptr || this->entry->abi_version != native_abi_version) {
+                    this->error = "generated library has no compatible entry point";
+                    this->entry = nullptr;
+                    return false;
+                }
+                return true;
+            }
+
+        public:
+            std::vector<std::string> input_names;
+            std::vector<std::string> output_names;
+
+            NativeSimulator(const netlist::Netlist& design, uint_type chunk = 64)
+                : slots(), program(), constant_ones(), clocks(), domains(), input_nets(), output_nets(), registers(0), chunk(chunk),
+                  library(nullptr), entry(nullptr), state(), error(), levelized(false), input_names(), output_names() {
+                LevelizedSimulator<1> reference(design);
+                this->levelized = reference.valid();
+                if (!this->levelized) return;
+                this->program = reference.levelized();
+                this->input_names = reference.input_names;
+                this->output_names = reference.output_names;
+                std::map<netlist::Handle,uint_type> domain_of;
+                for (netlist::Handle cell = 0; cell < design.cells(); cell++) {
+                    if (design.cell_kind[cell] == netlist::cells::constant1) this->constant_ones.push_back(design.cell_out[cell]);
+                    if (design.cell_kind[cell] != netlist::cells::reg) continue;
+                    auto found = domain_of.find(design.cell_clock[cell]);
+                    if (found == domain_of.end()) {
+                        found = domain_of.insert(std::make_pair(design.cell_clock[cell], this->domains.size())).first;
+                        this->clocks.push_back(design.cell_clock[cell]);
+                        this->domains.push_back(std::vector<std::pair<netlist::Handle,netlist::Handle> >());
+                    }
+                    this->domains[found->second].push_back(std::make_pair(design.cell_out[cell], design.cell_a[cell]));
+                    this->registers++;
+                }
+                for (netlist::Handle port = 0; port < design.ports(); port++) {
+                    if (design.port_direction[port] == netlist::ports::input) this->input_nets.push_back(design.port_net[port]);
+                    else this->output_nets.push_back(design.port_net[port]);
+                }
+                this->pack(design);
+            }
+
+            NativeSimulator(const NativeSimulator& copy) = delete;
+
+            ~NativeSimulator() {
+                if (this->library != nullptr) dlclose(this->library);
+            }
+
+            void generate(std::ostream& out, const std::string& top = "") const {
+                /*
+                    Writes the C++ for the design. State holds the nets, then the
+                    previous clock of every domain, then the next value of every
+                    register.
+                */
+                uint_type nets = this->slots.size();
+                uint_type previous = nets;
+                uint_type next = nets + this->domains.size();
+                out << "/* Generated by LLace from " << top << ". */\n#include <stdint.h>\n#include <string.h>\n" << native_abi << "\n";
+                out << "namespace {\n";
+                uint_type chunks = 0;
+                for (uint_type first = 0; first < this->program.size(); first += this->chunk, chunks++) {
+                    out << "void evaluate" << chunks << "(uint64_t* s) {\n";
+                    for (uint_type i = first; i < this->program.size() && i < first + this->chunk; i++) {
+                        const Instruction& instruction = this->program[i];
+                        out << "\t" << this->slot(instruction.out) << " = ";
+                        switch (instruction.op) {
+                            case netlist::cells::inverter: out << "~" << this->slot(instruction.a); break;
+                            case netlist::cells::and_gate: out << this->slot(instruction.a) << " & " << this->slot(instruction.b); break;
+                            case netlist::cells::or_gate: out << this->slot(instruction.a) << " | " << this->slot(instruction.b); break;
+                            case netlist::cells::xor_gate: out << this->slot(instruction.a) << " ^ " << this->slot(instruction.b); break;
+                        }
+                        out << ";\n";
+                    }
+                    out << "}\n";
+                }
+                out << "void evaluate(uint64_t* s) {\n";
+                for (uint_type i = 0; i < chunks; i++) out << "\tevaluate" << i << "(s);\n";
+                out << "}\n";
+                uint_type reg = 0;
+                for (uint_type d = 0; d < this->domains.size(); d++) {
+                    out << "int sample" << d << "(uint64_t* s) {\n\tuint64_t clock = " << this->slot(this->clocks[d])
+                        << ";\n\tuint64_t rose = clock & ~s[" << previous + d << "];\n\ts[" << previous + d << "] = clock;\n";
+                    for (auto& q_d : this->domains[d]) {
+                        out << "\ts[" << next + reg++ << "] = ";
+                        if (q_d.second != netlist::none) out << "(" << this->slot(q_d.second) << " & rose) | ";
+                        out << "(" << this->slot(q_d.first) << " & ~rose);\n";
+                    }
+                    out << "\treturn rose != 0;\n}\n";
+                }
+                out << "int settle(uint64_t* s) {\n\tevaluate(s);\n\tint sampled = 0;\n";
+                for (uint_type d = 0; d < this->domains.size(); d++) out << "\tsampled |= sample" << d << "(s);\n";
+                out << "\tif (!sampled) return 0;\n";
+                reg = 0;
+                for (auto& domain : this->domains) {
+                    for (auto& q_d : domain) out << "\t" << this->slot(q_d.first) << " = s[" << next + reg++ << "];\n";
+                }
+                out << "\tevaluate(s);\n\treturn 1;\n}\n";
+                out << "void reset(uint64_t* s) {\n\tmemset(s, 0, sizeof(uint64_t) * " << next + this->registers << ");\n";
+                for (auto one : this->constant_ones) out << "\t" << this->slot(one) << " = ~uint64_t(0);\n";
+                out << "}\n";
+                out << "const uint32_t input_slots[] = {";
+                for (auto net : this->input_nets) out << this->slots[net] << ", ";
+                out << "0};\nconst uint32_t output_slots[] = {";
+                for (auto net : this->output_nets) out << this->slots[net] << ", ";
+                out << "0};\n";
+                out << "const llace_native_v1 entry = {" << native_abi_version << ", " << this->input_nets.size() << ", " << this->output_nets.size()
+                    << ", " << this->registers << ", " << this->domains.size() << ", " << next + this->registers
+                    << ", input_slots, output_slots, reset, evaluate, settle};\n";
+                out << "}\n\nextern \"C\" const llace_native_v1* llace_native_entry() {\n\treturn &entry;\n}\n";
+            }
+
+            bool build(const std::string& top = "") {
+                /*
+                    Generates, compiles and loads the design. Returns false, with
+                    the reason in failure(), if any step fails.
+                */
+                if (!this->levelized) {
+                    this->error = "design can't be levelized";
+                    return false;
+                }
+                std::stringstream code;
+                this->generate(code, top);
+                if (!this->compile(code.str())) return false;
+                this->state.assign(this->entry->state_words, 0);
+                this->reset();
+                return true;
+            }
+
+            bool valid() const {
+                return this->entry != nullptr;
+            }
+
+            const std::string& failure() const {
+                return this->error;
+            }
+
+            uint_type inputs() const {
+                return this->input_nets.size();
+            }
+
+            uint_type outputs() const {
+                return this->output_nets.size();
+            }
+
+            uint_type instructions() const {
+                return this->program.size();
+            }
+
+            uint_type clockDomains() const {
+                return this->domains.size();
+            }
+
+            void reset() {
+                this->entry->reset(this->state.data());
+            }
+
+            void setInput(uint_type input, uint64_t lanes) {
+                this->state[this->entry->input_slots[input]] = lanes;
+            }
+
+            uint64_t getOutput(uint_type output) const {
+                return this->state[this->entry->output_slots[output]];
+            }
+
+            void evaluate() {
+                this->entry->evaluate(this->state.data());
+            }
+
+            bool settle() {
+                return this->entry->settle(this->state.data()) != 0;
+            }
+
+            void run(const uint64_t* stimulus, uint64_t* response, uint_type batches) {
+                /*
+                    Same batch layout as LevelizedSimulator<1>::run.
+                */
+                for (uint_type batch = 0; batch < batches; batch++) {
+                    for (uint_type i = 0; i < this->inputs(); i++) this->setInput(i, stimulus[i]);
+                    this->settle();
+                    for (uint_type o = 0; o < this->outputs(); o++) response[o] = this->getOutput(o);
+                    stimulus += this->inputs();
+                    response += this->outputs();
+                }
+            }
+    };
+
+    bool nativeReport(const netlist::Netlist& design, uint_type steps, std::ostream& out = std::cout) {
+        /*
+            Drives a design with random inputs on both the native and the
+            levelized simulator, checking every output after every step.
+        */
+        NativeSimulator native(design);
+        LevelizedSimulator<1> reference(design);
+        auto started = std::chrono::steady_clock::now();
+        if (!native.build(design.top)) {
+            SIM_ERROUT << "native simulation of " << design.top << ": " << native.failure() << std::endl;
+            return false;
+        }
+        double build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        std::mt19937_64 random(0x11ace);
+        std::vector<uint64_t> stimulus(steps * native.inputs());
+        for (auto& lanes : stimulus) lanes = random();
+        std::vector<uint64_t> native_response(steps * native.outputs());
+        std::vector<uint64_t> reference_response(steps * native.outputs());
+        started = std::chrono::steady_clock::now();
+        native.run(stimulus.data(), native_response.data(), steps);
+        auto middle = std::chrono::steady_clock::now();
+        reference.run(stimulus.data(), reference_response.data(), steps);
+        auto finished = std::chrono::steady_clock::now();
+        for (uint_type i = 0; i < native_response.size(); i++) {
+            if (native_response[i] != reference_response[i]) {
+                SIM_ERROUT << "output " << native.output_names[i % native.outputs()] << " differs from the reference at step "
+                           << i / native.outputs() << "." << std::endl;
+                return false;
+            }
+        }
+        double native_seconds = std::chrono::duration<double>(middle - started).count();
+        double reference_seconds = std::chrono::duration<double>(finished - middle).count();
+        out << "native simulation of " << design.top << " (" << native.instructions() << " gates, " << native.clockDomains()
+            << " clock domains) matches the reference over " << steps << " steps: " << std::fixed << std::setprecision(6)
+            << native_seconds << "s against " << reference_seconds << "s levelized, " << build_seconds << "s to build";
+        if (native_seconds > 0) {
+            out << " (" << std::setprecision(2) << native.instructions() * 64.0 * steps / native_seconds / 1e9 << " billion gate evaluations/s)";
+        }
+        out << '\n';
+        out.flush();
+        return true;
+    }
+};
+
+#endif
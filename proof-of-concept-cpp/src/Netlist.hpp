@@ -0,0 +1,897 @@
+#ifndef NETLIST_HPP
+#define NETLIST_HPP
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <set>
+#include <tuple>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include "generic-btree.hpp"
+#include "BuildSyntaxTree.hpp"
+#include "Lexer.hpp"
+#include "TreeIndex.hpp"
+
+#define NETLIST_OUT std::cout << "(Elaboration) "
+#define NETLIST_ERROUT std::cerr << "(Elaboration) Error: "
+#define NETLIST_WARNOUT std::cout << "(Elaboration) Warning: "
+
+namespace netlist {
+
+    /*
+        Flat gate level netlist. Nets, cells and ports live in parallel arrays
+        indexed by integer handles, so a design costs a few words per gate and is
+        walked linearly instead of through pointers.
+    */
+
+    typedef uint32_t Handle;
+    const Handle none = 0xffffffff;
+
+    namespace cells {
+        enum Kinds {
+            constant0,
+            constant1,
+            inverter,   //out = ~a
+            and_gate,   //out = a & b
+            or_gate,    //out = a | b
+            xor_gate,   //out = a ^ b
+            reg,        //out = a, sampled when clock rises, starts at 0
+            kind_count
+        };
+    };
+
+    namespace ports {
+        enum Directions {
+            input,
+            output
+        };
+    };
+
+    std::string cellKindStr(uint_type kind) {
+        switch (kind) {
+            case cells::constant0:  return "const0";
+            case cells::constant1:  return "const1";
+            case cells::inverter:   return "not";
+            case cells::and_gate:   return "and";
+            case cells::or_gate:    return "or";
+            case cells::xor_gate:   return "xor";
+            case cells::reg:        return "reg";
+            default:                return "notype";
+        }
+    }
+
+    class Netlist {
+        private:
+            struct CellKey {
+                uint8_t kind;
+                Handle a;
+                Handle b;
+
+                bool operator== (const CellKey& compare) const {
+                    return this->kind == compare.kind && this->a == compare.a && this->b == compare.b;
+                }
+            };
+
+            struct CellKeyHash {
+                size_t operator() (const CellKey& key) const {
+                    uint64_t hash = (uint64_t(key.a) << 32) ^ key.b ^ (uint64_t(key.kind) << 59);
+                    hash ^= hash >> 33;
+                    hash *= 0xff51afd7ed558ccdULL;
+                    hash ^= hash >> 33;
+                    return size_t(hash);
+                }
+            };
+
+            /*
+                Combinational cells are hash-consed, asking for a gate that already
+                exists with the same inputs returns its output net. Registers are
+                never shared, each one is state of its own.
+            */
+            std::unordered_map<CellKey,Handle,CellKeyHash> cell_index;
+
+            Handle addCell(uint8_t kind, Handle a, Handle b) {
+                Handle cell = this->cell_kind.size();
+                Handle out = this->addNet();
+                this->cell_kind.push_back(kind);
+                this->cell_a.push_back(a);
+                this->cell_b.push_back(b);
+                this->cell_clock.push_back(none);
+                this->cell_out.push_back(out);
+                this->net_driver[out] = cell;
+                return out;
+            }
+
+        public:
+            /*
+                Nets. Input port nets have no driver.
+            */
+            std::vector<Handle> net_driver;
+            std::vector<Handle> net_name;
+            /*
+                Cells. Unused inputs are none.
+            */
+            std::vector<uint8_t> cell_kind;
+            std::vector<Handle> cell_a;
+            std::vector<Handle> cell_b;
+            std::vector<Handle> cell_clock;
+            std::vector<Handle> cell_out;
+            /*
+                Ports, in declaration order with inputs first.
+            */
+            std::vector<uint8_t> port_direction;
+            std::vector<Handle> port_net;
+            std::vector<Handle> port_name;
+            /*
+                Names of ports and of the nets named at the top level.
+            */
+            std::vector<std::string> names;
+            std::string top;
+
+            Netlist() : cell_index(), net_driver(), net_name(), cell_kind(), cell_a(), cell_b(), cell_clock(), cell_out(),
+                        port_direction(), port_net(), port_name(), names(), top() {
+            }
+
+            uint_type nets() const {
+                return this->net_driver.size();
+            }
+
+            uint_type cells() const {
+                return this->cell_kind.size();
+            }
+
+            uint_type ports() const {
+                return this->port_net.size();
+            }
+
+            Handle addName(const std::string& name) {
+                this->names.push_back(name);
+                return this->names.size() - 1;
+            }
+
+            Handle addNet() {
+                this->net_driver.push_back(none);
+                this->net_name.push_back(none);
+                return this->net_driver.size() - 1;
+            }
+
+            void nameNet(Handle net, const std::string& name) {
+                /*
+                    The first name given to a net is kept.
+                */
+                if (this->net_name[net] == none) this->net_name[net] = this->addName(name);
+            }
+
+            Handle constant(bool value) {
+                return this->gate(value ? cells::constant1 : cells::constant0);
+            }
+
+            Handle gate(uint8_t kind, Handle a = none, Handle b = none) {
+                /*
+                    Returns the output net of a combinational cell. Inputs of
+                    commutative gates are ordered so a & b and b & a are one cell.
+                */
+                if (kind != cells::inverter && a > b) std::swap(a, b);
+                CellKey key = {kind, a, b};
+                auto found = this->cell_index.find(key);
+                if (found != this->cell_index.end()) return found->second;
+                Handle out = this->addCell(kind, a, b);
+                this->cell_index[key] = out;
+                return out;
+            }
+
+            Handle addRegister(Handle clock) {
+                /*
+                    Returns the register's output net. Its data input is connected
+                    later with connectRegister so it can depend on its own output.
+                */
+                Handle out = this->addCell(cells::reg, none, none);
+                this->cell_clock[this->net_driver[out]] = clock;
+                return out;
+            }
+
+            void connectRegister(Handle out, Handle data) {
+                this->cell_a[this->net_driver[out]] = data;
+            }
+
+            Handle addInput(const std::string& name) {
+                Handle net = this->addNet();
+                this->port_direction.push_back(ports::input);
+                this->port_net.push_back(net);
+                this->port_name.push_back(this->addName(name));
+                this->net_name[net] = this->port_name.back();
+                return net;
+            }
+
+            void addOutput(const std::string& name, Handle net) {
+                this->port_direction.push_back(ports::output);
+                this->port_net.push_back(net);
+                this->port_name.push_back(this->addName(name));
+                this->nameNet(net, name);
+            }
+
+            const std::string& portName(Handle port) const {
+                return this->names[this->port_name[port]];
+            }
+
+            uint_type bytes() const {
+                /*
+                    Memory held by the tables themselves, names excluded.
+                */
+                return this->net_driver.capacity() * sizeof(Handle) + this->net_name.capacity() * sizeof(Handle)
+                     + this->cell_kind.capacity() * sizeof(uint8_t) + this->cell_a.capacity() * sizeof(Handle)
+                     + this->cell_b.capacity() * sizeof(Handle) + this->cell_clock.capacity() * sizeof(Handle)
+                     + this->cell_out.capacity() * sizeof(Handle) + this->port_direction.capacity() * sizeof(uint8_t)
+                     + this->port_net.capacity() * sizeof(Handle) + this->port_name.capacity() * sizeof(Handle);
+            }
+
+            void summary(std::ostream& out = std::cout) const {
+                std::vector<uint_type> counts(cells::kind_count, 0);
+                for (uint_type i = 0; i < this->cells(); i++) counts[this->cell_kind[i]]++;
+                out << "netlist " << this->top << ": " << this->nets() << " nets, " << this->cells() << " cells, "
+                    << this->ports() << " ports, " << this->bytes() << " bytes" << '\n';
+                for (uint_type kind = 0; kind < cells::kind_count; kind++) {
+                    if (counts[kind] > 0) out << "\t" << cellKindStr(kind) << ": " << counts[kind] << '\n';
+                }
+                for (uint_type port = 0; port < this->ports(); port++) {
+                    out << "\t" << (this->port_direction[port] == ports::input ? "in  " : "out ") << this->portName(port)
+                        << " -> net " << this->port_net[port] << '\n';
+                }
+                out.flush();
+            }
+    };
+
+    /*
+        Bodies of function and component declarations are written in a small
+        gate level statement language:
+
+            <sum, carry> halfAdd(In a, In b) {
+                sum = a ^ b;                    combinational assignment
+                carry = a & b;
+            }
+            <q> toggle(In clk, In en) {
+                reg(clk) q = q ^ en;            register clocked by clk
+            }
+            <s, c> fullAdd(In a, In b, In cin) {
+                <s1, c1> = halfAdd(a, b);       instance of another declaration
+                <s, c2> = halfAdd(s1, cin);
+                c = c1 | c2;
+            }
+
+        Expressions use ~ & ^ | (tightest first), parentheses, names and the
+        constants 0 and 1. Names must be assigned before they are read, except
+        register outputs which may be read anywhere in their declaration.
+        Declarations may start with component, class or struct.
+    */
+
+    namespace ops {
+        enum Ops {
+            name,
+            constant0,
+            constant1,
+            inverter,
+            and_gate,
+            or_gate,
+            xor_gate
+        };
+    };
+
+    struct Statement {
+        enum Kinds {
+            assign,
+            reg,
+            instance
+        };
+
+        uint8_t kind;
+        std::vector<std::string> targets;
+        std::string clock;
+        std::string callee;
+        /*
+            Expression nodes are stored children first, so evaluating them in
+            order never needs recursion. The value of an assignment or register is
+            the node at root, each instance argument is a root in arguments.
+        */
+        uint_type first;
+        uint_type root;
+        std::vector<uint_type> arguments;
+    };
+
+    struct Declaration {
+        std::string name;
+        std::vector<std::string> inputs;
+        std::vector<std::string> input_types;
+        std::vector<std::string> outputs;
+        std::vector<Statement> statements;
+        /*
+            Expression nodes for every statement in the declaration.
+        */
+        std::vector<uint8_t> op;
+        std::vector<uint_type> operand_a;
+        std::vector<uint_type> operand_b;
+        std::vector<std::string> operand_name;
+
+        uint_type addOp(uint8_t kind, uint_type a = 0, uint_type b = 0, const std::string& name = "") {
+            this->op.push_back(kind);
+            this->operand_a.push_back(a);
+            this->operand_b.push_back(b);
+            this->operand_name.push_back(name);
+            return this->op.size() - 1;
+        }
+    };
+
+    std::vector<lexer::Token> significantTokens(const lexer::TokenArray& all) {
+        std::vector<lexer::Token> tokens;
+        for (uint_type i = 0; i < all.size(); i++) {
+            if (!all[i].trivia()) tokens.push_back(all[i]);
+        }
+        return tokens;
+    }
+
+    class DeclarationParser {
+        /*
+            Recursive descent over the significant tokens of one declaration. The
+            tokens are those of the whole source, see significantTokens, so any
+            number of declarations are parsed from a single tokenization.
+        */
+        private:
+            const std::string& source;
+            const std::vector<lexer::Token>& tokens;
+            uint_type at;
+
+            std::string text(uint_type index) const {
+                if (index >= this->tokens.size()) return "";
+                return this->source.substr(this->tokens[index].offset, this->tokens[index].length);
+            }
+
+            bool is(const std::string& literal) const {
+                return this->at < this->tokens.size() && this->text(this->at) == literal;
+            }
+
+            bool isName() const {
+                return this->at < this->tokens.size() && this->tokens[this->at].kind == lexer::kinds::identifier;
+            }
+
+            bool expect(const std::string& literal) {
+                if (this->is(literal)) {
+                    this->at++;
+                    return true;
+                }
+                return this->fail("expected \"" + literal + "\" but found \"" + this->text(this->at) + "\"");
+            }
+
+            bool fail(const std::string& message) {
+                if (this->error.empty()) this->error = message;
+                return false;
+            }
+
+            bool nameList(const std::string& close, std::vector<std::string>& names) {
+                while (!this->is(close)) {
+                    if (!this->isName()) return this->fail("expected a name but found \"" + this->text(this->at) + "\"");
+                    names.push_back(this->text(this->at++));
+                    if (!this->is(close) && !this->expect(",")) return false;
+                }
+                return this->expect(close);
+            }
+
+            bool expression(Declaration& decl, uint_type& node) {
+                /*
+                    Operator precedence with explicit stacks, so nesting is only
+                    limited by memory. Levels from loosest to tightest: | ^ &, then
+                    ~ on a single operand. Nodes are added as operators are
+                    reduced, children before their parents.
+                */
+                static const char* symbols[] = {"|", "^", "&"};
+                static const uint8_t kinds[] = {ops::or_gate, ops::xor_gate, ops::and_gate};
+                const uint8_t invert = 3;
+                const uint8_t open = 4;
+                std::vector<uint8_t> pending;
+                std::vector<uint_type> operands;
+                auto reduce = [&]() {
+                    uint_type rhs = operands.back();
+                    operands.pop_back();
+                    operands.back() = decl.addOp(kinds[pending.back()], operands.back(), rhs);
+                    pending.pop_back();
+                };
+                auto inverted = [&]() {
+                    while (!pending.empty() && pending.back() == invert) {
+                        operands.back() = decl.addOp(ops::inverter, operands.back());
+                        pending.pop_back();
+                    }
+                };
+                while (true) {
+                    if (this->is("~") || this->is("(")) {
+                        pending.push_back(this->is("~") ? invert : open);
+                        this->at++;
+                        continue;
+                    }
+                    if (this->is("0") || this->is("1")) operands.push_back(decl.addOp(this->is("0") ? ops::constant0 : ops::constant1));
+                    else if (this->isName()) operands.push_back(decl.addOp(ops::name, 0, 0, this->text(this->at)));
+                    else return this->fail("expected an expression but found \"" + this->text(this->at) + "\"");
+                    this->at++;
+                    inverted();
+                    while (true) {
+                        uint8_t level = 0;
+                        while (level < 3 && !this->is(symbols[level])) level++;
+                        if (level < 3) {
+                            while (!pending.empty() && pending.back() < invert && pending.back() >= level) reduce();
+                            pending.push_back(level);
+                            this->at++;
+                            break;
+                        }
+                        while (!pending.empty() && pending.back() < invert) reduce();
+                        if (pending.empty()) {
+                            node = operands.back();
+                            return true;
+                        }
+                        if (!this->expect(")")) return false;
+                        pending.pop_back();
+                        inverted();
+                    }
+                }
+            }
+
+            bool instance(Declaration& decl, Statement& statement) {
+                statement.kind = Statement::instance;
+                statement.callee = this->text(this->at++);
+                if (!this->expect("(")) return false;
+                while (!this->is(")")) {
+                    uint_type argument = 0;
+                    if (!this->expression(decl, argument)) return false;
+                    statement.arguments.push_back(argument);
+                    if (!this->is(")") && !this->expect(",")) return false;
+                }
+                return this->expect(")");
+            }
+
+            bool statement(Declaration& decl) {
+                Statement statement;
+                statement.kind = Statement::assign;
+                statement.first = decl.op.size();
+                statement.root = 0;
+                if (this->is("reg")) {
+                    this->at++;
+                    statement.kind = Statement::reg;
+                    if (!this->expect("(")) return false;
+                    if (!this->isName()) return this->fail("expected a clock name");
+                    statement.clock = this->text(this->at++);
+                    if (!this->expect(")")) return false;
+                }
+                if (this->is("<")) {
+                    if (statement.kind == Statement::reg) return this->fail("a register has a single output");
+                    this->at++;
+                    if (!this->nameList(">", statement.targets)) return false;
+                }
+                else if (this->isName()) statement.targets.push_back(this->text(this->at++));
+                else return this->fail("expected a statement but found \"" + this->text(this->at) + "\"");
+                if (!this->expect("=")) return false;
+                bool call = this->isName() && this->at + 1 < this->tokens.size() && this->text(this->at + 1) == "(";
+                if (call && statement.kind != Statement::reg) {
+                    if (!this->instance(decl, statement)) return false;
+                }
+                else {
+                    if (statement.targets.size() != 1) return this->fail("only instances assign several outputs");
+                    if (!this->expression(decl, statement.root)) return false;
+                }
+                decl.statements.push_back(statement);
+                return this->expect(";");
+            }
+
+        public:
+            std::string error;
+            uint_type end;      //Source offset just past the declaration
+
+            DeclarationParser(const std::string& source, const std::vector<lexer::Token>& tokens) : source(source), tokens(tokens), at(0), error(), end(0) {
+            }
+
+            bool parse(uint_type offset, Declaration& decl) {
+                this->at = std::lower_bound(this->tokens.begin(), this->tokens.end(), offset, [](const lexer::Token& lhs, uint_type rhs) {
+                    return lhs.offset < rhs;
+                }) - this->tokens.begin();
+                if (this->at > 0 && this->tokens[this->at - 1].end() > offset) return this->fail("offset is inside a token");
+                if (this->is("component") || this->is("class") || this->is("struct")) this->at++;
+                if (!this->expect("<") || !this->nameList(">", decl.outputs)) return false;
+                if (!this->isName()) return this->fail("expected a declaration name");
+                decl.name = this->text(this->at++);
+                if (!this->expect("(")) return false;
+                while (!this->is(")")) {
+                    /*
+                        Parameters are "Type name", a parameter without a name still
+                        takes an argument but can't be read.
+                    */
+                    std::vector<std::string> words;
+                    while (this->isName()) words.push_back(this->text(this->at++));
+                    if (words.empty()) return this->fail("expected a parameter but found \"" + this->text(this->at) + "\"");
+                    decl.inputs.push_back(words.size() > 1 ? words.back() : "");
+                    std::string type = words[0];
+                    for (uint_type i = 1; i + 1 < words.size(); i++) type += " " + words[i];
+                    decl.input_types.push_back(type);
+                    if (!this->is(")") && !this->expect(",")) return false;
+                }
+                if (!this->expect(")") || !this->expect("{")) return false;
+                while (!this->is("}")) {
+                    if (this->at >= this->tokens.size()) return this->fail("unterminated body");
+                    if (!this->statement(decl)) return false;
+                }
+                this->end = this->tokens[this->at].end();
+                return true;
+            }
+    };
+
+    struct Module {
+        /*
+            One declaration elaborated once and shared by all of its instances.
+            Values are numbered slots local to the module, the inputs being the
+            first ones. Steps are kept in the order the cells would have been
+            added to a netlist, so replaying them adds exactly the cells
+            elaborating each instance in place would.
+        */
+        enum Steps {
+            gate,           //slot result = cell kind over slots a and b
+            reg,            //slot result = register clocked by slot a
+            connect,        //register in slot a takes slot b
+            instance        //callee a, with wires[b...] its arguments then its results
+        };
+
+        struct Step {
+            uint8_t kind;
+            uint8_t cell;
+            uint32_t a;
+            uint32_t b;
+            uint32_t result;
+        };
+
+        std::string key;
+        std::string name;
+        uint_type inputs;
+        uint_type slots;
+        std::vector<Step> steps;
+        std::vector<uint32_t> wires;
+        std::vector<std::shared_ptr<const Module> > callees;
+        std::vector<uint32_t> outputs;
+        std::vector<std::pair<uint32_t,std::string> > names;    //Net names, only given at the top level
+        uint_type instances;        //Instances below this one once flattened, itself excluded
+
+        Module() : key(), name(), inputs(0), slots(0), steps(), wires(), callees(), outputs(), names(), instances(0) {
+        }
+    };
+
+    const uint32_t no_slot = 0xffffffff;
+
+    class Elaborator {
+        /*
+            Collects declarations from syntax trees or sources and flattens one of
+            them, with everything it instantiates, into a Netlist. Each declaration
+            is elaborated once into a Module shared by all of its instances, and
+            instances are only expanded when a netlist is asked for. Declaring
+            anything drops the modules built so far.
+        */
+        private:
+            lexer::Lexer lex;
+            uint_type max_depth;
+
+            static std::vector<std::string> terminals() {
+                return {"<", ">", "(", ")", "{", "}", ",", ";", "=", "&", "|", "^", "~"};
+            }
+
+            static std::string key(const Declaration& decl) {
+                /*
+                    Component and parameter tuple, the types its inputs are declared
+                    with. Instances only differ by the nets they are connected to,
+                    so every instance of a declaration shares one module.
+                */
+                std::string key = decl.name + "(";
+                for (uint_type i = 0; i < decl.input_types.size(); i++) key += (i > 0 ? "," : "") + decl.input_types[i];
+                return key + ")";
+            }
+
+            std::shared_ptr<const Module> build(const Declaration& decl, uint_type depth) {
+                /*
+                    Elaborates decl into a module, or returns the one already built
+                    for its key. Callees are built first and shared. Combinational
+                    cells over the same slots are shared within the module, the
+                    netlist would share them anyway.
+                */
+                std::string module_key = key(decl);
+                auto cached = this->modules.find(module_key);
+                if (cached != this->modules.end()) return cached->second;
+                if (this->building.count(module_key) > 0) {
+                    NETLIST_ERROUT << decl.name << ": instantiates itself." << std::endl;
+                    return nullptr;
+                }
+                if (depth > this->max_depth) {
+                    NETLIST_ERROUT << decl.name << ": instances nested more than " << this->max_depth << " deep." << std::endl;
+                    return nullptr;
+                }
+                this->building.insert(module_key);
+                std::shared_ptr<Module> module = std::make_shared<Module>();
+                std::shared_ptr<const Module> built = this->buildBody(decl, *module, depth) ? module : nullptr;
+                this->building.erase(module_key);
+                if (built == nullptr) return nullptr;
+                module->key = module_key;
+                this->modules[module_key] = built;
+                return built;
+            }
+
+            bool buildBody(const Declaration& decl, Module& module, uint_type depth) {
+                module.name = decl.name;
+                module.inputs = decl.inputs.size();
+                module.slots = decl.inputs.size();
+                std::map<std::string,uint32_t> env;
+                std::map<std::tuple<uint8_t,uint32_t,uint32_t>,uint32_t> shared;
+                auto addGate = [&](uint8_t kind, uint32_t a, uint32_t b) {
+                    if (kind != cells::inverter && a > b) std::swap(a, b);
+                    auto found = shared.find(std::make_tuple(kind, a, b));
+                    if (found != shared.end()) return found->second;
+                    uint32_t result = module.slots++;
+                    module.steps.push_back(Module::Step{Module::gate, kind, a, b, result});
+                    shared[std::make_tuple(kind, a, b)] = result;
+                    return result;
+                };
+                for (uint_type i = 0; i < decl.inputs.size(); i++) {
+                    if (!decl.inputs[i].empty()) env[decl.inputs[i]] = i;
+                }
+                /*
+                    Registers exist before anything is evaluated so they can be read
+                    anywhere, including by their own input.
+                */
+                for (auto& statement : decl.statements) {
+                    if (statement.kind != Statement::reg) continue;
+                    auto clock = env.find(statement.clock);
+                    if (clock == env.end()) {
+                        NETLIST_ERROUT << decl.name << ": clock \"" << statement.clock << "\" must be an input or register." << std::endl;
+                        return false;
+                    }
+                    if (env.find(statement.targets[0]) != env.end()) {
+                        NETLIST_ERROUT << decl.name << ": \"" << statement.targets[0] << "\" is assigned twice." << std::endl;
+                        return false;
+                    }
+                    uint32_t result = module.slots++;
+                    module.steps.push_back(Module::Step{Module::reg, 0, clock->second, no_slot, result});
+                    env[statement.targets[0]] = result;
+                }
+                std::vector<uint32_t> values(decl.op.size(), no_slot);
+                for (auto& statement : decl.statements) {
+                    uint_type last = (statement.kind == Statement::instance)
+                                   ? (statement.arguments.empty() ? statement.first : statement.arguments.back() + 1)
+                                   : statement.root + 1;
+                    for (uint_type node = statement.first; node < last; node++) {
+                        switch (decl.op[node]) {
+                            case ops::name: {
+                                auto found = env.find(decl.operand_name[node]);
+                                if (found == env.end()) {
+                                    NETLIST_ERROUT << decl.name << ": \"" << decl.operand_name[node] << "\" is read before it is assigned." << std::endl;
+                                    return false;
+                                }
+                                values[node] = found->second;
+                                break;
+                            }
+                            case ops::constant0:
+                                values[node] = addGate(cells::constant0, no_slot, no_slot);
+                                break;
+                            case ops::constant1:
+                                values[node] = addGate(cells::constant1, no_slot, no_slot);
+                                break;
+                            case ops::inverter:
+                                values[node] = addGate(cells::inverter, values[decl.operand_a[node]], no_slot);
+                                break;
+                            case ops::and_gate:
+                                values[node] = addGate(cells::and_gate, values[decl.operand_a[node]], values[decl.operand_b[node]]);
+                                break;
+                            case ops::or_gate:
+                                values[node] = addGate(cells::or_gate, values[decl.operand_a[node]], values[decl.operand_b[node]]);
+                                break;
+                            case ops::xor_gate:
+                                values[node] = addGate(cells::xor_gate, values[decl.operand_a[node]], values[decl.operand_b[node]]);
+                                break;
+                        }
+                    }
+                    std::vector<uint32_t> results;
+                    if (statement.kind == Statement::instance) {
+                        auto callee = this->declarations.find(statement.callee);
+                        if (callee == this->declarations.end()) {
+                            NETLIST_ERROUT << decl.name << ": no declaration named \"" << statement.callee << "\"." << std::endl;
+                            return false;
+                        }
+                        if (callee->second.inputs.size() != statement.arguments.size() || callee->second.outputs.size() != statement.targets.size()) {
+                            NETLIST_ERROUT << decl.name << ": " << statement.callee << " takes " << callee->second.inputs.size()
+                                           << " inputs and gives " << callee->second.outputs.size() << " outputs." << std::endl;
+                            return false;
+                        }
+                        std::shared_ptr<const Module> callee_module = this->build(callee->second, depth + 1);
+                        if (callee_module == nullptr) return false;
+                        uint32_t wires = module.wires.size();
+                        for (auto argument : statement.arguments) module.wires.push_back(values[argument]);
+                        for (uint_type i = 0; i < callee_module->outputs.size(); i++) {
+                            results.push_back(module.slots++);
+                            module.wires.push_back(results.back());
+                        }
+                        module.steps.push_back(Module::Step{Module::instance, 0, uint32_t(module.callees.size()), wires, no_slot});
+                        module.callees.push_back(callee_module);
+                        module.instances += 1 + callee_module->instances;
+                    }
+                    else results.push_back(values[statement.root]);
+                    if (statement.kind == Statement::reg) {
+                        module.steps.push_back(Module::Step{Module::connect, 0, env[statement.targets[0]], results[0], no_slot});
+                        continue;
+                    }
+                    for (uint_type i = 0; i < statement.targets.size(); i++) {
+                        if (env.find(statement.targets[i]) != env.end()) {
+                            NETLIST_ERROUT << decl.name << ": \"" << statement.targets[i] << "\" is assigned twice." << std::endl;
+                            return false;
+                        }
+                        env[statement.targets[i]] = results[i];
+                        module.names.push_back(std::make_pair(results[i], statement.targets[i]));
+                    }
+                }
+                for (auto& name : decl.outputs) {
+                    auto found = env.find(name);
+                    if (found == env.end()) {
+                        NETLIST_WARNOUT << decl.name << ": output \"" << name << "\" is never assigned, tied to 0." << std::endl;
+                        module.outputs.push_back(addGate(cells::constant0, no_slot, no_slot));
+                    }
+                    else module.outputs.push_back(found->second);
+                }
+                return true;
+            }
+
+            void instantiate(const Module& module, const std::vector<Handle>& inputs, std::vector<Handle>& outputs, Netlist& out,
+                             std::vector<Handle>* slot_nets = nullptr) const {
+                /*
+                    Adds the cells of one instance of module to out, with its inputs
+                    driven by the given nets. slot_nets, if given, is set to the net
+                    of every slot.
+                */
+                std::vector<Handle> nets(module.slots, none);
+                std::copy(inputs.begin(), inputs.end(), nets.begin());
+                for (auto& step : module.steps) {
+                    switch (step.kind) {
+                        case Module::gate:
+                            nets[step.result] = out.gate(step.cell, step.a == no_slot ? none : nets[step.a], step.b == no_slot ? none : nets[step.b]);
+                            break;
+                        case Module::reg:
+                            nets[step.result] = out.addRegister(nets[step.a]);
+                            break;
+                        case Module::connect:
+                            out.connectRegister(nets[step.a], nets[step.b]);
+                            break;
+                        case Module::instance: {
+                            const Module& callee = *module.callees[step.a];
+                            std::vector<Handle> arguments;
+                            std::vector<Handle> results;
+                            for (uint_type i = 0; i < callee.inputs; i++) arguments.push_back(nets[module.wires[step.b + i]]);
+                            this->instantiate(callee, arguments, results, out);
+                            for (uint_type i = 0; i < results.size(); i++) nets[module.wires[step.b + callee.inputs + i]] = results[i];
+                            break;
+                        }
+                    }
+                }
+                for (auto output : module.outputs) outputs.push_back(nets[output]);
+                if (slot_nets != nullptr) slot_nets->swap(nets);
+            }
+
+            std::map<std::string,std::shared_ptr<const Module> > modules;
+            std::set<std::string> building;
+
+        public:
+            std::map<std::string,Declaration> declarations;
+
+            Elaborator(uint_type max_depth = 256) : lex(terminals()), max_depth(max_depth), modules(), building(), declarations() {
+            }
+
+            bool declare(const std::string& source, const std::vector<lexer::Token>& tokens, uint_type offset, uint_type* end = nullptr) {
+                /*
+                    Parses the declaration starting at offset in source, given the
+                    significant tokens of all of source. end, if given, is set to
+                    the offset just past it.
+                */
+                Declaration decl;
+                DeclarationParser parser(source, tokens);
+                if (!parser.parse(offset, decl)) {
+                    NETLIST_ERROUT << "declaration at offset " << offset << ": " << parser.error << std::endl;
+                    return false;
+                }
+                if (this->declarations.find(decl.name) != this->declarations.end()) {
+                    NETLIST_WARNOUT << "\"" << decl.name << "\" is declared again, the later declaration is used." << std::endl;
+                }
+                if (end != nullptr) *end = parser.end;
+                this->declarations[decl.name] = decl;
+                this->modules.clear();
+                return true;
+            }
+
+            bool declare(const std::string& source, uint_type offset, uint_type* end = nullptr) {
+                return this->declare(source, significantTokens(this->lex.tokenize(source)), offset, end);
+            }
+
+            uint_type declareTree(const syntree::TreeIndex& index, const std::string& source) {
+                /*
+                    Declares every function_declr and component_declr in an indexed
+                    tree built from source, in source order. Returns how many were
+                    declared.
+                */
+                std::vector<lexer::Token> tokens = significantTokens(this->lex.tokenize(source));
+                uint_type declared = 0;
+                for (auto id : index.byRules({"function_declr", "component_declr"})) {
+                    if (this->declare(source, tokens, index.element(id).index)) declared++;
+                }
+                return declared;
+            }
+
+            uint_type declareTree(const Trie<syntree::SyntaxElement>& tree, const std::string& source) {
+                return this->declareTree(syntree::TreeIndex(tree), source);
+            }
+
+            uint_type declareAll(const std::string& source) {
+                /*
+                    Declares everything that looks like a declaration at the top level
+                    of source, for grammars that don't produce declaration nodes.
+                */
+                std::vector<lexer::Token> tokens = significantTokens(this->lex.tokenize(source));
+                uint_type declared = 0;
+                uint_type resume = 0;
+                int depth = 0;
+                for (uint_type i = 0; i < tokens.size(); i++) {
+                    if (tokens[i].offset < resume) continue;
+                    std::string text = source.substr(tokens[i].offset, tokens[i].length);
+                    if (text == "{") depth++;
+                    else if (text == "}") depth--;
+                    else if (depth == 0 && (text == "<" || text == "component" || text == "class" || text == "struct")) {
+                        uint_type end = 0;
+                        if (this->declare(source, tokens, tokens[i].offset, &end)) {
+                            declared++;
+                            resume = end;
+                        }
+                    }
+                }
+                return declared;
+            }
+
+            std::shared_ptr<const Module> module(const std::string& top) {
+                /*
+                    The elaborated module of a declaration without flattening it, its
+                    callees shared with every other module instantiating them.
+                */
+                auto found = this->declarations.find(top);
+                if (found == this->declarations.end()) {
+                    NETLIST_ERROUT << "no declaration named \"" << top << "\"." << std::endl;
+                    return nullptr;
+                }
+                return this->build(found->second, 0);
+            }
+
+            uint_type cachedModules() const {
+                return this->modules.size();
+            }
+
+            void flatten(const Module& top, Netlist& out) const {
+                /*
+                    Expands every instance under top into a flat netlist. Only nets
+                    named in top itself are named.
+                */
+                const Declaration& decl = this->declarations.at(top.name);
+                out = Netlist();
+                out.top = top.name;
+                std::vector<Handle> inputs;
+                for (uint_type i = 0; i < decl.inputs.size(); i++) {
+                    inputs.push_back(out.addInput(decl.inputs[i].empty() ? "in" + std::to_string(i) : decl.inputs[i]));
+                }
+                std::vector<Handle> outputs;
+                std::vector<Handle> nets;
+                this->instantiate(top, inputs, outputs, out, &nets);
+                for (auto& name : top.names) out.nameNet(nets[name.first], name.second);
+                for (uint_type i = 0; i < outputs.size(); i++) out.addOutput(decl.outputs[i], outputs[i]);
+            }
+
+            bool elaborate(const std::string& top, Netlist& out) {
+                std::shared_ptr<const Module> module = this->module(top);
+                if (module == nullptr) return false;
+                this->flatten(*module, out);
+                return true;
+            }
+    };
+};
+
+#endif
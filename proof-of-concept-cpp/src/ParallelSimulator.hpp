@@ -0,0 +1,708 @@
+#ifndef PARALLEL_SIMULATOR_HPP
+#define PARALLEL_SIMULATOR_HPP
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include "Netlist.hpp"
+#include "Simulator.hpp"
+
+namespace sim {
+
+    const uint32_t idle = 0xffffffff;       //No cell pending
+
+    class Barrier {
+        /*
+            Reusable barrier for a fixed number of threads.
+        */
+        private:
+            std::mutex lock;
+            std::condition_variable released;
+            uint_type parties;
+            uint_type arrived;
+            uint_type generation;
+
+        public:
+            Barrier(uint_type parties) : lock(), released(), parties(parties), arrived(0), generation(0) {
+            }
+
+            void wait() {
+                std::unique_lock<std::mutex> guard(this->lock);
+                uint_type current = this->generation;
+                if (++this->arrived == this->parties) {
+                    this->arrived = 0;
+                    this->generation++;
+                    this->released.notify_all();
+                    return;
+                }
+                this->released.wait(guard, [&]() { return this->generation != current; });
+            }
+    };
+
+    struct Event {
+        uint32_t slot;      //Slot in the receiving partition
+        uint64_t value;
+    };
+
+    class EventQueue {
+        /*
+            Unbounded lock-free queue with exactly one producer and one consumer
+            thread. Events are written into fixed size blocks, a block is only
+            published to the consumer through its atomic count, and the producer
+            links a fresh block once the current one is full, so neither side
+            ever waits for the other.
+        */
+        private:
+            static const uint32_t block_size = 1024;
+
+            struct Block {
+                Event events[block_size];
+                std::atomic<uint32_t> count;
+                std::atomic<Block*> next;
+
+                Block() : count(0), next(nullptr) {
+                }
+            };
+
+            Block* head;        //Consumer side
+            uint32_t read;
+            Block* tail;        //Producer side
+
+        public:
+            EventQueue() : head(new Block()), read(0), tail(nullptr) {
+                this->tail = this->head;
+            }
+
+            EventQueue(const EventQueue& copy) = delete;
+
+            ~EventQueue() {
+                while (this->head != nullptr) {
+                    Block* next = this->head->next.load();
+                    delete this->head;
+                    this->head = next;
+                }
+            }
+
+            void push(const Event& event) {
+                uint32_t count = this->tail->count.load(std::memory_order_relaxed);
+                if (count == block_size) {
+                    Block* block = new Block();
+                    this->tail->next.store(block, std::memory_order_release);
+                    this->tail = block;
+                    count = 0;
+                }
+                this->tail->events[count] = event;
+                this->tail->count.store(count + 1, std::memory_order_release);
+            }
+
+            bool pop(Event& event) {
+                while (true) {
+                    if (this->read < this->head->count.load(std::memory_order_acquire)) {
+                        event = this->head->events[this->read++];
+                        return true;
+                    }
+                    if (this->read < block_size) return false;
+                    Block* next = this->head->next.load(std::memory_order_acquire);
+                    if (next == nullptr) return false;
+                    delete this->head;
+                    this->head = next;
+                    this->read = 0;
+                }
+            }
+    };
+
+    class PartitionedSimulator {
+        /*
+            Event-driven simulation of a netlist split across threads. Cells are
+            grouped into clusters of connected cells, and clusters are spread over
+            the threads in runs of about equal size. Each thread keeps the values of the nets its cells
+            touch in slots of its own, and only re-evaluates cells whose inputs
+            changed, lowest level first. A change to a net read by another thread
+            is sent to it through the queue between the two threads.
+
+            Evaluation proceeds in rounds between barriers, and stops once no
+            thread has a cell left to evaluate. A settle() settles the combinational logic,
+            samples the registers whose clock rose (as LevelizedSimulator does)
+            and settles again, so its results match LevelizedSimulator<1>.
+        */
+        private:
+            struct Remote {
+                uint32_t thread;
+                uint32_t slot;
+            };
+
+            struct Partition {
+                std::vector<uint64_t> value;
+                /*
+                    Cells owned by this thread.
+                */
+                std::vector<uint8_t> op;
+                std::vector<uint32_t> a;
+                std::vector<uint32_t> b;
+                std::vector<uint32_t> out;
+                std::vector<uint32_t> level;
+                std::vector<uint32_t> remote_level;     //1 + highest level of another thread's cells feeding it, 0 if none
+                std::vector<uint8_t> scheduled;
+                /*
+                    Local cells reading each slot, and the other threads reading it,
+                    as compressed rows.
+                */
+                std::vector<uint32_t> reader_start;
+                std::vector<uint32_t> readers;
+                std::vector<uint32_t> remote_start;
+                std::vector<Remote> remotes;
+                /*
+                    Registers owned by this thread.
+                */
+                std::vector<uint32_t> reg_q;
+                std::vector<uint32_t> reg_d;
+                std::vector<uint32_t> reg_clock;
+                std::vector<uint64_t> reg_previous_clock;
+                std::vector<uint64_t> reg_next;
+                std::vector<uint32_t> constant_ones;
+                std::priority_queue<std::pair<uint32_t,uint32_t>, std::vector<std::pair<uint32_t,uint32_t> >,
+                                    std::greater<std::pair<uint32_t,uint32_t> > > pending;
+                uint64_t round;
+                uint64_t evaluations;
+            };
+
+            uint_type thread_count;
+            uint_type cluster_count;
+            std::vector<Partition> partitions;
+            std::deque<EventQueue> queues;              //queues[from * threads + to]
+            std::vector<std::vector<Remote> > input_slots;
+            std::vector<Remote> output_slots;
+            std::vector<std::thread> workers;
+            Barrier barrier;
+            std::atomic<uint32_t> lowest[3];
+            std::atomic<bool> stopping;
+            uint64_t round_total;
+            bool compiled;
+
+            static bool combinational(uint8_t kind) {
+                return kind != netlist::cells::constant0 && kind != netlist::cells::constant1 && kind != netlist::cells::reg;
+            }
+
+            void schedule(Partition& part, uint32_t slot) {
+                for (uint32_t i = part.reader_start[slot]; i < part.reader_start[slot + 1]; i++) {
+                    uint32_t cell = part.readers[i];
+                    if (part.scheduled[cell]) continue;
+                    part.scheduled[cell] = 1;
+                    part.pending.push(std::make_pair(part.level[cell], cell));
+                }
+            }
+
+            void publish(uint_type thread, uint32_t slot) {
+                /*
+                    Lets every reader of a slot that just changed know.
+                */
+                Partition& part = this->partitions[thread];
+                this->schedule(part, slot);
+                for (uint32_t i = part.remote_start[slot]; i < part.remote_start[slot + 1]; i++) {
+                    const Remote& remote = part.remotes[i];
+                    Event event = {remote.slot, part.value[slot]};
+                    this->queues[thread * this->thread_count + remote.thread].push(event);
+                }
+            }
+
+            void propagate(uint_type thread) {
+                /*
+                    Each round every thread takes in the events sent to it and
+                    reports the lowest level it has pending. No cell below the lowest
+                    level pending anywhere can change again, so a cell is safe to
+                    evaluate once every cell of another thread feeding it (directly
+                    or through cells of this thread) lies below it. Cells that are
+                    not safe wait for a later round, which keeps every cell to about
+                    one evaluation per settle.
+                */
+                Partition& part = this->partitions[thread];
+                std::vector<std::pair<uint32_t,uint32_t> > waiting;
+                while (true) {
+                    this->barrier.wait();
+                    Event event;
+                    for (uint_type from = 0; from < this->thread_count; from++) {
+                        if (from == thread) continue;
+                        EventQueue& queue = this->queues[from * this->thread_count + thread];
+                        while (queue.pop(event)) {
+                            if (part.value[event.slot] == event.value) continue;
+                            part.value[event.slot] = event.value;
+                            this->schedule(part, event.slot);
+                        }
+                    }
+                    /*
+                        Three minimums in rotation: the one for the next round was
+                        reset a round ago, after every thread had read it.
+                    */
+                    uint64_t round = part.round++;
+                    std::atomic<uint32_t>& lowest = this->lowest[round % 3];
+                    uint32_t local = part.pending.empty() ? idle : part.pending.top().first;
+                    uint32_t seen = lowest.load(std::memory_order_relaxed);
+                    while (local < seen && !lowest.compare_exchange_weak(seen, local, std::memory_order_relaxed)) {
+                    }
+                    this->barrier.wait();
+                    uint32_t horizon = lowest.load(std::memory_order_relaxed);
+                    if (thread == 0) {
+                        this->lowest[(round + 2) % 3].store(idle, std::memory_order_relaxed);
+                        this->round_total++;
+                    }
+                    if (horizon == idle) break;
+                    while (!part.pending.empty()) {
+                        uint32_t cell = part.pending.top().second;
+                        if (part.remote_level[cell] > horizon) {
+                            waiting.push_back(part.pending.top());
+                            part.pending.pop();
+                            continue;
+                        }
+                        part.pending.pop();
+                        part.scheduled[cell] = 0;
+                        uint64_t a = part.value[part.a[cell]];
+                        uint64_t b = (part.b[cell] != no_slot) ? part.value[part.b[cell]] : a;
+                        uint64_t result = 0;
+                        switch (part.op[cell]) {
+                            case netlist::cells::inverter: result = ~a; break;
+                            case netlist::cells::and_gate: result = a & b; break;
+                            case netlist::cells::or_gate:  result = a | b; break;
+                            case netlist::cells::xor_gate: result = a ^ b; break;
+                        }
+                        part.evaluations++;
+                        if (part.value[part.out[cell]] == result) continue;
+                        part.value[part.out[cell]] = result;
+                        this->publish(thread, part.out[cell]);
+                    }
+                    for (auto& entry : waiting) part.pending.push(entry);
+                    waiting.clear();
+                }
+            }
+
+            void sample(uint_type thread) {
+                Partition& part = this->partitions[thread];
+                for (uint_type r = 0; r < part.reg_q.size(); r++) {
+                    uint64_t clock = part.value[part.reg_clock[r]];
+                    uint64_t rose = clock & ~part.reg_previous_clock[r];
+                    uint64_t data = (part.reg_d[r] != no_slot) ? part.value[part.reg_d[r]] : 0;
+                    part.reg_next[r] = (data & rose) | (part.value[part.reg_q[r]] & ~rose);
+                    part.reg_previous_clock[r] = clock;
+                }
+                for (uint_type r = 0; r < part.reg_q.size(); r++) {
+                    if (part.value[part.reg_q[r]] == part.reg_next[r]) continue;
+                    part.value[part.reg_q[r]] = part.reg_next[r];
+                    this->publish(thread, part.reg_q[r]);
+                }
+            }
+
+            void settleThread(uint_type thread) {
+                this->propagate(thread);
+                this->sample(thread);
+                this->propagate(thread);
+            }
+
+            void work(uint_type thread) {
+                while (true) {
+                    this->barrier.wait();
+                    if (this->stopping) return;
+                    this->settleThread(thread);
+                    this->barrier.wait();
+                }
+            }
+
+            std::vector<uint32_t> cluster(const netlist::Netlist& design, const std::vector<netlist::Handle>& owned_cells) {
+                /*
+                    Grows clusters of about equal size breadth first over the cell
+                    graph, so connected cells land in the same cluster. Returns the
+                    cluster of every cell.
+                */
+                uint_type cell_count = design.cells();
+                std::vector<std::vector<netlist::Handle> > fanout(design.nets());
+                for (auto cell : owned_cells) {
+                    if (design.cell_a[cell] != netlist::none) fanout[design.cell_a[cell]].push_back(cell);
+                    if (design.cell_b[cell] != netlist::none) fanout[design.cell_b[cell]].push_back(cell);
+                    if (design.cell_kind[cell] == netlist::cells::reg && design.cell_clock[cell] != netlist::none) fanout[design.cell_clock[cell]].push_back(cell);
+                }
+                std::vector<uint32_t> cluster_of(cell_count, no_slot);
+                uint_type target = std::max<uint_type>(1, (owned_cells.size() + this->cluster_count - 1) / this->cluster_count);
+                uint32_t current = 0;
+                uint_type size = 0;
+                std::deque<netlist::Handle> frontier;
+                for (auto seed : owned_cells) {
+                    if (cluster_of[seed] != no_slot) continue;
+                    frontier.push_back(seed);
+                    cluster_of[seed] = current;
+                    while (!frontier.empty()) {
+                        netlist::Handle cell = frontier.front();
+                        frontier.pop_front();
+                        if (++size >= target) {
+                            /*
+                                Cluster full, whatever is still queued seeds the next one.
+                            */
+                            current++;
+                            size = 0;
+                            for (auto queued : frontier) cluster_of[queued] = current;
+                        }
+                        std::vector<netlist::Handle> neighbours(fanout[design.cell_out[cell]]);
+                        netlist::Handle inputs[] = {design.cell_a[cell], design.cell_b[cell], design.cell_clock[cell]};
+                        for (auto input : inputs) {
+                            if (input == netlist::none || design.net_driver[input] == netlist::none) continue;
+                            neighbours.push_back(design.net_driver[input]);
+                        }
+                        for (auto next : neighbours) {
+                            if (cluster_of[next] != no_slot || (!combinational(design.cell_kind[next]) && design.cell_kind[next] != netlist::cells::reg)) continue;
+                            cluster_of[next] = current;
+                            frontier.push_back(next);
+                        }
+                    }
+                    if (size > 0) {
+                        current++;
+                        size = 0;
+                    }
+                }
+                this->cluster_count = current;
+                return cluster_of;
+            }
+
+            bool build(const netlist::Netlist& design) {
+                /*
+                    Levels give the order cells are evaluated in within a thread.
+                */
+                uint_type cell_count = design.cells();
+                std::vector<uint32_t> level(cell_count, 0);
+                std::vector<uint32_t> waiting(cell_count, 0);
+                std::vector<std::vector<netlist::Handle> > comb_readers(design.nets());
+                std::vector<netlist::Handle> ready;
+                std::vector<netlist::Handle> owned_cells;
+                uint_type comb_count = 0;
+                for (netlist::Handle cell = 0; cell < cell_count; cell++) {
+                    uint8_t kind = design.cell_kind[cell];
+                    if (kind == netlist::cells::reg) owned_cells.push_back(cell);
+                    if (!combinational(kind)) continue;
+                    owned_cells.push_back(cell);
+                    comb_count++;
+                    netlist::Handle inputs[] = {design.cell_a[cell], design.cell_b[cell]};
+                    for (auto input : inputs) {
+                        if (input == netlist::none || design.net_driver[input] == netlist::none) continue;
+                        if (!combinational(design.cell_kind[design.net_driver[input]])) continue;
+                        waiting[cell]++;
+                        comb_readers[input].push_back(cell);
+                    }
+                    if (waiting[cell] == 0) ready.push_back(cell);
+                }
+                uint_type ordered = 0;
+                while (!ready.empty()) {
+                    netlist::Handle cell = ready.back();
+                    ready.pop_back();
+                    ordered++;
+                    for (auto reader : comb_readers[design.cell_out[cell]]) {
+                        level[reader] = std::max(level[reader], level[cell] + 1);
+                        if (--waiting[reader] == 0) ready.push_back(reader);
+                    }
+                }
+                if (ordered != comb_count) {
+                    SIM_ERROUT << design.top << " has a combinational loop." << std::endl;
+                    return false;
+                }
+                /*
+                    Clusters were grown one next to the other, so each thread takes a
+                    run of consecutive clusters of about equal total size, which keeps
+                    neighbouring clusters on the same thread.
+                */
+                std::vector<uint32_t> cluster_of = this->cluster(design, owned_cells);
+                std::vector<uint_type> cluster_size(this->cluster_count, 0);
+                for (auto cell : owned_cells) cluster_size[cluster_of[cell]]++;
+                std::vector<uint32_t> thread_of_cluster(this->cluster_count, 0);
+                uint_type assigned = 0;
+                for (uint32_t c = 0; c < this->cluster_count; c++) {
+                    thread_of_cluster[c] = std::min<uint_type>(this->thread_count - 1, assigned * this->thread_count / std::max<uint_type>(1, owned_cells.size()));
+                    assigned += cluster_size[c];
+                }
+                std::vector<uint32_t> owner(design.nets(), no_slot);
+                for (auto cell : owned_cells) owner[design.cell_out[cell]] = thread_of_cluster[cluster_of[cell]];
+                /*
+                    Highest level among the other threads' cells feeding each cell,
+                    looking through cells of the same thread, plus one.
+                */
+                std::vector<uint32_t> remote_level(cell_count, 0);
+                std::vector<netlist::Handle> by_level;
+                for (auto cell : owned_cells) {
+                    if (combinational(design.cell_kind[cell])) by_level.push_back(cell);
+                }
+                std::stable_sort(by_level.begin(), by_level.end(), [&](netlist::Handle lhs, netlist::Handle rhs) {
+                    return level[lhs] < level[rhs];
+                });
+                for (auto cell : by_level) {
+                    netlist::Handle inputs[] = {design.cell_a[cell], design.cell_b[cell]};
+                    for (auto input : inputs) {
+                        if (input == netlist::none || design.net_driver[input] == netlist::none) continue;
+                        netlist::Handle driver = design.net_driver[input];
+                        if (!combinational(design.cell_kind[driver])) continue;
+                        uint32_t remote = (owner[input] != owner[design.cell_out[cell]]) ? level[driver] + 1 : remote_level[driver];
+                        remote_level[cell] = std::max(remote_level[cell], remote);
+                    }
+                }
+                /*
+                    Slots: every net a thread's cells read or drive. Input and constant
+                    nets get a slot in every thread reading them.
+                */
+                std::vector<std::unordered_map<netlist::Handle,uint32_t> > slots(this->thread_count);
+                auto slotFor = [&](uint_type thread, netlist::Handle net) -> uint32_t {
+                    if (net == netlist::none) return no_slot;
+                    auto found = slots[thread].find(net);
+                    if (found != slots[thread].end()) return found->second;
+                    uint32_t slot = slots[thread].size();
+                    slots[thread][net] = slot;
+                    return slot;
+                };
+                std::vector<std::vector<std::pair<uint32_t,uint32_t> > > slot_readers(this->thread_count);
+                for (auto cell : owned_cells) {
+                    uint32_t thread = owner[design.cell_out[cell]];
+                    Partition& part = this->partitions[thread];
+                    uint32_t out = slotFor(thread, design.cell_out[cell]);
+                    uint32_t a = slotFor(thread, design.cell_a[cell]);
+                    uint32_t b = slotFor(thread, design.cell_b[cell]);
+                    if (design.cell_kind[cell] == netlist::cells::reg) {
+                        part.reg_q.push_back(out);
+                        part.reg_d.push_back(a);
+                        part.reg_clock.push_back(slotFor(thread, design.cell_clock[cell]));
+                        continue;
+                    }
+                    uint32_t local = part.op.size();
+                    part.op.push_back(design.cell_kind[cell]);
+                    part.a.push_back(a);
+                    part.b.push_back(b);
+                    part.out.push_back(out);
+                    part.level.push_back(level[cell]);
+                    part.remote_level.push_back(remote_level[cell]);
+                    slot_readers[thread].push_back(std::make_pair(a, local));
+                    if (b != no_slot && b != a) slot_readers[thread].push_back(std::make_pair(b, local));
+                }
+                for (netlist::Handle port = 0; port < design.ports(); port++) {
+                    netlist::Handle net = design.port_net[port];
+                    if (design.port_direction[port] == netlist::ports::input) {
+                        std::vector<Remote> replicas;
+                        for (uint32_t thread = 0; thread < this->thread_count; thread++) {
+                            auto found = slots[thread].find(net);
+                            if (found != slots[thread].end()) replicas.push_back(Remote{thread, found->second});
+                        }
+                        this->input_slots.push_back(replicas);
+                    }
+                    else {
+                        uint32_t thread = (owner[net] != no_slot) ? owner[net] : 0;
+                        this->output_slots.push_back(Remote{thread, slotFor(thread, net)});
+                    }
+                }
+                /*
+                    Inputs only read by an output still need a slot to be set.
+                */
+                for (netlist::Handle port = 0, input = 0; port < design.ports(); port++) {
+                    if (design.port_direction[port] != netlist::ports::input) continue;
+                    if (this->input_slots[input].empty()) {
+                        auto found = slots[0].find(design.port_net[port]);
+                        if (found != slots[0].end()) this->input_slots[input].push_back(Remote{0, found->second});
+                    }
+                    input++;
+                }
+                /*
+                    Constants last, an output driven straight by one only gets its
+                    slot with the ports above.
+                */
+                for (netlist::Handle cell = 0; cell < cell_count; cell++) {
+                    if (design.cell_kind[cell] != netlist::cells::constant1) continue;
+                    for (uint_type thread = 0; thread < this->thread_count; thread++) {
+                        auto found = slots[thread].find(design.cell_out[cell]);
+                        if (found != slots[thread].end()) this->partitions[thread].constant_ones.push_back(found->second);
+                    }
+                }
+                for (uint32_t thread = 0; thread < this->thread_count; thread++) {
+                    Partition& part = this->partitions[thread];
+                    uint_type slot_count = slots[thread].size();
+                    part.value.assign(slot_count, 0);
+                    part.scheduled.assign(part.op.size(), 0);
+                    part.reg_previous_clock.assign(part.reg_q.size(), 0);
+                    part.reg_next.assign(part.reg_q.size(), 0);
+                    part.reader_start.assign(slot_count + 1, 0);
+                    for (auto& entry : slot_readers[thread]) part.reader_start[entry.first + 1]++;
+                    for (uint_type s = 0; s < slot_count; s++) part.reader_start[s + 1] += part.reader_start[s];
+                    part.readers.assign(slot_readers[thread].size(), 0);
+                    std::vector<uint32_t> fill(part.reader_start.begin(), part.reader_start.end() - 1);
+                    for (auto& entry : slot_readers[thread]) part.readers[fill[entry.first]++] = entry.second;
+                    /*
+                        Other threads reading nets this thread drives.
+                    */
+                    std::vector<std::vector<Remote> > remote_rows(slot_count);
+                    for (auto& entry : slots[thread]) {
+                        if (owner[entry.first] != thread) continue;
+                        for (uint32_t other = 0; other < this->thread_count; other++) {
+                            if (other == thread) continue;
+                            auto found = slots[other].find(entry.first);
+                            if (found != slots[other].end()) remote_rows[entry.second].push_back(Remote{other, found->second});
+                        }
+                    }
+                    part.remote_start.assign(slot_count + 1, 0);
+                    for (uint_type s = 0; s < slot_count; s++) {
+                        part.remote_start[s + 1] = part.remote_start[s] + remote_rows[s].size();
+                        for (auto& remote : remote_rows[s]) part.remotes.push_back(remote);
+                    }
+                }
+                return true;
+            }
+
+        public:
+            std::vector<std::string> input_names;
+            std::vector<std::string> output_names;
+
+            PartitionedSimulator(const netlist::Netlist& design, uint_type threads, uint_type clusters_per_thread = 4)
+                : thread_count(std::max<uint_type>(1, threads)), cluster_count(0), partitions(), queues(), input_slots(), output_slots(),
+                  workers(), barrier(std::max<uint_type>(1, threads)), stopping(false), round_total(0), compiled(false),
+                  input_names(), output_names() {
+                this->cluster_count = this->thread_count * std::max<uint_type>(1, clusters_per_thread);
+                this->partitions.resize(this->thread_count);
+                for (uint_type i = 0; i < this->thread_count * this->thread_count; i++) this->queues.emplace_back();
+                for (auto& minimum : this->lowest) minimum = idle;
+                for (auto& part : this->partitions) {
+                    part.round = 0;
+                    part.evaluations = 0;
+                }
+                for (netlist::Handle port = 0; port < design.ports(); port++) {
+                    if (design.port_direction[port] == netlist::ports::input) this->input_names.push_back(design.portName(port));
+                    else this->output_names.push_back(design.portName(port));
+                }
+                this->compiled = this->build(design);
+                this->reset();
+                for (uint_type thread = 1; thread < this->thread_count; thread++) {
+                    this->workers.push_back(std::thread(&PartitionedSimulator::work, this, thread));
+                }
+            }
+
+            PartitionedSimulator(const PartitionedSimulator& copy) = delete;
+
+            ~PartitionedSimulator() {
+                this->stopping = true;
+                if (this->thread_count > 1) this->barrier.wait();
+                for (auto& worker : this->workers) worker.join();
+            }
+
+            bool valid() const {
+                return this->compiled;
+            }
+
+            uint_type threads() const {
+                return this->thread_count;
+            }
+
+            uint_type clusters() const {
+                return this->cluster_count;
+            }
+
+            uint_type inputs() const {
+                return this->input_slots.size();
+            }
+
+            uint_type outputs() const {
+                return this->output_slots.size();
+            }
+
+            uint64_t rounds() const {
+                return this->round_total;
+            }
+
+            uint64_t cellEvaluations() const {
+                uint64_t total = 0;
+                for (auto& part : this->partitions) total += part.evaluations;
+                return total;
+            }
+
+            void reset() {
+                /*
+                    Every slot back to 0 and every cell scheduled, so the first
+                    settle() evaluates the whole design.
+                */
+                for (auto& part : this->partitions) {
+                    std::fill(part.value.begin(), part.value.end(), 0);
+                    std::fill(part.reg_previous_clock.begin(), part.reg_previous_clock.end(), 0);
+                    for (auto one : part.constant_ones) part.value[one] = ~uint64_t(0);
+                    for (uint32_t cell = 0; cell < part.op.size(); cell++) {
+                        if (part.scheduled[cell]) continue;
+                        part.scheduled[cell] = 1;
+                        part.pending.push(std::make_pair(part.level[cell], cell));
+                    }
+                }
+            }
+
+            void setInput(uint_type input, uint64_t lanes) {
+                /*
+                    Only between calls to settle().
+                */
+                for (auto& replica : this->input_slots[input]) {
+                    Partition& part = this->partitions[replica.thread];
+                    if (part.value[replica.slot] == lanes) continue;
+                    part.value[replica.slot] = lanes;
+                    this->schedule(part, replica.slot);
+                }
+            }
+
+            uint64_t getOutput(uint_type output) const {
+                const Remote& slot = this->output_slots[output];
+                return this->partitions[slot.thread].value[slot.slot];
+            }
+
+            void settle() {
+                if (this->thread_count > 1) this->barrier.wait();
+                this->settleThread(0);
+                if (this->thread_count > 1) this->barrier.wait();
+            }
+    };
+
+    bool parallelReport(const netlist::Netlist& design, uint_type threads, uint_type steps, std::ostream& out = std::cout) {
+        /*
+            Drives a design with random inputs on both the partitioned simulator
+            and the single-threaded levelized one, checking every output after
+            every step.
+        */
+        PartitionedSimulator parallel(design, threads);
+        LevelizedSimulator<1> reference(design);
+        if (!parallel.valid() || !reference.valid()) return false;
+        std::mt19937_64 random(0x11ace);
+        double parallel_seconds = 0;
+        double reference_seconds = 0;
+        for (uint_type step = 0; step < steps; step++) {
+            for (uint_type i = 0; i < reference.inputs(); i++) {
+                uint64_t lanes = random();
+                parallel.setInput(i, lanes);
+                reference.setInput(i, &lanes);
+            }
+            auto started = std::chrono::steady_clock::now();
+            parallel.settle();
+            auto middle = std::chrono::steady_clock::now();
+            reference.settle();
+            auto finished = std::chrono::steady_clock::now();
+            parallel_seconds += std::chrono::duration<double>(middle - started).count();
+            reference_seconds += std::chrono::duration<double>(finished - middle).count();
+            for (uint_type o = 0; o < reference.outputs(); o++) {
+                uint64_t expected = 0;
+                reference.getOutput(o, &expected);
+                if (parallel.getOutput(o) != expected) {
+                    SIM_ERROUT << "output " << reference.output_names[o] << " differs from the reference at step " << step << "." << std::endl;
+                    return false;
+                }
+            }
+        }
+        out << "partitioned simulation of " << design.top << " on " << parallel.threads() << " threads (" << parallel.clusters()
+            << " clusters) matches the reference over " << steps << " steps: " << parallel.rounds() << " rounds, "
+            << parallel.cellEvaluations() << " cell evaluations, " << std::fixed << std::setprecision(6) << parallel_seconds
+            << "s against " << reference_seconds << "s single-threaded levelized" << '\n';
+        out.flush();
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef PARSE_CACHE_HPP
+#define PARSE_CACHE_HPP
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "generic-btree.hpp"
+#include "EBNF.hpp"
+#include "BuildSyntaxTree.hpp"
+#include "BinaryTree.hpp"
+
+#define CACHE_OUT std::cout << "(Parse cache) "
+#define CACHE_ERROUT std::cerr << "(Parse cache) Error: "
+
+namespace cache {
+
+    /*
+        Bumped whenever entries written by one version could be wrong for the
+        next, such as a change in how trees are built.
+    */
+    const char* const cache_format = "lltree-cache-1";
+
+    uint64_t contentHash(const std::string& content, uint64_t seed = 0xcbf29ce484222325ULL) {
+        /*
+            64-bit FNV-1a. Not cryptographic, the cache double checks the embedded
+            source on every hit so a collision only costs a reparse.
+        */
+        uint64_t hash = seed;
+        for (uint_type i = 0; i < content.size(); i++) {
+            hash ^= (unsigned char)content[i];
+            hash *= 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    class ParseCache {
+        /*
+            Persistent cache mapping (grammar hash, source hash) to a serialised
+            syntax tree in a directory. Entries are bintree files with the source
+            embedded. Hits refresh an entry's modification time, and the oldest
+            entries are removed whenever the directory grows past max_bytes.
+        */
+        private:
+            std::string directory;
+            uint_type max_bytes;
+            uint_type hit_count;
+            uint_type miss_count;
+
+            static const char* extension() {
+                return ".lltree";
+            }
+
+            std::string entryPath(uint64_t grammar_hash, uint64_t source_hash) const {
+                std::stringstream ss;
+                ss << this->directory << "/" << std::hex << std::setfill('0') << std::setw(16) << grammar_hash
+                   << "-" << std::setw(16) << source_hash << extension();
+                return ss.str();
+            }
+
+            static void touch(const std::string& path) {
+                utimes(path.c_str(), nullptr);
+            }
+
+        public:
+            ParseCache(const std::string& directory, uint_type max_bytes = uint_type(256) << 20)
+                : directory(directory), max_bytes(max_bytes), hit_count(0), miss_count(0) {
+                mkdir(this->directory.c_str(), 0755);
+            }
+
+            uint_type hits() const {
+                return this->hit_count;
+            }
+
+            uint_type misses() const {
+                return this->miss_count;
+            }
+
+            std::string entryPath(const EBNF& grammar, const std::string& source, const std::string& variant) const {
+                /*
+                    The variant names any parse option that changes the resulting
+                    tree, so trees built in different modes never share an entry.
+                    The cache format and how this build was compiled count too,
+                    as do start rules, which decide which rules become nodes.
+                */
+                std::string key = std::string(cache_format) + ";" + (syntree::give_up_easily ? "give-up;" : "full;") + variant;
+                for (auto& rule_id : grammar.startRules()) key += "start:" + rule_id + ";";
+                return this->entryPath(contentHash(key + grammar.grammar()), contentHash(source));
+            }
+
+            bool lookup(const EBNF& grammar, const std::string& source, Trie<syntree::SyntaxElement>& tree, const std::string& variant = "") {
+                std::string path = this->entryPath(grammar,source,variant);
+                struct stat info;
+                if (stat(path.c_str(), &info) != 0) {
+                    this->miss_count++;
+                    return false;
+                }
+                bintree::MappedTree mapped(path);
+                if (!mapped.valid() || !mapped.hasSource() || !(mapped.source() == source)) {
+                    /*
+                        Stale format, corrupt or a hash collision, treat as a miss and
+                        let the store overwrite it.
+                    */
+                    this->miss_count++;
+                    return false;
+                }
+                tree = mapped.toTrie();
+                touch(path);
+                this->hit_count++;
+                return true;
+            }
+
+            bool store(const EBNF& grammar, const std::string& source, const Trie<syntree::SyntaxElement>& tree, const std::string& variant = "") {
+                /*
+                    Written to a temporary file first and renamed into place so that
+                    concurrent builds never observe a partial entry.
+                */
+                std::string path = this->entryPath(grammar,source,variant);
+                std::stringstream tmp;
+                tmp << path << ".tmp" << getpid();
+                if (!bintree::write(tmp.str(),tree,&source)) {
+                    std::remove(tmp.str().c_str());
+                    CACHE_ERROUT << "was not able to write cache entry " << path << std::endl;
+                    return false;
+                }
+                if (std::rename(tmp.str().c_str(), path.c_str()) != 0) {
+                    std::remove(tmp.str().c_str());
+                    CACHE_ERROUT << "was not able to move cache entry into place: " << path << std::endl;
+                    return false;
+                }
+                this->evict();
+                return true;
+            }
+
+            uint_type evict() {
+                /*
+                    Removes least recently used entries until the cache fits in
+                    max_bytes. Returns the number of entries removed.
+                */
+                struct Entry {
+                    std::string path;
+                    uint_type size;
+                    time_t used;
+                };
+                std::vector<Entry> entries;
+                uint_type total = 0;
+                DIR* dir = opendir(this->directory.c_str());
+                if (dir == nullptr) return 0;
+                std::string ext(extension());
+                while (struct dirent* item = readdir(dir)) {
+                    std::string name(item->d_name);
+                    if (name.size() <= ext.size() || name.compare(name.size() - ext.size(), ext.size(), ext) != 0) continue;
+                    Entry entry;
+                    entry.path = this->directory + "/" + name;
+                    struct stat info;
+                    if (stat(entry.path.c_str(), &info) != 0) continue;
+                    entry.size = info.st_size;
+                    entry.used = info.st_mtime;
+                    total += entry.size;
+                    entries.push_back(entry);
+                }
+                closedir(dir);
+                if (total <= this->max_bytes) return 0;
+                std::sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs) {
+                    return lhs.used < rhs.used;
+                });
+                uint_type removed = 0;
+                for (uint_type i = 0; i < entries.size() && total > this->max_bytes; i++) {
+                    if (std::remove(entries[i].path.c_str()) == 0) {
+                        total -= entries[i].size;
+                        removed++;
+                    }
+                }
+                return removed;
+            }
+    };
+};
+
+namespace syntree {
+
+    Trie<SyntaxElement> buildTree(const EBNF& grammar, const std::string& source, cache::ParseCache& parse_cache) {
+        /*
+            Returns the cached tree for this grammar and source if there is one,
+            otherwise parses and stores the result.
+        */
+        Trie<SyntaxElement> tree;
+        if (parse_cache.lookup(grammar,source,tree)) return tree;
+        tree = buildTree(grammar,source);
+        parse_cache.store(grammar,source,tree);
+        return tree;
+    }
+
+    Trie<SyntaxElement> buildTree(const EBNF& grammar, const std::string& source, const ParseContext& context, cache::ParseCache& parse_cache) {
+        /*
+            Recovering parses bypass the cache, their diagnostics are not stored.
+            Hashes aren't stored either, cached trees are hashed again on a hit.
+        */
+        if (context.recovering()) return buildTree(grammar,source,context);
+        std::string variant = (context.tokens != nullptr) ? "lex" : "";
+        Trie<SyntaxElement> tree;
+        if (parse_cache.lookup(grammar,source,tree,variant)) {
+            if (context.hashing) hashTree(tree);
+            return tree;
+        }
+        tree = buildTree(grammar,source,context);
+        parse_cache.store(grammar,source,tree,variant);
+        return tree;
+    }
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef PREPROCESS_HPP
+#define PREPROCESS_HPP
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "generic-btree.hpp"
+#include "BuildSyntaxTree.hpp"
+
+namespace preprocess {
+
+    class OffsetMap {
+        /*
+            Maps offsets in preprocessed text back to the source it came from. Text
+            is only ever removed, so between two removals offsets differ by a
+            constant and one entry per removed run is enough: the first processed
+            offset after the run and the original offset it came from.
+        */
+        private:
+            std::vector<std::pair<uint_type,uint_type> > entries;
+
+        public:
+            OffsetMap() : entries() {
+                this->entries.push_back(std::make_pair(0, 0));
+            }
+
+            void shift(uint_type processed, uint_type original) {
+                if (this->entries.back().first == processed) this->entries.back().second = original;
+                else this->entries.push_back(std::make_pair(processed, original));
+            }
+
+            uint_type original(uint_type processed) const {
+                auto after = std::upper_bound(this->entries.begin(), this->entries.end(), std::make_pair(processed, uint_type(-1)));
+                --after;
+                return after->second + (processed - after->first);
+            }
+
+            uint_type originalEnd(uint_type processed_begin, uint_type processed_end) const {
+                /*
+                    End of the original range a processed range came from, so a range
+                    ending in a collapsed run doesn't cover what was removed after it.
+                */
+                if (processed_end <= processed_begin) return this->original(processed_begin);
+                return this->original(processed_end - 1) + 1;
+            }
+
+            uint_type size() const {
+                return this->entries.size();
+            }
+    };
+
+    struct Preprocessed {
+        std::string text;
+        OffsetMap map;
+    };
+
+    Preprocessed preprocess(const std::string& source) {
+        /*
+            One pass over the source. Comments are removed and every run of
+            whitespace and comments becomes a single space, unless it is at the very
+            start or end. String literals are copied untouched, comment markers
+            inside them included.
+        */
+        Preprocessed result;
+        result.text.reserve(source.size());
+        uint_type i = 0;
+        while (i < source.size()) {
+            uint_type run = i;
+            i = syntree::skipTrivia(source, i);
+            if (i > run) {
+                bool keep_space = run > 0 && i < source.size();
+                if (keep_space) result.text += ' ';
+                if (i - run > (keep_space ? 1 : 0)) result.map.shift(result.text.size(), i);
+                continue;
+            }
+            if (source[i] == '"') {
+                uint_type end = source.find('"', i + 1);
+                end = (end == std::string::npos) ? source.size() : end + 1;
+                result.text.append(source, i, end - i);
+                i = end;
+                continue;
+            }
+            result.text += source[i++];
+        }
+        return result;
+    }
+
+    void restore(Trie<syntree::SyntaxElement>& tree, const OffsetMap& map, const std::string& source) {
+        /*
+            Points a tree parsed from preprocessed text back at the original source,
+            content included, so it can't be told apart from a tree over the source
+            apart from the comments it no longer has children for. The root covers
+            the whole source, whitespace it started or ended with included.
+        */
+        std::vector<Trie<syntree::SyntaxElement>*> work;
+        tree.self.index = 0;
+        tree.self.content = source;
+        for (auto& child : tree.data) work.push_back(&child);
+        while (!work.empty()) {
+            Trie<syntree::SyntaxElement>* node = work.back();
+            work.pop_back();
+            uint_type begin = map.original(node->self.index);
+            uint_type end = map.originalEnd(node->self.index, node->self.index + node->self.content.size());
+            node->self.index = begin;
+            node->self.content = source.substr(begin, end - begin);
+            for (auto& child : node->data) work.push_back(&child);
+        }
+    }
+
+    void restore(std::vector<syntree::Diagnostic>& diagnostics, const OffsetMap& map, const std::string& source) {
+        /*
+            Moves diagnostics back onto the original source and locates their line
+            and column in it.
+        */
+        for (auto& diagnostic : diagnostics) {
+            uint_type begin = map.original(diagnostic.offset);
+            diagnostic.length = map.originalEnd(diagnostic.offset, diagnostic.offset + diagnostic.length) - begin;
+            diagnostic.offset = begin;
+        }
+        syntree::locate(source, diagnostics);
+    }
+};
+
+#endif
@@ -121,6 +121,33 @@ namespace RegexHelper {
         }
     }
     
+    std::string matchAt(const pcrecpp::RE& regex, const std::string& content, uint_type position) {
+        /*
+            The match of a regex anchored at position, or an empty string if it
+            does not match there.
+        */
+        std::string matched_text;
+        if (position >= content.size()) return matched_text;
+        pcrecpp::StringPiece wrk_content(content.data() + position, content.size() - position);
+        if (!regex.Consume(&wrk_content, &matched_text)) matched_text.clear();
+        return matched_text;
+    }
+
+    std::pair<std::string,uint_type> nextMatch(const pcrecpp::RE& regex, const std::string& content, uint_type position) {
+        /*
+            The first match of a regex at or after position and where it starts,
+            or an empty string at content.size() if there is none.
+        */
+        std::string matched_text;
+        if (position < content.size()) {
+            pcrecpp::StringPiece wrk_content(content.data() + position, content.size() - position);
+            if (regex.FindAndConsume(&wrk_content, &matched_text)) {
+                return std::pair<std::string,uint_type>(matched_text, content.size() - wrk_content.size() - matched_text.size());
+            }
+        }
+        return std::pair<std::string,uint_type>(std::string(), content.size());
+    }
+
     std::string nthMatch(const pcrecpp::RE& regex, const std::string& content, uint_type match_number = 0) {
         /*
             0-indexed nth match for a regex in string. if that match doesn't exist then
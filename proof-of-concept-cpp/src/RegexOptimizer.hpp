@@ -0,0 +1,716 @@
+#ifndef REGEX_OPTIMIZER_HPP
+#define REGEX_OPTIMIZER_HPP
+#include <string>
+#include <vector>
+#include <map>
+#include <bitset>
+#include <cstdio>
+#include <cstdlib>
+
+#ifndef PARSE_TYPE_DEFAULTS
+#define PARSE_TYPE_DEFAULTS
+typedef uintmax_t uint_type;
+typedef double prec_type;
+#endif
+
+namespace regexopt {
+
+    /*
+        Rewrites assembled rule patterns into equivalent, cheaper ones:
+
+            - capturing groups nothing reads become non-capturing
+            - non-capturing groups that don't need to be groups are removed
+            - common literal prefixes of neighbouring alternatives are factored out
+            - neighbouring single character alternatives become one class
+            - a single character repeat directly followed by something that can
+              never start with a character it matches is made possessive
+
+        Only the subset of PCRE syntax the evaluator and ordinary specials produce
+        is understood. Anything else (option settings, conditionals, \Q..\E,
+        verbs) leaves the pattern untouched, and numbered back references or
+        calls keep every capture.
+    */
+
+    typedef std::bitset<256> CharSet;
+
+    enum kinds {
+        literal,    //One character
+        charset,    //Class, escape such as \d, or .
+        call,       //Subroutine call to a named group
+        group,
+        opaque      //Anything else, left exactly as written
+    };
+
+    struct Node {
+        uint_type kind;
+        std::string text;           //Atom as written, or the opening of a group ("(", "(?:", "(?P<name>" ...)
+        std::string quantifier;
+        std::string name;           //Named groups and calls
+        uint_type number;           //Capture number, 0 if the group doesn't capture
+        bool known;                 //Whether set holds (a superset of) what the atom matches
+        bool mergeable;             //Whether text can be placed inside a character class
+        CharSet set;
+        std::vector<std::vector<Node> > alternatives;
+
+        Node() : kind(opaque), text(), quantifier(), name(), number(0), known(false), mergeable(false), set(), alternatives() {
+        }
+
+        bool plainGroup() const {
+            return this->kind == group && this->text == "(?:";
+        }
+
+        bool singleUnit() const {
+            /*
+                Matches exactly one thing and can take a quantifier directly.
+            */
+            return this->kind == literal || this->kind == charset || this->kind == call;
+        }
+    };
+
+    void addRange(CharSet& set, unsigned from, unsigned to) {
+        for (unsigned c = from; c <= to && c < 256; c++) set.set(c);
+    }
+
+    bool escapeClass(char escape, CharSet& set) {
+        /*
+            Sets for \d, \w, \s and their negations. Bytes above 127 depend on the
+            character tables, so the positive classes include them all, keeping
+            every set a superset of what can actually match.
+        */
+        CharSet base;
+        switch (escape) {
+            case 'd': case 'D':
+                addRange(base,'0','9');
+                break;
+            case 'w': case 'W':
+                addRange(base,'0','9');
+                addRange(base,'a','z');
+                addRange(base,'A','Z');
+                base.set('_');
+                break;
+            case 's': case 'S':
+                addRange(base,9,13);
+                base.set(' ');
+                break;
+            default:
+                return false;
+        }
+        if (escape >= 'a') addRange(base,128,255);
+        else base.flip();
+        set |= base;
+        return true;
+    }
+
+    bool literalEscape(const std::string& pattern, uint_type& at, unsigned& code) {
+        /*
+            Reads the escape starting at pattern[at] (just after the backslash) if
+            it stands for a single character, leaving at on its last character.
+        */
+        char c = pattern[at];
+        switch (c) {
+            case 'n': code = '\n'; return true;
+            case 't': code = '\t'; return true;
+            case 'r': code = '\r'; return true;
+            case 'f': code = '\f'; return true;
+            case 'e': code = 27; return true;
+            case 'a': code = 7; return true;
+            case 'x': {
+                std::string digits;
+                if (at + 1 < pattern.size() && pattern[at + 1] == '{') {
+                    uint_type close = pattern.find('}', at + 2);
+                    if (close == std::string::npos) return false;
+                    digits = pattern.substr(at + 2, close - at - 2);
+                    at = close;
+                }
+                else {
+                    while (digits.size() < 2 && at + 1 < pattern.size() && isxdigit((unsigned char)pattern[at + 1])) digits += pattern[++at];
+                }
+                code = digits.empty() ? 0 : std::strtoul(digits.c_str(), nullptr, 16);
+                return code < 256;
+            }
+            case '0': {
+                std::string digits;
+                while (digits.size() < 2 && at + 1 < pattern.size() && pattern[at + 1] >= '0' && pattern[at + 1] <= '7') digits += pattern[++at];
+                code = digits.empty() ? 0 : std::strtoul(digits.c_str(), nullptr, 8);
+                return true;
+            }
+            default:
+                if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) return false;
+                code = (unsigned char)c;
+                return true;
+        }
+    }
+
+    std::string classText(unsigned code) {
+        /*
+            A character written so it means itself inside or outside a class.
+        */
+        if ((code >= 'a' && code <= 'z') || (code >= 'A' && code <= 'Z') || (code >= '0' && code <= '9') || code == '_') return std::string(1, char(code));
+        if (code > 32 && code < 127) return std::string("\\") + char(code);
+        char hex[8];
+        std::snprintf(hex, sizeof(hex), "\\x%02x", code);
+        return hex;
+    }
+
+    class Parser {
+        private:
+            const std::string& pattern;
+            uint_type at;
+            uint_type captures;
+
+            bool fail() {
+                this->failed = true;
+                return false;
+            }
+
+            bool parseClass(Node& node) {
+                uint_type start = this->at++;
+                bool negated = false;
+                bool exact = true;
+                CharSet set;
+                if (this->at < this->pattern.size() && this->pattern[this->at] == '^') {
+                    negated = true;
+                    this->at++;
+                }
+                uint_type inner = this->at;
+                bool first = true;
+                bool have_previous = false;
+                unsigned previous = 0;
+                while (this->at < this->pattern.size() && (this->pattern[this->at] != ']' || first)) {
+                    first = false;
+                    char c = this->pattern[this->at];
+                    unsigned code = (unsigned char)c;
+                    bool single = true;
+                    if (c == '[' && this->at + 1 < this->pattern.size() && this->pattern[this->at + 1] == ':') {
+                        uint_type close = this->pattern.find(":]", this->at + 2);
+                        if (close == std::string::npos) return this->fail();
+                        this->at = close + 2;
+                        exact = false;
+                        addRange(set,0,255);
+                        have_previous = false;
+                        continue;
+                    }
+                    if (c == '\\') {
+                        if (++this->at >= this->pattern.size()) return this->fail();
+                        char escape = this->pattern[this->at];
+                        if (escape == 'b') code = 8;
+                        else if (escapeClass(escape, set)) {
+                            exact = false;
+                            single = false;
+                        }
+                        else if (!literalEscape(this->pattern, this->at, code)) {
+                            exact = false;
+                            addRange(set,0,255);
+                            single = false;
+                        }
+                    }
+                    else if (c == '-' && have_previous && this->at + 1 < this->pattern.size() && this->pattern[this->at + 1] != ']') {
+                        /*
+                            Range, the upper bound may itself be escaped.
+                        */
+                        this->at++;
+                        unsigned upper = (unsigned char)this->pattern[this->at];
+                        if (this->pattern[this->at] == '\\') {
+                            if (++this->at >= this->pattern.size() || !literalEscape(this->pattern, this->at, upper)) return this->fail();
+                        }
+                        if (upper < previous) return this->fail();
+                        addRange(set, previous, upper);
+                        have_previous = false;
+                        this->at++;
+                        continue;
+                    }
+                    if (single) set.set(code);
+                    have_previous = single;
+                    previous = code;
+                    this->at++;
+                }
+                if (this->at >= this->pattern.size()) return this->fail();
+                std::string contents = this->pattern.substr(inner, this->at - inner);
+                this->at++;
+                node.kind = charset;
+                node.text = this->pattern.substr(start, this->at - start);
+                if (negated) {
+                    node.known = exact;
+                    node.set = ~set;
+                }
+                else {
+                    node.known = true;
+                    node.set = set;
+                }
+                node.mergeable = !negated && !contents.empty() && contents[0] != ']' && contents[0] != '-' && contents.back() != '-';
+                return true;
+            }
+
+            bool parseEscape(Node& node) {
+                uint_type start = this->at++;
+                if (this->at >= this->pattern.size()) return this->fail();
+                char c = this->pattern[this->at];
+                unsigned code = 0;
+                if (c == 'Q' || c == 'E') return this->fail();
+                if (c == 'g' || c == 'k') {
+                    /*
+                        \g'name' and \g<name> are calls, every other form refers back to
+                        a capture.
+                    */
+                    char open = (this->at + 1 < this->pattern.size()) ? this->pattern[this->at + 1] : '\0';
+                    char close = (open == '\'') ? '\'' : (open == '<') ? '>' : (open == '{') ? '}' : '\0';
+                    std::string name;
+                    if (close != '\0') {
+                        uint_type end = this->pattern.find(close, this->at + 2);
+                        if (end == std::string::npos) return this->fail();
+                        name = this->pattern.substr(this->at + 2, end - this->at - 2);
+                        this->at = end;
+                    }
+                    else {
+                        while (this->at + 1 < this->pattern.size() && (isdigit((unsigned char)this->pattern[this->at + 1]) || this->pattern[this->at + 1] == '-' || this->pattern[this->at + 1] == '+')) {
+                            name += this->pattern[++this->at];
+                        }
+                    }
+                    if (name.empty()) return this->fail();
+                    bool numbered = isdigit((unsigned char)name[0]) || name[0] == '-' || name[0] == '+';
+                    if (numbered) this->numeric_refs = true;
+                    this->at++;
+                    node.text = this->pattern.substr(start, this->at - start);
+                    if (c == 'g' && open != '{' && !numbered) {
+                        node.kind = call;
+                        node.name = name;
+                    }
+                    return true;
+                }
+                if (c >= '1' && c <= '9') {
+                    this->numeric_refs = true;
+                    while (this->at < this->pattern.size() && isdigit((unsigned char)this->pattern[this->at])) this->at++;
+                    node.text = this->pattern.substr(start, this->at - start);
+                    return true;
+                }
+                if (escapeClass(c, node.set)) {
+                    node.kind = charset;
+                    node.known = true;
+                    node.mergeable = true;
+                }
+                else if (literalEscape(this->pattern, this->at, code)) {
+                    node.kind = literal;
+                    node.known = true;
+                    node.mergeable = true;
+                    node.set.set(code);
+                }
+                else if (c == 'p' || c == 'P') {
+                    if (this->at + 1 < this->pattern.size() && this->pattern[this->at + 1] == '{') {
+                        uint_type end = this->pattern.find('}', this->at);
+                        if (end == std::string::npos) return this->fail();
+                        this->at = end;
+                    }
+                    else this->at++;
+                    node.kind = charset;
+                }
+                else if (c == 'c') {
+                    this->at++;
+                }
+                else if (c == 'h' || c == 'H' || c == 'v' || c == 'V' || c == 'N' || c == 'R' || c == 'X' || c == 'C') {
+                    node.kind = charset;
+                }
+                this->at++;
+                node.text = this->pattern.substr(start, this->at - start);
+                return true;
+            }
+
+            bool parseGroup(Node& node) {
+                uint_type start = this->at++;
+                if (this->at < this->pattern.size() && this->pattern[this->at] == '*') return this->fail();
+                if (this->at < this->pattern.size() && this->pattern[this->at] == '?') {
+                    uint_type close = std::string::npos;
+                    std::string rest = this->pattern.substr(this->at + 1, 4);
+                    if (rest.compare(0, 1, ":") == 0 || rest.compare(0, 1, "=") == 0 || rest.compare(0, 1, "!") == 0
+                        || rest.compare(0, 1, ">") == 0 || rest.compare(0, 2, "<=") == 0 || rest.compare(0, 2, "<!") == 0) {
+                        this->at += (rest[0] == '<') ? 3 : 2;
+                    }
+                    else if (rest.compare(0, 2, "P<") == 0 || rest.compare(0, 1, "<") == 0 || rest.compare(0, 1, "'") == 0) {
+                        uint_type name_start = this->at + ((rest[0] == 'P') ? 3 : 2);
+                        close = this->pattern.find((rest[0] == '\'') ? '\'' : '>', name_start);
+                        if (close == std::string::npos) return this->fail();
+                        node.name = this->pattern.substr(name_start, close - name_start);
+                        node.number = ++this->captures;
+                        this->at = close + 1;
+                    }
+                    else if (rest.compare(0, 1, "C") == 0 || rest.compare(0, 1, "#") == 0 || rest.compare(0, 1, "R") == 0
+                             || rest.compare(0, 2, "P=") == 0 || rest.compare(0, 2, "P>") == 0 || rest.compare(0, 1, "&") == 0
+                             || isdigit((unsigned char)rest[0]) || rest[0] == '+' || rest[0] == '-') {
+                        /*
+                            Callouts, comments, recursion and references, kept as written.
+                        */
+                        close = this->pattern.find(')', this->at);
+                        if (close == std::string::npos) return this->fail();
+                        if (isdigit((unsigned char)rest[0]) || ((rest[0] == '+' || rest[0] == '-') && isdigit((unsigned char)rest[1]))) this->numeric_refs = true;
+                        else if (rest[0] == '-' || rest[0] == '+') return this->fail();
+                        this->at = close + 1;
+                        node.text = this->pattern.substr(start, this->at - start);
+                        if (rest.compare(0, 2, "P>") == 0 || rest[0] == '&') {
+                            node.kind = call;
+                            node.name = this->pattern.substr(start + ((rest[0] == '&') ? 3 : 4), close - start - ((rest[0] == '&') ? 3 : 4));
+                        }
+                        return true;
+                    }
+                    else return this->fail();
+                }
+                else node.number = ++this->captures;
+                node.kind = group;
+                node.text = this->pattern.substr(start, this->at - start);
+                node.alternatives = this->parseAlternatives();
+                if (this->failed) return false;
+                if (this->at >= this->pattern.size() || this->pattern[this->at] != ')') return this->fail();
+                this->at++;
+                return true;
+            }
+
+            void parseQuantifier(Node& node) {
+                if (this->at >= this->pattern.size()) return;
+                uint_type start = this->at;
+                char c = this->pattern[this->at];
+                if (c == '*' || c == '+' || c == '?') this->at++;
+                else if (c == '{') {
+                    uint_type end = this->at + 1;
+                    while (end < this->pattern.size() && isdigit((unsigned char)this->pattern[end])) end++;
+                    if (end == this->at + 1) return;
+                    if (end < this->pattern.size() && this->pattern[end] == ',') {
+                        end++;
+                        while (end < this->pattern.size() && isdigit((unsigned char)this->pattern[end])) end++;
+                    }
+                    if (end >= this->pattern.size() || this->pattern[end] != '}') return;
+                    this->at = end + 1;
+                }
+                else return;
+                if (this->at < this->pattern.size() && (this->pattern[this->at] == '?' || this->pattern[this->at] == '+')) this->at++;
+                node.quantifier = this->pattern.substr(start, this->at - start);
+            }
+
+            std::vector<Node> parseSequence() {
+                std::vector<Node> sequence;
+                while (this->at < this->pattern.size() && !this->failed) {
+                    char c = this->pattern[this->at];
+                    if (c == '|' || c == ')') break;
+                    Node node;
+                    if (c == '(') this->parseGroup(node);
+                    else if (c == '[') this->parseClass(node);
+                    else if (c == '\\') this->parseEscape(node);
+                    else if (c == '*' || c == '+' || c == '?') this->fail();
+                    else {
+                        if (c == '.') {
+                            node.kind = charset;
+                            node.known = true;
+                            node.set.set();
+                        }
+                        else if (c != '^' && c != '$') {
+                            node.kind = literal;
+                            node.known = true;
+                            node.mergeable = true;
+                            node.set.set((unsigned char)c);
+                            if (c == '{' || c == '}' || c == ']') node.text = classText((unsigned char)c);
+                        }
+                        if (node.text.empty()) node.text = std::string(1, c);
+                        this->at++;
+                    }
+                    if (this->failed) break;
+                    this->parseQuantifier(node);
+                    sequence.push_back(node);
+                }
+                return sequence;
+            }
+
+            std::vector<std::vector<Node> > parseAlternatives() {
+                std::vector<std::vector<Node> > alternatives;
+                alternatives.push_back(this->parseSequence());
+                while (!this->failed && this->at < this->pattern.size() && this->pattern[this->at] == '|') {
+                    this->at++;
+                    alternatives.push_back(this->parseSequence());
+                }
+                return alternatives;
+            }
+
+        public:
+            bool failed;
+            bool numeric_refs;
+
+            Parser(const std::string& pattern) : pattern(pattern), at(0), captures(0), failed(false), numeric_refs(false) {
+            }
+
+            std::vector<std::vector<Node> > parse() {
+                auto alternatives = this->parseAlternatives();
+                if (this->at != this->pattern.size()) this->fail();
+                return alternatives;
+            }
+    };
+
+    class Optimizer {
+        private:
+            uint_type keep_captures;
+            bool keep_all;
+            std::map<std::string,const Node*> definitions;
+
+            static bool sameLiteral(const Node& lhs, const Node& rhs) {
+                return lhs.kind == literal && rhs.kind == literal && lhs.quantifier.empty() && rhs.quantifier.empty() && lhs.set == rhs.set;
+            }
+
+            static bool classMember(const std::vector<Node>& alternative) {
+                return alternative.size() == 1 && alternative[0].mergeable && alternative[0].quantifier.empty();
+            }
+
+            static std::string classContents(const Node& node) {
+                if (node.kind == charset && node.text[0] == '[') return node.text.substr(1, node.text.size() - 2);
+                if (node.kind == literal) {
+                    for (unsigned c = 0; c < 256; c++) if (node.set[c]) return classText(c);
+                }
+                return node.text;
+            }
+
+            void flatten(std::vector<Node>& sequence) {
+                /*
+                    Splices groups that neither capture, repeat nor alternate into the
+                    surrounding sequence.
+                */
+                std::vector<Node> flat;
+                flat.reserve(sequence.size());
+                for (auto& node : sequence) {
+                    if (node.plainGroup() && node.quantifier.empty() && node.alternatives.size() == 1) {
+                        for (auto& inner : node.alternatives[0]) flat.push_back(std::move(inner));
+                    }
+                    else flat.push_back(std::move(node));
+                }
+                sequence.swap(flat);
+            }
+
+            void spliceAlternatives(std::vector<std::vector<Node> >& alternatives) {
+                /*
+                    (?:a|(?:b|c)) is (?:a|b|c), order is kept so priorities don't change.
+                */
+                std::vector<std::vector<Node> > spliced;
+                spliced.reserve(alternatives.size());
+                for (auto& alternative : alternatives) {
+                    if (alternative.size() == 1 && alternative[0].plainGroup() && alternative[0].quantifier.empty()) {
+                        for (auto& inner : alternative[0].alternatives) spliced.push_back(std::move(inner));
+                    }
+                    else spliced.push_back(std::move(alternative));
+                }
+                alternatives.swap(spliced);
+            }
+
+            void mergeClasses(std::vector<std::vector<Node> >& alternatives) {
+                /*
+                    Runs of neighbouring single character alternatives become one class.
+                    Only neighbours are merged, moving a character past another
+                    alternative could change which one wins.
+                */
+                std::vector<std::vector<Node> > merged;
+                merged.reserve(alternatives.size());
+                for (uint_type i = 0; i < alternatives.size();) {
+                    uint_type end = i;
+                    while (end < alternatives.size() && classMember(alternatives[end])) end++;
+                    if (end - i < 2) {
+                        merged.push_back(std::move(alternatives[i]));
+                        i++;
+                        continue;
+                    }
+                    Node node;
+                    node.kind = charset;
+                    node.known = true;
+                    node.mergeable = true;
+                    node.text = "[";
+                    for (uint_type j = i; j < end; j++) {
+                        const Node& member = alternatives[j][0];
+                        node.text += classContents(member);
+                        node.known = node.known && member.known;
+                        node.set |= member.set;
+                    }
+                    node.text += "]";
+                    merged.push_back(std::vector<Node>(1, node));
+                    i = end;
+                }
+                alternatives.swap(merged);
+            }
+
+            void factorPrefixes(std::vector<std::vector<Node> >& alternatives) {
+                /*
+                    Neighbouring alternatives starting with the same literal characters
+                    share them: abc|abd becomes ab(?:c|d). A literal prefix only ever
+                    matches one way, so this is exact.
+                */
+                std::vector<std::vector<Node> > factored;
+                factored.reserve(alternatives.size());
+                for (uint_type i = 0; i < alternatives.size();) {
+                    uint_type end = i + 1;
+                    while (end < alternatives.size() && !alternatives[i].empty() && !alternatives[end].empty()
+                           && sameLiteral(alternatives[i][0], alternatives[end][0])) end++;
+                    if (end - i < 2) {
+                        factored.push_back(std::move(alternatives[i]));
+                        i++;
+                        continue;
+                    }
+                    uint_type common = 1;
+                    bool extend = true;
+                    while (extend) {
+                        for (uint_type j = i; j < end && extend; j++) {
+                            extend = common < alternatives[j].size() && sameLiteral(alternatives[i][common], alternatives[j][common]);
+                        }
+                        if (extend) common++;
+                    }
+                    std::vector<Node> alternative(alternatives[i].begin(), alternatives[i].begin() + common);
+                    Node rest;
+                    rest.kind = group;
+                    rest.text = "(?:";
+                    bool all_empty = true;
+                    for (uint_type j = i; j < end; j++) {
+                        rest.alternatives.push_back(std::vector<Node>(alternatives[j].begin() + common, alternatives[j].end()));
+                        all_empty = all_empty && rest.alternatives.back().empty();
+                    }
+                    if (!all_empty) {
+                        this->optimizeAlternatives(rest.alternatives);
+                        alternative.push_back(std::move(rest));
+                        this->flatten(alternative);
+                    }
+                    factored.push_back(std::move(alternative));
+                    i = end;
+                }
+                alternatives.swap(factored);
+            }
+
+            void optimizeAlternatives(std::vector<std::vector<Node> >& alternatives) {
+                for (auto& alternative : alternatives) {
+                    for (auto& node : alternative) {
+                        if (node.kind == group) this->optimizeGroup(node);
+                    }
+                    this->flatten(alternative);
+                }
+                this->spliceAlternatives(alternatives);
+                this->mergeClasses(alternatives);
+                this->factorPrefixes(alternatives);
+            }
+
+            void optimizeGroup(Node& node) {
+                if (node.text == "(" && !this->keep_all && node.number > this->keep_captures) {
+                    node.text = "(?:";
+                    node.number = 0;
+                }
+                this->optimizeAlternatives(node.alternatives);
+                /*
+                    A group holding nothing but a plain group takes over its contents.
+                */
+                while (node.alternatives.size() == 1 && node.alternatives[0].size() == 1
+                       && node.alternatives[0][0].plainGroup() && node.alternatives[0][0].quantifier.empty()) {
+                    std::vector<std::vector<Node> > inner;
+                    inner.swap(node.alternatives[0][0].alternatives);
+                    node.alternatives.swap(inner);
+                }
+                /*
+                    A plain group around one unquantified unit is just the unit.
+                */
+                if (node.plainGroup() && node.alternatives.size() == 1 && node.alternatives[0].size() == 1
+                    && node.alternatives[0][0].singleUnit() && node.alternatives[0][0].quantifier.empty()) {
+                    std::string quantifier = node.quantifier;
+                    Node unit = std::move(node.alternatives[0][0]);
+                    node = std::move(unit);
+                    node.quantifier = quantifier;
+                }
+            }
+
+            void collectDefinitions(const std::vector<std::vector<Node> >& alternatives) {
+                for (auto& alternative : alternatives) {
+                    for (auto& node : alternative) {
+                        if (node.kind != group) continue;
+                        if (!node.name.empty()) this->definitions[node.name] = &node;
+                        this->collectDefinitions(node.alternatives);
+                    }
+                }
+            }
+
+            bool unitSet(const Node& node, CharSet& set, uint_type depth = 0) const {
+                /*
+                    The characters a single character unit can match, following calls
+                    into groups whose whole body is one such unit.
+                */
+                if (node.kind == literal || node.kind == charset) {
+                    set = node.set;
+                    return node.known;
+                }
+                if (node.kind != call || depth > 16) return false;
+                auto found = this->definitions.find(node.name);
+                if (found == this->definitions.end()) return false;
+                const Node& body = *found->second;
+                if (body.alternatives.size() != 1 || body.alternatives[0].size() != 1 || !body.alternatives[0][0].quantifier.empty()) return false;
+                return this->unitSet(body.alternatives[0][0], set, depth + 1);
+            }
+
+            static bool atLeastOnce(const std::string& quantifier) {
+                if (quantifier.empty() || quantifier[0] == '+') return true;
+                return quantifier[0] == '{' && quantifier[1] != '0' && quantifier[1] != ',';
+            }
+
+            void possessify(std::vector<std::vector<Node> >& alternatives) {
+                /*
+                    x* x+ or x? directly followed by a unit that always consumes a
+                    character outside of x can never be asked to give characters back
+                    usefully, so it is made possessive and never backtracks.
+                */
+                for (auto& alternative : alternatives) {
+                    for (uint_type i = 0; i < alternative.size(); i++) {
+                        Node& node = alternative[i];
+                        if (node.kind == group) {
+                            this->possessify(node.alternatives);
+                            continue;
+                        }
+                        if (i + 1 >= alternative.size()) continue;
+                        if (node.quantifier != "*" && node.quantifier != "+" && node.quantifier != "?") continue;
+                        const Node& next = alternative[i + 1];
+                        if (!node.singleUnit() || !next.singleUnit() || !atLeastOnce(next.quantifier)) continue;
+                        CharSet repeated;
+                        CharSet following;
+                        if (!this->unitSet(node, repeated) || !this->unitSet(next, following)) continue;
+                        if ((repeated & following).none()) node.quantifier += "+";
+                    }
+                }
+            }
+
+            static void write(const std::vector<std::vector<Node> >& alternatives, std::string& out) {
+                for (uint_type i = 0; i < alternatives.size(); i++) {
+                    if (i > 0) out += '|';
+                    for (auto& node : alternatives[i]) {
+                        out += node.text;
+                        if (node.kind == group) {
+                            write(node.alternatives, out);
+                            out += ')';
+                        }
+                        out += node.quantifier;
+                    }
+                }
+            }
+
+        public:
+            Optimizer(uint_type keep_captures = 1) : keep_captures(keep_captures), keep_all(false), definitions() {
+            }
+
+            std::string optimize(const std::string& pattern) {
+                /*
+                    Returns an equivalent pattern in which captures numbered past
+                    keep_captures no longer capture, or pattern itself if it uses
+                    syntax the optimizer doesn't understand.
+                */
+                Parser parser(pattern);
+                auto alternatives = parser.parse();
+                if (parser.failed) return pattern;
+                this->keep_all = parser.numeric_refs;
+                this->definitions.clear();
+                this->optimizeAlternatives(alternatives);
+                this->collectDefinitions(alternatives);
+                this->possessify(alternatives);
+                std::string out;
+                out.reserve(pattern.size());
+                write(alternatives, out);
+                return out;
+            }
+    };
+
+    std::string optimize(const std::string& pattern, uint_type keep_captures = 1) {
+        Optimizer optimizer(keep_captures);
+        return optimizer.optimize(pattern);
+    }
+};
+
+#endif
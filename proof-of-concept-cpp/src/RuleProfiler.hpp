@@ -0,0 +1,274 @@
+#ifndef RULE_PROFILER_HPP
+#define RULE_PROFILER_HPP
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <pcre.h>
+#include <pcrecpp.h>
+#include "EBNF.hpp"
+
+#define PROFILE_OUT std::cout << "(Rule profiler) "
+#define PROFILE_ERROUT std::cerr << "(Rule profiler) Error: "
+
+namespace profile {
+
+    struct RuleStats {
+        uint_type attempts;     //Calls into the matcher while scanning for the rule
+        uint_type successes;    //Matches found
+        uint_type bytes;        //Bytes consumed by those matches
+        uint_type nanoseconds;  //Time spent scanning for the rule
+        uint_type calls;        //Subroutine calls (\g'rule') made by the matcher
+        uint_type backtracks;   //Subroutine calls retried at a position already tried
+
+        RuleStats() : attempts(0), successes(0), bytes(0), nanoseconds(0), calls(0), backtracks(0) {
+        }
+    };
+
+    struct CalloutState {
+        /*
+            Per-thread counters filled in by the PCRE callout while one rule is being
+            matched. Callout numbers identify (caller, callee) edges.
+        */
+        std::vector<uint_type> counts;
+        std::vector<int> furthest;
+        uint_type backtracks;
+
+        CalloutState() : counts(256, 0), furthest(256, -1), backtracks(0) {
+        }
+    };
+
+    thread_local CalloutState* active_callouts = nullptr;
+
+    int countCallout(pcre_callout_block* block) {
+        /*
+            Counts every subroutine call. A call to the same edge at or before the
+            furthest position it has already reached during this attempt can only
+            be the engine backtracking into it.
+        */
+        CalloutState* state = active_callouts;
+        if (state == nullptr || block->callout_number < 0 || block->callout_number > 255) return 0;
+        state->counts[block->callout_number]++;
+        if (block->current_position <= state->furthest[block->callout_number]) state->backtracks++;
+        else state->furthest[block->callout_number] = block->current_position;
+        return 0;
+    }
+
+    class RuleProfiler {
+        /*
+            Records match attempts, successes, bytes consumed, time and backtracking
+            for every rule the tree builder tries. Rules are matched with their own
+            instrumented copy of the assembled regex, in which every \g'rule' call is
+            preceded by a numbered callout naming the calling and called rule. The
+            profiler owns the PCRE callout while it exists.
+        */
+        private:
+            typedef std::pair<std::string,std::string> Edge;
+
+            std::map<std::string,RuleStats> rule_stats;
+            std::map<std::string,EvalEBNF::EvaluatedRule> instrumented_rules;
+            std::map<std::string,std::shared_ptr<const pcrecpp::RE> > instrumented;
+            std::map<Edge,int> edge_numbers;
+            std::vector<Edge> edges;
+            std::map<std::string,std::vector<uint_type> > edge_counts;
+            const EBNF* grammar;
+            int (*previous_callout)(pcre_callout_block*);
+
+            int edgeNumber(const std::string& caller, const std::string& callee) {
+                /*
+                    Callout numbers 1-255 are available, edges past that are matched
+                    but not counted.
+                */
+                Edge edge(caller,callee);
+                auto found = this->edge_numbers.find(edge);
+                if (found != this->edge_numbers.end()) return found->second;
+                if (this->edges.size() >= 255) return -1;
+                this->edges.push_back(edge);
+                int number = this->edges.size();
+                this->edge_numbers[edge] = number;
+                return number;
+            }
+
+            std::string instrument(const std::string& caller, const std::string& regex) {
+                std::string out;
+                out.reserve(regex.size() + regex.size() / 4);
+                uint_type cursor = 0;
+                while (true) {
+                    uint_type call = regex.find("\\g'", cursor);
+                    if (call == std::string::npos) break;
+                    uint_type name_end = regex.find('\'', call + 3);
+                    if (name_end == std::string::npos) break;
+                    /*
+                        Skip escaped backslashes, "\\g'" is a literal not a call.
+                    */
+                    uint_type slashes = 0;
+                    while (call >= slashes + 1 && regex[call - slashes - 1] == '\\') slashes++;
+                    out.append(regex, cursor, call - cursor);
+                    int number = (slashes % 2 == 0) ? this->edgeNumber(caller, regex.substr(call + 3, name_end - call - 3)) : -1;
+                    if (number > 0) out += "(?C" + std::to_string(number) + ")";
+                    out.append(regex, call, name_end + 1 - call);
+                    cursor = name_end + 1;
+                }
+                out.append(regex, cursor, std::string::npos);
+                return out;
+            }
+
+            const pcrecpp::RE& compiled(const std::string& rule_id) {
+                /*
+                    Every rule is instrumented once. Only rules the grammar has
+                    evaluated since (start rules evaluate lazily) are added later.
+                */
+                auto found = this->instrumented.find(rule_id);
+                if (found != this->instrumented.end()) return *found->second;
+                this->grammar->compiled(rule_id);
+                if (this->instrumented_rules.size() != this->grammar->regex_map.size()) {
+                    for (auto& elem : this->grammar->regex_map) {
+                        if (this->instrumented_rules.find(elem.first) != this->instrumented_rules.end()) continue;
+                        EvalEBNF::EvaluatedRule& rule = this->instrumented_rules[elem.first];
+                        rule = elem.second;
+                        rule.regex = this->instrument(elem.first, elem.second.regex);
+                    }
+                }
+                std::string assembled = this->instrumented_rules.at(rule_id).assemble(this->instrumented_rules);
+                if (this->grammar->optimizing()) assembled = regexopt::optimize(assembled);
+                std::shared_ptr<const pcrecpp::RE> regex = std::make_shared<const pcrecpp::RE>(assembled);
+                this->instrumented[rule_id] = regex;
+                return *regex;
+            }
+
+            std::string chain(const std::string& top, const std::string& rule) const {
+                /*
+                    Static call chain from top to rule through \g'rule' nesting, the
+                    shortest one if there are several.
+                */
+                if (top == rule) return top;
+                std::map<std::string,std::string> parent;
+                std::deque<std::string> queue;
+                queue.push_back(top);
+                parent[top] = "";
+                while (!queue.empty() && parent.find(rule) == parent.end()) {
+                    std::string current = queue.front();
+                    queue.pop_front();
+                    auto found = this->grammar->regex_map.find(current);
+                    if (found == this->grammar->regex_map.end()) continue;
+                    for (auto& dependency : found->second.dependencies) {
+                        if (parent.find(dependency) != parent.end()) continue;
+                        parent[dependency] = current;
+                        queue.push_back(dependency);
+                    }
+                }
+                if (parent.find(rule) == parent.end()) return top + ";" + rule;
+                std::string path = rule;
+                for (std::string at = parent[rule]; !at.empty(); at = parent[at]) path = at + ";" + path;
+                return path;
+            }
+
+        public:
+            RuleProfiler(const EBNF& grammar) : rule_stats(), instrumented_rules(), instrumented(), edge_numbers(), edges(), edge_counts(),
+                                                grammar(&grammar), previous_callout(pcre_callout) {
+                pcre_callout = countCallout;
+            }
+
+            RuleProfiler(const RuleProfiler& copy) = delete;
+
+            ~RuleProfiler() {
+                pcre_callout = this->previous_callout;
+            }
+
+            RuleProfiler& operator= (const RuleProfiler& copy) = delete;
+
+            std::vector<std::pair<std::string,uint_type> > match(const std::string& rule_id, const std::string& content) {
+                /*
+                    Equivalent of RegexHelper::getListOfMatches for a rule, while
+                    recording its statistics.
+                */
+                const pcrecpp::RE& regex = this->compiled(rule_id);
+                RuleStats& stats = this->rule_stats[rule_id];
+                std::vector<uint_type>& counts = this->edge_counts[rule_id];
+                counts.resize(256, 0);
+                CalloutState state;
+                active_callouts = &state;
+                auto started = std::chrono::steady_clock::now();
+                std::vector<std::pair<std::string,uint_type> > matches;
+                pcrecpp::StringPiece wrk_content(content);
+                std::string matched_text;
+                uint_type cursor = 0;
+                while (true) {
+                    std::fill(state.furthest.begin(), state.furthest.end(), -1);
+                    stats.attempts++;
+                    if (!regex.FindAndConsume(&wrk_content, &matched_text)) break;
+                    cursor = content.find(matched_text, cursor);
+                    matches.push_back(std::pair<std::string,uint_type>(matched_text,cursor));
+                    stats.successes++;
+                    stats.bytes += matched_text.size();
+                    cursor++;
+                }
+                stats.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+                active_callouts = nullptr;
+                for (uint_type i = 0; i < 256; i++) {
+                    counts[i] += state.counts[i];
+                    stats.calls += state.counts[i];
+                }
+                stats.backtracks += state.backtracks;
+                return matches;
+            }
+
+            const std::map<std::string,RuleStats>& stats() const {
+                return this->rule_stats;
+            }
+
+            void report(std::ostream& out = std::cout) const {
+                /*
+                    Prints one line per rule, most expensive first.
+                */
+                std::vector<std::pair<std::string,RuleStats> > sorted(this->rule_stats.begin(), this->rule_stats.end());
+                std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string,RuleStats>& lhs, const std::pair<std::string,RuleStats>& rhs) {
+                    return lhs.second.nanoseconds > rhs.second.nanoseconds;
+                });
+                out << std::left << std::setw(24) << "rule" << std::right
+                    << std::setw(12) << "time(ms)" << std::setw(12) << "attempts" << std::setw(12) << "matches"
+                    << std::setw(12) << "bytes" << std::setw(12) << "calls" << std::setw(12) << "backtracks" << '\n';
+                for (auto& elem : sorted) {
+                    out << std::left << std::setw(24) << elem.first << std::right
+                        << std::setw(12) << std::fixed << std::setprecision(3) << (elem.second.nanoseconds / 1e6)
+                        << std::setw(12) << elem.second.attempts << std::setw(12) << elem.second.successes
+                        << std::setw(12) << elem.second.bytes << std::setw(12) << elem.second.calls
+                        << std::setw(12) << elem.second.backtracks << '\n';
+                }
+                out.flush();
+            }
+
+            bool writeFolded(const std::string& filename) const {
+                /*
+                    Writes folded stacks ("a;b;c weight" per line) for flame graph
+                    tools. A rule's own frame is weighted by its attempts and each
+                    subroutine frame by the calls made into it, so weights are match
+                    steps rather than time.
+                */
+                std::ofstream out(filename.c_str(), std::ios::out | std::ios::trunc);
+                if (!out.is_open()) {
+                    PROFILE_ERROUT << "was not able to open " << filename << " for writing." << std::endl;
+                    return false;
+                }
+                for (auto& elem : this->rule_stats) {
+                    if (elem.second.attempts > 0) out << elem.first << " " << elem.second.attempts << '\n';
+                    auto counts = this->edge_counts.find(elem.first);
+                    if (counts == this->edge_counts.end()) continue;
+                    for (uint_type number = 1; number <= this->edges.size(); number++) {
+                        if (counts->second[number] == 0) continue;
+                        const Edge& edge = this->edges[number - 1];
+                        out << this->chain(elem.first, edge.first) << ";" << edge.second << " " << counts->second[number] << '\n';
+                    }
+                }
+                return out.good();
+            }
+    };
+};
+
+#endif
@@ -0,0 +1,368 @@
+#ifndef SIMULATOR_HPP
+#define SIMULATOR_HPP
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include "Netlist.hpp"
+
+#define SIM_OUT std::cout << "(Simulation) "
+#define SIM_ERROUT std::cerr << "(Simulation) Error: "
+
+namespace sim {
+
+    const uint32_t no_slot = 0xffffffff;
+
+    struct Instruction {
+        uint8_t op;
+        netlist::Handle out;
+        netlist::Handle a;
+        netlist::Handle b;
+    };
+
+    template<uint_type Words>
+    class LevelizedSimulator {
+        /*
+            Compiled, levelized simulation of a netlist. Every net holds Words
+            64-bit words, one bit per independent stimulus vector, and each cell is
+            a bitwise operation over them run in topological order, so one pass
+            over the program evaluates 64 * Words vectors. Words = 4 gives 256
+            lanes, which the compiler turns into vector instructions where the
+            target has them.
+
+            Registers output their state, which starts at 0. settle() evaluates
+            the combinational logic and lets every register whose clock rose since
+            the previous settle() sample its input, per lane.
+        */
+        public:
+            static const uint_type lanes = 64 * Words;
+
+        private:
+            std::vector<Instruction> program;
+            std::vector<uint_type> level_starts;
+            std::vector<uint64_t> values;
+            std::vector<netlist::Handle> constant_ones;
+            std::vector<netlist::Handle> reg_q;
+            std::vector<netlist::Handle> reg_d;
+            std::vector<netlist::Handle> reg_clock;
+            std::vector<uint64_t> reg_previous_clock;
+            std::vector<uint64_t> reg_next;
+            std::vector<netlist::Handle> input_nets;
+            std::vector<netlist::Handle> output_nets;
+            uint64_t evaluations;
+            bool compiled;
+
+            uint64_t* net(netlist::Handle handle) {
+                return &this->values[uint_type(handle) * Words];
+            }
+
+            const uint64_t* net(netlist::Handle handle) const {
+                return &this->values[uint_type(handle) * Words];
+            }
+
+            bool levelize(const netlist::Netlist& design) {
+                /*
+                    Orders combinational cells so every cell comes after the cells
+                    driving its inputs. Inputs, constants and register outputs are
+                    ready from the start.
+                */
+                uint_type cell_count = design.cells();
+                std::vector<uint32_t> waiting(cell_count, 0);
+                std::vector<std::vector<netlist::Handle> > readers(design.nets());
+                std::vector<netlist::Handle> ready;
+                for (netlist::Handle cell = 0; cell < cell_count; cell++) {
+                    uint8_t kind = design.cell_kind[cell];
+                    if (kind == netlist::cells::constant0 || kind == netlist::cells::constant1 || kind == netlist::cells::reg) continue;
+                    netlist::Handle inputs[] = {design.cell_a[cell], design.cell_b[cell]};
+                    for (auto input : inputs) {
+                        if (input == netlist::none) continue;
+                        netlist::Handle driver = design.net_driver[input];
+                        if (driver == netlist::none) continue;
+                        uint8_t driver_kind = design.cell_kind[driver];
+                        if (driver_kind == netlist::cells::constant0 || driver_kind == netlist::cells::constant1 || driver_kind == netlist::cells::reg) continue;
+                        waiting[cell]++;
+                        readers[input].push_back(cell);
+                    }
+                    if (waiting[cell] == 0) ready.push_back(cell);
+                }
+                uint_type combinational = 0;
+                for (netlist::Handle cell = 0; cell < cell_count; cell++) {
+                    uint8_t kind = design.cell_kind[cell];
+                    if (kind != netlist::cells::constant0 && kind != netlist::cells::constant1 && kind != netlist::cells::reg) combinational++;
+                }
+                this->program.reserve(combinational);
+                while (!ready.empty()) {
+                    this->level_starts.push_back(this->program.size());
+                    std::vector<netlist::Handle> next;
+                    for (auto cell : ready) {
+                        Instruction instruction = {design.cell_kind[cell], design.cell_out[cell], design.cell_a[cell], design.cell_b[cell]};
+                        this->program.push_back(instruction);
+                        for (auto reader : readers[design.cell_out[cell]]) {
+                            if (--waiting[reader] == 0) next.push_back(reader);
+                        }
+                    }
+                    ready.swap(next);
+                }
+                this->level_starts.push_back(this->program.size());
+                if (this->program.size() != combinational) {
+                    SIM_ERROUT << design.top << " has a combinational loop." << std::endl;
+                    return false;
+                }
+                return true;
+            }
+
+        public:
+            std::vector<std::string> input_names;
+            std::vector<std::string> output_names;
+
+            LevelizedSimulator(const netlist::Netlist& design) : program(), level_starts(), values(), constant_ones(), reg_q(), reg_d(),
+                                                                 reg_clock(), reg_previous_clock(), reg_next(), input_nets(), output_nets(),
+                                                                 evaluations(0), compiled(false), input_names(), output_names() {
+                for (netlist::Handle cell = 0; cell < design.cells(); cell++) {
+                    if (design.cell_kind[cell] == netlist::cells::constant1) this->constant_ones.push_back(design.cell_out[cell]);
+                    if (design.cell_kind[cell] == netlist::cells::reg) {
+                        this->reg_q.push_back(design.cell_out[cell]);
+                        this->reg_d.push_back(design.cell_a[cell]);
+                        this->reg_clock.push_back(design.cell_clock[cell]);
+                    }
+                }
+                for (netlist::Handle port = 0; port < design.ports(); port++) {
+                    if (design.port_direction[port] == netlist::ports::input) {
+                        this->input_nets.push_back(design.port_net[port]);
+                        this->input_names.push_back(design.portName(port));
+                    }
+                    else {
+                        this->output_nets.push_back(design.port_net[port]);
+                        this->output_names.push_back(design.portName(port));
+                    }
+                }
+                this->values.assign(design.nets() * Words, 0);
+                this->reg_previous_clock.assign(this->reg_q.size() * Words, 0);
+                this->reg_next.assign(this->reg_q.size() * Words, 0);
+                this->compiled = this->levelize(design);
+                this->reset();
+            }
+
+            bool valid() const {
+                return this->compiled;
+            }
+
+            uint_type inputs() const {
+                return this->input_nets.size();
+            }
+
+            uint_type outputs() const {
+                return this->output_nets.size();
+            }
+
+            uint_type levels() const {
+                return this->level_starts.size() - 1;
+            }
+
+            uint_type instructions() const {
+                return this->program.size();
+            }
+
+            uint_type registers() const {
+                return this->reg_q.size();
+            }
+
+            const std::vector<Instruction>& levelized() const {
+                /*
+                    The combinational cells in evaluation order, for backends that
+                    generate their own code from it.
+                */
+                return this->program;
+            }
+
+            uint64_t gateEvaluations() const {
+                /*
+                    Cells evaluated so far, counting every lane.
+                */
+                return this->evaluations;
+            }
+
+            void reset() {
+                std::fill(this->values.begin(), this->values.end(), 0);
+                std::fill(this->reg_previous_clock.begin(), this->reg_previous_clock.end(), 0);
+                for (auto one : this->constant_ones) {
+                    uint64_t* value = this->net(one);
+                    for (uint_type k = 0; k < Words; k++) value[k] = ~uint64_t(0);
+                }
+            }
+
+            void setInput(uint_type input, const uint64_t* lanes) {
+                uint64_t* value = this->net(this->input_nets[input]);
+                for (uint_type k = 0; k < Words; k++) value[k] = lanes[k];
+            }
+
+            void setInput(uint_type input, bool level) {
+                uint64_t* value = this->net(this->input_nets[input]);
+                for (uint_type k = 0; k < Words; k++) value[k] = level ? ~uint64_t(0) : 0;
+            }
+
+            void getOutput(uint_type output, uint64_t* lanes) const {
+                const uint64_t* value = this->net(this->output_nets[output]);
+                for (uint_type k = 0; k < Words; k++) lanes[k] = value[k];
+            }
+
+            const uint64_t* netValue(netlist::Handle handle) const {
+                return this->net(handle);
+            }
+
+            void evaluate() {
+                /*
+                    One pass over the levelized program.
+                */
+                uint64_t* values = this->values.data();
+                for (const Instruction& instruction : this->program) {
+                    uint64_t* out = values + uint_type(instruction.out) * Words;
+                    const uint64_t* a = values + uint_type(instruction.a) * Words;
+                    const uint64_t* b = (instruction.b != netlist::none) ? values + uint_type(instruction.b) * Words : a;
+                    switch (instruction.op) {
+                        case netlist::cells::inverter:
+                            for (uint_type k = 0; k < Words; k++) out[k] = ~a[k];
+                            break;
+                        case netlist::cells::and_gate:
+                            for (uint_type k = 0; k < Words; k++) out[k] = a[k] & b[k];
+                            break;
+                        case netlist::cells::or_gate:
+                            for (uint_type k = 0; k < Words; k++) out[k] = a[k] | b[k];
+                            break;
+                        case netlist::cells::xor_gate:
+                            for (uint_type k = 0; k < Words; k++) out[k] = a[k] ^ b[k];
+                            break;
+                    }
+                }
+                this->evaluations += this->program.size() * lanes;
+            }
+
+            bool sampleRegisters() {
+                /*
+                    Registers whose clock rose since the last sample take their input,
+                    all at once so one register feeding another shifts correctly.
+                    Returns whether any lane of any register sampled.
+                */
+                bool sampled = false;
+                for (uint_type r = 0; r < this->reg_q.size(); r++) {
+                    const uint64_t* clock = this->net(this->reg_clock[r]);
+                    const uint64_t* d = (this->reg_d[r] != netlist::none) ? this->net(this->reg_d[r]) : nullptr;
+                    const uint64_t* q = this->net(this->reg_q[r]);
+                    uint64_t* previous = &this->reg_previous_clock[r * Words];
+                    uint64_t* next = &this->reg_next[r * Words];
+                    for (uint_type k = 0; k < Words; k++) {
+                        uint64_t rose = clock[k] & ~previous[k];
+                        uint64_t data = (d != nullptr) ? d[k] : 0;
+                        next[k] = (data & rose) | (q[k] & ~rose);
+                        previous[k] = clock[k];
+                        sampled = sampled || rose != 0;
+                    }
+                }
+                if (!sampled) return false;
+                for (uint_type r = 0; r < this->reg_q.size(); r++) {
+                    uint64_t* q = this->net(this->reg_q[r]);
+                    for (uint_type k = 0; k < Words; k++) q[k] = this->reg_next[r * Words + k];
+                }
+                return true;
+            }
+
+            void settle() {
+                this->evaluate();
+                if (this->sampleRegisters()) this->evaluate();
+            }
+
+            void run(const uint64_t* stimulus, uint64_t* response, uint_type batches) {
+                /*
+                    Batch interface. Each batch reads inputs() * Words words of
+                    stimulus (input 0's words first) and writes outputs() * Words
+                    words of response in the same layout, settling once per batch.
+                */
+                for (uint_type batch = 0; batch < batches; batch++) {
+                    for (uint_type i = 0; i < this->inputs(); i++) this->setInput(i, stimulus + i * Words);
+                    this->settle();
+                    for (uint_type o = 0; o < this->outputs(); o++) this->getOutput(o, response + o * Words);
+                    stimulus += this->inputs() * Words;
+                    response += this->outputs() * Words;
+                }
+            }
+
+            bool exhaustive(std::vector<std::vector<uint64_t> >& truth, uint_type max_inputs = 36) {
+                /*
+                    Evaluates the combinational logic for every input combination from
+                    the reset state. truth[o] holds one bit per combination for output
+                    o, combination n having input i set when bit i of n is.
+                */
+                if (this->inputs() > max_inputs) {
+                    SIM_ERROUT << "exhaustive simulation of " << this->inputs() << " inputs is limited to " << max_inputs << "." << std::endl;
+                    return false;
+                }
+                static const uint64_t patterns[] = {
+                    0xAAAAAAAAAAAAAAAAULL, 0xCCCCCCCCCCCCCCCCULL, 0xF0F0F0F0F0F0F0F0ULL,
+                    0xFF00FF00FF00FF00ULL, 0xFFFF0000FFFF0000ULL, 0xFFFFFFFF00000000ULL
+                };
+                uint64_t combinations = uint64_t(1) << this->inputs();
+                uint_type words = (combinations + 63) / 64;
+                uint_type batches = (words + Words - 1) / Words;
+                truth.assign(this->outputs(), std::vector<uint64_t>(words, 0));
+                uint64_t lanes_in[Words];
+                uint64_t lanes_out[Words];
+                this->reset();
+                for (uint_type batch = 0; batch < batches; batch++) {
+                    for (uint_type i = 0; i < this->inputs(); i++) {
+                        for (uint_type k = 0; k < Words; k++) {
+                            uint64_t first = (uint64_t(batch) * Words + k) * 64;
+                            lanes_in[k] = (i < 6) ? patterns[i] : (((first >> i) & 1) ? ~uint64_t(0) : 0);
+                        }
+                        this->setInput(i, lanes_in);
+                    }
+                    this->evaluate();
+                    for (uint_type o = 0; o < this->outputs(); o++) {
+                        this->getOutput(o, lanes_out);
+                        for (uint_type k = 0; k < Words && batch * Words + k < words; k++) truth[o][batch * Words + k] = lanes_out[k];
+                    }
+                }
+                if (combinations < 64) {
+                    for (auto& table : truth) table[0] &= (uint64_t(1) << combinations) - 1;
+                }
+                return true;
+            }
+    };
+
+    template<uint_type Words>
+    bool exhaustiveReport(const netlist::Netlist& design, std::ostream& out = std::cout) {
+        /*
+            Runs every input combination through a design and prints the rate,
+            and the truth table for designs with up to 6 inputs.
+        */
+        LevelizedSimulator<Words> simulator(design);
+        if (!simulator.valid()) return false;
+        std::vector<std::vector<uint64_t> > truth;
+        auto started = std::chrono::steady_clock::now();
+        if (!simulator.exhaustive(truth)) return false;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        out << "simulated " << (uint64_t(1) << simulator.inputs()) << " input combinations of " << design.top
+            << " on " << LevelizedSimulator<Words>::lanes << " lanes: " << simulator.instructions() << " gates in "
+            << simulator.levels() << " levels, " << simulator.gateEvaluations() << " gate evaluations in "
+            << std::fixed << std::setprecision(6) << seconds << "s";
+        if (seconds > 0) out << " (" << std::setprecision(2) << simulator.gateEvaluations() / seconds / 1e9 << " billion/s)";
+        out << '\n';
+        if (simulator.inputs() <= 6) {
+            for (uint_type i = simulator.inputs(); i > 0; i--) out << simulator.input_names[i - 1] << "\t";
+            out << "|";
+            for (uint_type o = 0; o < simulator.outputs(); o++) out << "\t" << simulator.output_names[o];
+            out << '\n';
+            for (uint64_t n = 0; n < (uint64_t(1) << simulator.inputs()); n++) {
+                for (uint_type i = simulator.inputs(); i > 0; i--) out << ((n >> (i - 1)) & 1) << "\t";
+                out << "|";
+                for (uint_type o = 0; o < simulator.outputs(); o++) out << "\t" << ((truth[o][n / 64] >> (n % 64)) & 1);
+                out << '\n';
+            }
+        }
+        out.flush();
+        return true;
+    }
+};
+
+#endif
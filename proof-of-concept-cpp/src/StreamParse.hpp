@@ -0,0 +1,170 @@
+#ifndef STREAM_PARSE_HPP
+#define STREAM_PARSE_HPP
+#include <iostream>
+#include <istream>
+#include <string>
+#include <vector>
+#include "generic-btree.hpp"
+#include "EBNF.hpp"
+#include "BuildSyntaxTree.hpp"
+
+#define STREAM_OUT std::cout << "(Streaming) "
+#define STREAM_ERROUT std::cerr << "(Streaming) Error: "
+
+namespace syntree {
+
+    class ParseListener {
+        /*
+            Callback interface for streamed parses. Nodes with children are reported
+            with enter/leave pairs, nodes without are reported once as a leaf. The
+            elements passed are only valid for the duration of the call.
+        */
+        public:
+            virtual ~ParseListener() {
+            }
+
+            virtual void enter(const SyntaxElement& element, uint_type depth) = 0;
+            virtual void leave(const SyntaxElement& element, uint_type depth) = 0;
+            virtual void leaf(const SyntaxElement& element, uint_type depth) = 0;
+    };
+
+    class ConstructScanner {
+        /*
+            Finds where top-level constructs end in a character stream fed to it in
+            arbitrary chunks. A construct ends at a ';' or at the '}' that closes
+            its outermost bracket, ignoring anything inside strings and comments.
+            State is kept between calls so chunk boundaries can fall anywhere.
+        */
+        private:
+            enum States {
+                normal,
+                in_string,
+                in_string_escape,
+                in_comment
+            };
+
+            uint_type state;
+            uint_type depth;
+            char last;
+
+        public:
+            ConstructScanner() : state(normal), depth(0), last('\0') {
+            }
+
+            uint_type scan(const std::string& buffer, uint_type from) {
+                /*
+                    Returns the index one past the end of the first complete construct
+                    at or after from, or buffer.size() + 1 if none has completed yet.
+                */
+                for (uint_type i = from; i < buffer.size(); i++) {
+                    char c = buffer[i];
+                    char previous = this->last;
+                    this->last = c;
+                    switch (this->state) {
+                        case in_string:
+                            if (c == '\\') this->state = in_string_escape;
+                            else if (c == '"') this->state = normal;
+                            break;
+                        case in_string_escape:
+                            this->state = in_string;
+                            break;
+                        case in_comment:
+                            if (previous == '*' && c == '/') {
+                                this->state = normal;
+                                this->last = '\0';
+                            }
+                            break;
+                        default:
+                            if (c == '"') this->state = in_string;
+                            else if (previous == '/' && c == '*') {
+                                this->state = in_comment;
+                                this->last = '\0';
+                            }
+                            else if (c == '{' || c == '(' || c == '[') this->depth++;
+                            else if (c == '}' || c == ')' || c == ']') {
+                                if (this->depth > 0) this->depth--;
+                                if (this->depth == 0 && c == '}') return i + 1;
+                            }
+                            else if (c == ';' && this->depth == 0) return i + 1;
+                            break;
+                    }
+                }
+                return buffer.size() + 1;
+            }
+    };
+
+    void emitEvents(const Trie<SyntaxElement>& tree, ParseListener& listener, uint_type depth) {
+        walk(tree, [&](const Trie<SyntaxElement>& node, size_t level) {
+            if (node.data.size() == 0) listener.leaf(node.self,depth + level);
+            else listener.enter(node.self,depth + level);
+        }, [&](const Trie<SyntaxElement>& node, size_t level) {
+            if (node.data.size() != 0) listener.leave(node.self,depth + level);
+        });
+    }
+
+    uint_type streamParse(const EBNF& grammar, std::istream& input, ParseListener& listener, uint_type chunk_size = 1 << 16) {
+        /*
+            Parses a source read from input chunk by chunk. Each top-level construct
+            is parsed on its own as soon as it has been read completely, its events
+            are sent to the listener and its text and tree are dropped. Peak memory
+            is bounded by the largest construct rather than the size of the source.
+            Returns the number of constructs parsed.
+
+            Matches cannot span two constructs, and the root element is reported
+            with empty content as the source is never held as a whole.
+        */
+        SyntaxElement root(0,"__syntax_tree_whole__","");
+        listener.enter(root,0);
+        ConstructScanner scanner;
+        std::string pending;
+        std::vector<char> chunk(chunk_size > 0 ? chunk_size : 1);
+        uint_type consumed = 0;
+        uint_type scanned = 0;
+        uint_type constructs = 0;
+        bool at_end = false;
+        while (!at_end) {
+            input.read(chunk.data(),chunk.size());
+            uint_type got = input.gcount();
+            at_end = (got == 0);
+            pending.append(chunk.data(),got);
+            /*
+                Constructs are parsed where they lie in pending, start marking the
+                first byte not parsed yet, and everything before it is dropped
+                once per chunk, so many small constructs do not each move the rest.
+            */
+            uint_type start = 0;
+            uint_type end = 0;
+            while (start < pending.size()) {
+                if (at_end) end = pending.size();
+                else {
+                    end = scanner.scan(pending,scanned);
+                    if (end > pending.size()) {
+                        scanned = pending.size();
+                        break;
+                    }
+                }
+                /*
+                    A construct has completed (or the stream has ended), parse it and
+                    release everything belonging to it.
+                */
+                if (pending.find_first_not_of(" \t\r\n",start) < end) {
+                    Trie<SyntaxElement> tree = recurseParse(grammar,SyntaxElement(consumed,"__syntax_tree_construct__",pending.substr(start,end - start)));
+                    for (uint_type iter = 0; iter < tree.data.size(); iter++) {
+                        emitEvents(tree.data[iter],listener,1);
+                    }
+                    constructs++;
+                }
+                consumed += end - start;
+                start = end;
+                scanned = end;
+            }
+            pending.erase(0,start);
+            scanned -= start;
+            if (pending.capacity() > 4 * (pending.size() + chunk.size())) pending.shrink_to_fit();
+        }
+        listener.leave(root,0);
+        return constructs;
+    }
+};
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef TREE_HASH_HPP
+#define TREE_HASH_HPP
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "generic-btree.hpp"
+#include "BuildSyntaxTree.hpp"
+
+namespace syntree {
+
+    namespace changes {
+        enum Change {
+            changed,    //Same rule at the same place, different structure
+            added,
+            removed
+        };
+    };
+
+    const uint_type no_component = uint_type(-1);
+
+    struct ComponentChange {
+        changes::Change change;
+        uint_type before;       //Component in the old tree, no_component if added
+        uint_type after;        //Component in the new tree, no_component if removed
+    };
+
+    std::vector<const Trie<SyntaxElement>*> components(const Trie<SyntaxElement>& tree) {
+        /*
+            The top-level constructs of a tree, leaving out matches that are only
+            whitespace and comments so adding a blank line changes none of them.
+        */
+        std::vector<const Trie<SyntaxElement>*> found;
+        for (auto& child : tree.data) {
+            if (skipTrivia(child.self.content, 0) < child.self.content.size()) found.push_back(&child);
+        }
+        return found;
+    }
+
+    std::vector<ComponentChange> diffComponents(const std::vector<const Trie<SyntaxElement>*>& before, const std::vector<const Trie<SyntaxElement>*>& after,
+                                                uint_type max_cells = 1 << 22) {
+        /*
+            Which components differ between two hashed trees, in source order.
+            Components are matched by hash along the longest common subsequence
+            after cutting the common head and tail, so inserting one shifts
+            nothing. In each unmatched stretch a removed and an added component of
+            the same rule pair up, in order, as one changed component. Stretches
+            too large for max_cells of the subsequence table are compared in
+            order without it.
+        */
+        std::vector<ComponentChange> result;
+        uint_type head = 0;
+        while (head < before.size() && head < after.size() && before[head]->self.hash == after[head]->self.hash) head++;
+        uint_type tail = 0;
+        while (tail < before.size() - head && tail < after.size() - head
+               && before[before.size() - 1 - tail]->self.hash == after[after.size() - 1 - tail]->self.hash) tail++;
+        uint_type rows = before.size() - head - tail;
+        uint_type columns = after.size() - head - tail;
+        /*
+            Anchors are the matched (before, after) pairs, closed by the tail.
+        */
+        std::vector<std::pair<uint_type,uint_type> > anchors;
+        if (rows > 0 && columns > 0 && (rows + 1) * (columns + 1) <= max_cells) {
+            std::vector<uint32_t> common((rows + 1) * (columns + 1), 0);
+            for (uint_type i = rows; i > 0; i--) {
+                for (uint_type j = columns; j > 0; j--) {
+                    uint32_t& cell = common[(i - 1) * (columns + 1) + (j - 1)];
+                    if (before[head + i - 1]->self.hash == after[head + j - 1]->self.hash) cell = common[i * (columns + 1) + j] + 1;
+                    else cell = std::max(common[i * (columns + 1) + (j - 1)], common[(i - 1) * (columns + 1) + j]);
+                }
+            }
+            uint_type i = 0;
+            uint_type j = 0;
+            while (i < rows && j < columns) {
+                if (before[head + i]->self.hash == after[head + j]->self.hash) anchors.push_back(std::make_pair(head + i++, head + j++));
+                else if (common[(i + 1) * (columns + 1) + j] >= common[i * (columns + 1) + j + 1]) i++;
+                else j++;
+            }
+        }
+        anchors.push_back(std::make_pair(before.size() - tail, after.size() - tail));
+        uint_type i = head;
+        uint_type j = head;
+        for (auto& anchor : anchors) {
+            while (i < anchor.first || j < anchor.second) {
+                if (i < anchor.first && j < anchor.second && before[i]->self.identifier == after[j]->self.identifier) {
+                    ComponentChange change = {changes::changed, i++, j++};
+                    result.push_back(change);
+                }
+                else if (i < anchor.first && (j == anchor.second || anchor.first - i >= anchor.second - j)) {
+                    ComponentChange change = {changes::removed, i++, no_component};
+                    result.push_back(change);
+                }
+                else {
+                    ComponentChange change = {changes::added, no_component, j++};
+                    result.push_back(change);
+                }
+            }
+            i = anchor.first + 1;
+            j = anchor.second + 1;
+        }
+        return result;
+    }
+
+    std::vector<ComponentChange> diffComponents(const Trie<SyntaxElement>& before, const Trie<SyntaxElement>& after) {
+        /*
+            Both trees need their hashes, from buildTree with ParseContext::hashing
+            set or from hashTree.
+        */
+        return diffComponents(components(before), components(after));
+    }
+
+    void diffReport(const Trie<SyntaxElement>& before, const Trie<SyntaxElement>& after, std::ostream& out = std::cout) {
+        auto old_components = components(before);
+        auto new_components = components(after);
+        auto found = diffComponents(old_components, new_components);
+        uint_type counts[3] = {0, 0, 0};
+        for (auto& change : found) counts[change.change]++;
+        out << "Components: " << new_components.size() - counts[changes::changed] - counts[changes::added] << " unchanged, "
+            << counts[changes::changed] << " changed, " << counts[changes::added] << " added, " << counts[changes::removed] << " removed." << '\n';
+        const char* names[] = {"changed", "added", "removed"};
+        for (auto& change : found) {
+            const SyntaxElement& element = (change.after != no_component) ? new_components[change.after]->self : old_components[change.before]->self;
+            std::string shown = element.content.substr(0, element.content.find('\n'));
+            if (shown.size() > 40) shown = shown.substr(0, 40) + "...";
+            out << "\t" << names[change.change] << " " << element.identifier << " at " << element.index << ": " << shown << '\n';
+        }
+        out.flush();
+    }
+};
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef TREE_INDEX_HPP
+#define TREE_INDEX_HPP
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include "generic-btree.hpp"
+#include "BuildSyntaxTree.hpp"
+
+namespace syntree {
+
+    typedef uint32_t NodeId;
+    const NodeId no_node = 0xffffffff;
+
+    class TreeIndex {
+        /*
+            Index over a built syntax tree for answering structural queries without
+            walking it. Nodes are identified by their preorder number, so a node's
+            subtree is the contiguous range [node, subtreeEnd(node)) and a node is
+            an ancestor of another exactly when it comes first in preorder and last
+            in postorder. Every rule keeps a posting list of its nodes in preorder,
+            which turns "nodes of rule r under n" into two binary searches.
+
+            The index points into the tree it was built from, which must outlive it
+            and not change.
+        */
+        private:
+            std::vector<const Trie<SyntaxElement>*> nodes;
+            std::vector<NodeId> post;
+            std::vector<NodeId> end;
+            std::vector<NodeId> parents;
+            std::vector<uint32_t> depths;
+            std::vector<uint32_t> rules;
+            std::vector<NodeId> rule_parent;     //Nearest ancestor of the same rule
+            std::unordered_map<std::string,uint32_t> rule_ids;
+            std::vector<std::vector<NodeId> > postings;
+
+            const std::vector<NodeId>& postingsOf(const std::string& rule) const {
+                static const std::vector<NodeId> none;
+                auto found = this->rule_ids.find(rule);
+                return (found == this->rule_ids.end()) ? none : this->postings[found->second];
+            }
+
+        public:
+            TreeIndex(const Trie<SyntaxElement>& tree) : nodes(), post(), end(), parents(), depths(), rules(), rule_parent(), rule_ids(), postings() {
+                /*
+                    One walk numbers every node on the way in and on the way out.
+                    Open nodes are kept on a stack, with the innermost open node of
+                    each rule found by scanning it from the top.
+                */
+                NodeId post_count = 0;
+                std::vector<NodeId> open;
+                std::vector<NodeId> open_of_rule;
+                walk(tree, [&](const Trie<SyntaxElement>& node, size_t depth) {
+                    NodeId id = this->nodes.size();
+                    auto rule = this->rule_ids.find(node.self.identifier);
+                    if (rule == this->rule_ids.end()) {
+                        rule = this->rule_ids.insert(std::make_pair(node.self.identifier, uint32_t(this->postings.size()))).first;
+                        this->postings.push_back(std::vector<NodeId>());
+                        open_of_rule.push_back(no_node);
+                    }
+                    this->nodes.push_back(&node);
+                    this->post.push_back(0);
+                    this->end.push_back(0);
+                    this->parents.push_back(open.empty() ? no_node : open.back());
+                    this->depths.push_back(depth);
+                    this->rules.push_back(rule->second);
+                    this->rule_parent.push_back(open_of_rule[rule->second]);
+                    this->postings[rule->second].push_back(id);
+                    open_of_rule[rule->second] = id;
+                    open.push_back(id);
+                }, [&](const Trie<SyntaxElement>&, size_t) {
+                    NodeId id = open.back();
+                    open.pop_back();
+                    this->post[id] = post_count++;
+                    this->end[id] = this->nodes.size();
+                    open_of_rule[this->rules[id]] = this->rule_parent[id];
+                });
+            }
+
+            uint_type size() const {
+                return this->nodes.size();
+            }
+
+            NodeId root() const {
+                return 0;
+            }
+
+            const Trie<SyntaxElement>& node(NodeId id) const {
+                return *this->nodes[id];
+            }
+
+            const SyntaxElement& element(NodeId id) const {
+                return this->nodes[id]->self;
+            }
+
+            NodeId parent(NodeId id) const {
+                return this->parents[id];
+            }
+
+            uint_type depth(NodeId id) const {
+                return this->depths[id];
+            }
+
+            NodeId subtreeEnd(NodeId id) const {
+                return this->end[id];
+            }
+
+            bool isAncestor(NodeId ancestor, NodeId id) const {
+                return ancestor < id && this->post[id] < this->post[ancestor];
+            }
+
+            const std::vector<NodeId>& byRule(const std::string& rule) const {
+                /*
+                    Every node of a rule, in preorder.
+                */
+                return this->postingsOf(rule);
+            }
+
+            std::vector<NodeId> byRules(const std::vector<std::string>& rules) const {
+                std::vector<NodeId> merged;
+                for (auto& rule : rules) {
+                    const std::vector<NodeId>& list = this->postingsOf(rule);
+                    uint_type middle = merged.size();
+                    merged.insert(merged.end(), list.begin(), list.end());
+                    std::inplace_merge(merged.begin(), merged.begin() + middle, merged.end());
+                }
+                merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+                return merged;
+            }
+
+            std::pair<std::vector<NodeId>::const_iterator,std::vector<NodeId>::const_iterator> descendantRange(NodeId id, const std::string& rule) const {
+                /*
+                    The nodes of a rule strictly under id, as a range of its posting
+                    list.
+                */
+                const std::vector<NodeId>& list = this->postingsOf(rule);
+                auto first = std::upper_bound(list.begin(), list.end(), id);
+                auto last = std::lower_bound(first, list.end(), this->end[id]);
+                return std::make_pair(first, last);
+            }
+
+            std::vector<NodeId> descendants(NodeId id, const std::string& rule) const {
+                auto range = this->descendantRange(id, rule);
+                return std::vector<NodeId>(range.first, range.second);
+            }
+
+            uint_type countDescendants(NodeId id, const std::string& rule) const {
+                auto range = this->descendantRange(id, rule);
+                return range.second - range.first;
+            }
+
+            NodeId nearestAncestor(NodeId id, const std::string& rule) const {
+                /*
+                    The last node of the rule before id in preorder either contains
+                    id or doesn't, and then neither does anything under it. Climbing
+                    same rule ancestors from there only visits nodes of that rule.
+                */
+                const std::vector<NodeId>& list = this->postingsOf(rule);
+                auto before = std::lower_bound(list.begin(), list.end(), id);
+                if (before == list.begin()) return no_node;
+                NodeId candidate = *(before - 1);
+                while (candidate != no_node && this->end[candidate] <= id) candidate = this->rule_parent[candidate];
+                return candidate;
+            }
+
+            std::vector<NodeId> ancestors(NodeId id, const std::string& rule) const {
+                /*
+                    Ancestors of a rule, nearest first.
+                */
+                std::vector<NodeId> found;
+                for (NodeId at = this->nearestAncestor(id, rule); at != no_node; at = this->rule_parent[at]) found.push_back(at);
+                return found;
+            }
+
+            std::vector<NodeId> select(const std::string& path) const {
+                /*
+                    Nodes matching a path of rules separated by '/', each a descendant
+                    of a node matching the step before it, e.g. "component_declr/name".
+                    A leading '/' anchors the first step to children of the root.
+                    Contexts nested inside an earlier context are already covered by
+                    its range, so every step stays sorted and free of duplicates.
+                */
+                std::vector<std::string> steps;
+                uint_type start = 0;
+                bool anchored = !path.empty() && path[0] == '/';
+                if (anchored) start = 1;
+                while (start <= path.size()) {
+                    uint_type slash = path.find('/', start);
+                    if (slash == std::string::npos) slash = path.size();
+                    if (slash > start) steps.push_back(path.substr(start, slash - start));
+                    start = slash + 1;
+                }
+                std::vector<NodeId> current;
+                if (steps.empty() || this->nodes.empty()) return current;
+                if (anchored) {
+                    for (NodeId child : this->postingsOf(steps[0])) {
+                        if (this->parents[child] == this->root()) current.push_back(child);
+                    }
+                }
+                else current = this->postingsOf(steps[0]);
+                for (uint_type step = 1; step < steps.size(); step++) {
+                    std::vector<NodeId> next;
+                    NodeId covered = 0;
+                    for (NodeId context : current) {
+                        if (context < covered) continue;
+                        covered = this->end[context];
+                        auto range = this->descendantRange(context, steps[step]);
+                        next.insert(next.end(), range.first, range.second);
+                    }
+                    current.swap(next);
+                }
+                return current;
+            }
+    };
+};
+
+#endif
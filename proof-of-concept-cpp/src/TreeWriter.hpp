@@ -0,0 +1,303 @@
+#ifndef TREE_WRITER_HPP
+#define TREE_WRITER_HPP
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include "generic-btree.hpp"
+#include "BuildSyntaxTree.hpp"
+#include "StreamParse.hpp"
+
+namespace syntree {
+
+    namespace formats {
+        enum Format {
+            text,       //Indented, the layout treeSummary has always printed
+            json,       //An array of nested {rule, index, length, content, children} objects
+            dot         //Graphviz digraph, one box per node
+        };
+    };
+
+    namespace contents {
+        enum Content {
+            full,       //All of a node's content
+            truncated,  //At most a set number of bytes of it
+            span        //Only its offset and length
+        };
+    };
+
+    class OutputBuffer {
+        /*
+            Collects output in one large block, handed to the stream only when full
+            or flushed rather than a write per line.
+        */
+        private:
+            std::ostream& out;
+            std::string buffer;
+            uint_type capacity;
+
+        public:
+            OutputBuffer(std::ostream& out, uint_type capacity = 1 << 20) : out(out), buffer(), capacity(capacity) {
+                this->buffer.reserve(capacity);
+            }
+
+            OutputBuffer(const OutputBuffer& copy) = delete;
+
+            ~OutputBuffer() {
+                this->flush();
+            }
+
+            void append(const char* data, uint_type size) {
+                if (this->buffer.size() + size > this->capacity) {
+                    this->flush();
+                    if (size > this->capacity) {
+                        this->out.write(data, size);
+                        return;
+                    }
+                }
+                this->buffer.append(data, size);
+            }
+
+            void append(const std::string& data) {
+                this->append(data.data(), data.size());
+            }
+
+            void put(char c) {
+                if (this->buffer.size() == this->capacity) this->flush();
+                this->buffer += c;
+            }
+
+            void number(uint_type value) {
+                char digits[24];
+                uint_type at = sizeof(digits);
+                do {
+                    digits[--at] = '0' + value % 10;
+                    value /= 10;
+                } while (value > 0);
+                this->append(digits + at, sizeof(digits) - at);
+            }
+
+            void flush() {
+                if (this->buffer.empty()) return;
+                this->out.write(this->buffer.data(), this->buffer.size());
+                this->buffer.clear();
+            }
+    };
+
+    class TreeWriter : public ParseListener {
+        /*
+            Writes syntax trees, whole or as streamed parse events, in one of the
+            formats above. Output goes through an OutputBuffer and indentation comes
+            from one string of tabs, so writing costs a copy per byte written. Full
+            content repeats every byte once per enclosing node, truncated or span
+            content keeps output linear in the number of nodes.
+        */
+        private:
+            OutputBuffer buffer;
+            formats::Format format;
+            contents::Content content;
+            uint_type limit;
+            std::string tabs;
+            std::vector<uint_type> open;        //JSON: children written so far, DOT: node number, per open node
+            uint_type top_level;
+            uint_type next_node;
+            bool flush_constructs;
+            bool finished;
+
+            void indent(uint_type depth) {
+                while (this->tabs.size() < depth) this->tabs.append(this->tabs.size() + 16, '\t');
+                this->buffer.append(this->tabs.data(), depth);
+            }
+
+            uint_type shown(const std::string& text) const {
+                /*
+                    Bytes of content to show, truncation backs off to the start of a
+                    UTF-8 sequence.
+                */
+                if (this->content != contents::truncated || text.size() <= this->limit) return text.size();
+                uint_type cut = this->limit;
+                while (cut > 0 && (text[cut] & 0xC0) == 0x80) cut--;
+                return cut;
+            }
+
+            void escaped(const std::string& text, uint_type size) {
+                /*
+                    Quoted the way JSON strings and DOT labels both accept.
+                */
+                static const char hex[] = "0123456789abcdef";
+                uint_type run = 0;
+                for (uint_type i = 0; i < size; i++) {
+                    unsigned char c = text[i];
+                    if (c >= 0x20 && c != '"' && c != '\\') continue;
+                    this->buffer.append(text.data() + run, i - run);
+                    run = i + 1;
+                    this->buffer.put('\\');
+                    switch (c) {
+                        case '"': this->buffer.put('"'); break;
+                        case '\\': this->buffer.put('\\'); break;
+                        case '\n': this->buffer.put('n'); break;
+                        case '\t': this->buffer.put('t'); break;
+                        case '\r': this->buffer.put('r'); break;
+                        default:
+                            if (this->format == formats::dot) {
+                                this->buffer.put(' ');
+                                break;
+                            }
+                            this->buffer.append("u00", 3);
+                            this->buffer.put(hex[c >> 4]);
+                            this->buffer.put(hex[c & 15]);
+                    }
+                }
+                this->buffer.append(text.data() + run, size - run);
+            }
+
+            void textNode(const SyntaxElement& element, uint_type depth) {
+                this->indent(depth);
+                this->buffer.append("depth:", 6);
+                this->buffer.number(depth);
+                this->buffer.append(" type:", 6);
+                this->buffer.append(element.identifier);
+                this->buffer.append(" index:", 7);
+                this->buffer.number(element.index);
+                if (this->content == contents::span) {
+                    this->buffer.append(" length:", 8);
+                    this->buffer.number(element.content.size());
+                    this->buffer.put('\n');
+                    return;
+                }
+                this->buffer.append(" content:\n", 10);
+                this->indent(depth);
+                this->buffer.put('"');
+                uint_type size = this->shown(element.content);
+                this->buffer.append(element.content.data(), size);
+                if (size < element.content.size()) this->buffer.append("...", 3);
+                this->buffer.append("\"\n", 2);
+            }
+
+            void jsonEnter(const SyntaxElement& element) {
+                if (this->open.empty()) this->buffer.append(this->top_level++ == 0 ? "[\n" : ",\n", 2);
+                else if (this->open.back()++ > 0) this->buffer.put(',');
+                this->buffer.append("{\"rule\":\"", 9);
+                this->escaped(element.identifier, element.identifier.size());
+                this->buffer.append("\",\"index\":", 10);
+                this->buffer.number(element.index);
+                this->buffer.append(",\"length\":", 10);
+                this->buffer.number(element.content.size());
+                if (this->content != contents::span) {
+                    this->buffer.append(",\"content\":\"", 12);
+                    this->escaped(element.content, this->shown(element.content));
+                    this->buffer.put('"');
+                }
+                this->buffer.append(",\"children\":[", 13);
+                this->open.push_back(0);
+            }
+
+            void jsonLeave() {
+                this->buffer.append("]}", 2);
+                this->open.pop_back();
+            }
+
+            void dotEnter(const SyntaxElement& element) {
+                if (this->next_node == 0) {
+                    this->buffer.append("digraph syntax_tree {\n\tnode [shape=box, fontname=\"monospace\"];\n");
+                }
+                uint_type id = this->next_node++;
+                this->buffer.append("\tn", 2);
+                this->buffer.number(id);
+                this->buffer.append(" [label=\"", 9);
+                this->escaped(element.identifier, element.identifier.size());
+                this->buffer.append("\\n@", 3);
+                this->buffer.number(element.index);
+                if (this->content == contents::span) {
+                    this->buffer.append(" +", 2);
+                    this->buffer.number(element.content.size());
+                }
+                else {
+                    uint_type size = this->shown(element.content);
+                    this->buffer.append("\\n\\\"", 4);
+                    this->escaped(element.content, size);
+                    if (size < element.content.size()) this->buffer.append("...", 3);
+                    this->buffer.append("\\\"", 2);
+                }
+                this->buffer.append("\"];\n", 4);
+                if (!this->open.empty()) {
+                    this->buffer.append("\tn", 2);
+                    this->buffer.number(this->open.back());
+                    this->buffer.append(" -> n", 5);
+                    this->buffer.number(id);
+                    this->buffer.append(";\n", 2);
+                }
+                this->open.push_back(id);
+            }
+
+        public:
+            TreeWriter(std::ostream& out, formats::Format format = formats::text, contents::Content content = contents::full, uint_type limit = 40)
+                : buffer(out), format(format), content(content), limit(limit), tabs(64, '\t'), open(), top_level(0), next_node(0), flush_constructs(false), finished(false) {
+            }
+
+            ~TreeWriter() {
+                this->finish();
+            }
+
+            void incremental(bool flush_constructs) {
+                /*
+                    Flushes after the root and after every top-level construct, so
+                    the output of a streamed parse keeps up with it.
+                */
+                this->flush_constructs = flush_constructs;
+            }
+
+            void enter(const SyntaxElement& element, uint_type depth) {
+                if (this->format == formats::text) this->textNode(element, depth);
+                else if (this->format == formats::json) this->jsonEnter(element);
+                else this->dotEnter(element);
+                if (this->flush_constructs && depth == 0) this->buffer.flush();
+            }
+
+            void leave(const SyntaxElement&, uint_type depth) {
+                if (this->format == formats::json) this->jsonLeave();
+                else if (this->format == formats::dot) this->open.pop_back();
+                if (this->flush_constructs && depth <= 1) this->buffer.flush();
+            }
+
+            void leaf(const SyntaxElement& element, uint_type depth) {
+                this->enter(element, depth);
+                this->leave(element, depth);
+            }
+
+            void write(const Trie<SyntaxElement>& tree, uint_type depth = 0) {
+                walk(tree, [&](const Trie<SyntaxElement>& node, size_t level) {
+                    this->enter(node.self, depth + level);
+                }, [&](const Trie<SyntaxElement>& node, size_t level) {
+                    this->leave(node.self, depth + level);
+                });
+            }
+
+            void flush() {
+                this->buffer.flush();
+            }
+
+            void finish() {
+                /*
+                    Closes the JSON array or DOT graph and flushes. Nothing more can be
+                    written after.
+                */
+                if (this->finished) return;
+                this->finished = true;
+                if (this->format == formats::json) this->buffer.append(this->top_level > 0 ? "\n]\n" : "[]\n");
+                else if (this->format == formats::dot) {
+                    if (this->next_node == 0) this->buffer.append("digraph syntax_tree {\n");
+                    this->buffer.append("}\n", 2);
+                }
+                this->buffer.flush();
+            }
+    };
+
+    void treeSummary(const Trie<SyntaxElement>& tree, uint_type depth = 0, std::ostream& out = std::cout) {
+        TreeWriter writer(out);
+        writer.write(tree, depth);
+    }
+};
+
+#endif
@@ -0,0 +1,520 @@
+#ifndef WAVEFORM_HPP
+#define WAVEFORM_HPP
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include "Netlist.hpp"
+#include "Simulator.hpp"
+
+namespace sim {
+
+    /*
+        Waveform files hold value changes of single bit signals. After the header
+        come compressed blocks, each the changes of one signal over a stretch of
+        time, then an index of the blocks and a fixed size trailer pointing at it:
+
+            header  "LLWAVE01", signal count, scope and signal names
+            blocks  run length encoded time deltas as varints
+            index   per block: signal, first and last time, offset, size,
+                    changes and the value after its first change
+            trailer index offset as 8 little endian bytes, "LLWAVIDX"
+
+        A signal's value flips at every change, so a block needs only the times
+        and its first value, and the index alone gives any signal's value at any
+        time without reading a block.
+    */
+    const char* const wave_magic = "LLWAVE01";
+    const char* const wave_index_magic = "LLWAVIDX";
+    const uint_type wave_trailer = 16;
+
+    void putVarint(std::string& out, uint64_t value) {
+        while (value >= 0x80) {
+            out += char((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        out += char(value);
+    }
+
+    uint64_t getVarint(const std::string& in, uint_type& at) {
+        uint64_t value = 0;
+        for (uint_type shift = 0; at < in.size() && shift < 64; shift += 7) {
+            uint8_t byte = in[at++];
+            value |= uint64_t(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) break;
+        }
+        return value;
+    }
+
+    struct WaveBlock {
+        uint32_t signal;
+        uint64_t first_time;
+        uint64_t last_time;
+        uint64_t offset;
+        uint64_t bytes;
+        uint64_t changes;
+        bool first_value;
+
+        bool lastValue() const {
+            return this->first_value ^ ((this->changes - 1) & 1);
+        }
+    };
+
+    class WaveformWriter {
+        /*
+            Records value changes of a fixed set of signals. Each signal buffers its
+            change times, a full buffer is handed to a background thread that
+            encodes it and appends it to the file, so the simulation only ever
+            pays for comparing and appending. Times must not decrease.
+        */
+        private:
+            struct Pending {
+                uint32_t signal;
+                bool first_value;
+                std::vector<uint64_t> times;
+            };
+
+            std::fstream out;
+            uint_type block_changes;
+            std::vector<std::vector<uint64_t> > buffers;
+            std::vector<uint8_t> values;            //Last value, 2 until the first sample
+            std::vector<uint8_t> buffer_values;     //Value after the first change in the buffer
+            std::deque<Pending> queue;
+            std::mutex lock;
+            std::condition_variable ready;
+            std::thread compressor;
+            std::vector<WaveBlock> index;
+            uint64_t written;
+            uint64_t changes;
+            bool opened;
+            bool stopping;
+            bool finished;
+
+            void hand(uint32_t signal) {
+                Pending pending;
+                pending.signal = signal;
+                pending.first_value = this->buffer_values[signal];
+                pending.times.swap(this->buffers[signal]);
+                {
+                    std::lock_guard<std::mutex> guard(this->lock);
+                    this->queue.push_back(std::move(pending));
+                }
+                this->ready.notify_one();
+            }
+
+            void compress() {
+                /*
+                    Runs on the background thread. Equal deltas are stored once with
+                    their count, so a clock costs a few bytes per block.
+                */
+                std::string encoded;
+                while (true) {
+                    Pending pending;
+                    {
+                        std::unique_lock<std::mutex> guard(this->lock);
+                        this->ready.wait(guard, [&]() { return !this->queue.empty() || this->stopping; });
+                        if (this->queue.empty()) return;
+                        pending = std::move(this->queue.front());
+                        this->queue.pop_front();
+                    }
+                    encoded.clear();
+                    const std::vector<uint64_t>& times = pending.times;
+                    for (uint_type i = 1; i < times.size(); ) {
+                        uint64_t delta = times[i] - times[i - 1];
+                        uint_type run = 1;
+                        while (i + run < times.size() && times[i + run] - times[i + run - 1] == delta) run++;
+                        putVarint(encoded, delta);
+                        putVarint(encoded, run);
+                        i += run;
+                    }
+                    this->out.write(encoded.data(), encoded.size());
+                    WaveBlock block = {pending.signal, times.front(), times.back(), this->written, encoded.size(), times.size(), pending.first_value};
+                    this->index.push_back(block);
+                    this->written += encoded.size();
+                }
+            }
+
+        public:
+            WaveformWriter(const std::string& filename, const std::vector<std::string>& signals, const std::string& scope = "top", uint_type block_changes = 4096)
+                : out(filename.c_str(), std::ios::out | std::ios::trunc | std::ios::binary), block_changes(block_changes), buffers(signals.size()),
+                  values(signals.size(), 2), buffer_values(signals.size(), 0), queue(), lock(), ready(), compressor(), index(), written(0), changes(0),
+                  opened(false), stopping(false), finished(false) {
+                if (!this->out.is_open()) {
+                    SIM_ERROUT << "cannot write waveform to " << filename << "." << std::endl;
+                    this->finished = true;
+                    return;
+                }
+                std::string header(wave_magic);
+                putVarint(header, signals.size());
+                putVarint(header, scope.size());
+                header += scope;
+                for (auto& name : signals) {
+                    putVarint(header, name.size());
+                    header += name;
+                }
+                this->out.write(header.data(), header.size());
+                this->written = header.size();
+                this->opened = true;
+                this->compressor = std::thread(&WaveformWriter::compress, this);
+            }
+
+            WaveformWriter(const WaveformWriter& copy) = delete;
+
+            ~WaveformWriter() {
+                this->finish();
+            }
+
+            bool valid() const {
+                return this->opened;
+            }
+
+            void record(uint64_t time, uint32_t signal, bool value) {
+                /*
+                    Keeps the value if it differs from the signal's last one, the
+                    first value of every signal is always kept.
+                */
+                if (this->values[signal] == uint8_t(value)) return;
+                this->values[signal] = value;
+                std::vector<uint64_t>& buffer = this->buffers[signal];
+                if (buffer.empty()) this->buffer_values[signal] = value;
+                buffer.push_back(time);
+                this->changes++;
+                if (buffer.size() >= this->block_changes) this->hand(signal);
+            }
+
+            /*
+                Blocks and bytes are only settled once finished.
+            */
+            uint64_t recorded() const {
+                return this->changes;
+            }
+
+            uint64_t blocks() const {
+                return this->index.size();
+            }
+
+            uint64_t bytes() const {
+                return this->written;
+            }
+
+            void finish() {
+                /*
+                    Hands over the partly filled buffers, waits for the background
+                    thread and writes the index, blocks of each signal together.
+                */
+                if (this->finished) return;
+                this->finished = true;
+                for (uint32_t signal = 0; signal < this->buffers.size(); signal++) {
+                    if (!this->buffers[signal].empty()) this->hand(signal);
+                }
+                {
+                    std::lock_guard<std::mutex> guard(this->lock);
+                    this->stopping = true;
+                }
+                this->ready.notify_one();
+                this->compressor.join();
+                std::stable_sort(this->index.begin(), this->index.end(), [](const WaveBlock& a, const WaveBlock& b) { return a.signal < b.signal; });
+                std::string encoded;
+                putVarint(encoded, this->index.size());
+                for (auto& block : this->index) {
+                    putVarint(encoded, block.signal);
+                    putVarint(encoded, block.first_time);
+                    putVarint(encoded, block.last_time - block.first_time);
+                    putVarint(encoded, block.offset);
+                    putVarint(encoded, block.bytes);
+                    putVarint(encoded, block.changes);
+                    encoded += char(block.first_value);
+                }
+                uint64_t index_offset = this->written;
+                for (uint_type i = 0; i < 8; i++) encoded += char((index_offset >> (i * 8)) & 0xff);
+                encoded += wave_index_magic;
+                this->out.write(encoded.data(), encoded.size());
+                this->written += encoded.size();
+                this->out.close();
+            }
+    };
+
+    class WaveformReader {
+        /*
+            Reads a waveform through its index, only the blocks overlapping the
+            time range asked for are read from disk.
+        */
+        private:
+            mutable std::ifstream in;
+            std::vector<WaveBlock> index;
+            std::vector<uint_type> signal_blocks;   //First index entry of every signal, and the end
+            bool loaded;
+
+            std::string readAt(uint64_t offset, uint64_t bytes) const {
+                std::string data(bytes, '\0');
+                this->in.clear();
+                this->in.seekg(offset);
+                this->in.read(&data[0], bytes);
+                return data;
+            }
+
+            bool readVarint(uint64_t& at, uint64_t end, uint64_t& value) const {
+                /*
+                    A varint read straight from the file, false if it runs past end.
+                */
+                value = 0;
+                this->in.clear();
+                this->in.seekg(at);
+                for (uint_type shift = 0; at < end && shift < 64; shift += 7) {
+                    int byte = this->in.get();
+                    if (byte == std::char_traits<char>::eof()) return false;
+                    at++;
+                    value |= uint64_t(byte & 0x7f) << shift;
+                    if ((byte & 0x80) == 0) return true;
+                }
+                return false;
+            }
+
+            bool readString(uint64_t& at, uint64_t end, std::string& text) const {
+                uint64_t length = 0;
+                if (!this->readVarint(at, end, length) || length > end - at) return false;
+                text = this->readAt(at, length);
+                at += length;
+                return true;
+            }
+
+            bool fail(const std::string& filename) {
+                SIM_ERROUT << filename << " is not a waveform file." << std::endl;
+                return false;
+            }
+
+            bool load(const std::string& filename) {
+                if (!this->in.is_open()) {
+                    SIM_ERROUT << "cannot read waveform from " << filename << "." << std::endl;
+                    return false;
+                }
+                this->in.seekg(0, std::ios::end);
+                uint64_t size = this->in.tellg();
+                if (size < std::strlen(wave_magic) + wave_trailer) return this->fail(filename);
+                std::string trailer = this->readAt(size - wave_trailer, wave_trailer);
+                if (trailer.compare(8, 8, wave_index_magic) != 0) return this->fail(filename);
+                uint64_t index_offset = 0;
+                for (uint_type i = 0; i < 8; i++) index_offset |= uint64_t(uint8_t(trailer[i])) << (i * 8);
+                if (index_offset > size - wave_trailer) return this->fail(filename);
+                /*
+                    The header is read field by field up to the index, never the
+                    blocks in between, and every count and length is checked
+                    against the bytes left before anything is allocated for it.
+                    A name takes at least its length byte, an index entry seven.
+                */
+                if (index_offset < std::strlen(wave_magic) || this->readAt(0, 8).compare(0, 8, wave_magic) != 0) return this->fail(filename);
+                uint64_t at = 8;
+                uint64_t count = 0;
+                if (!this->readVarint(at, index_offset, count) || count > index_offset - at) return this->fail(filename);
+                if (!this->readString(at, index_offset, this->scope)) return this->fail(filename);
+                this->names.resize(count);
+                for (auto& name : this->names) {
+                    if (!this->readString(at, index_offset, name)) return this->fail(filename);
+                }
+                uint64_t blocks_start = at;
+                std::string encoded = this->readAt(index_offset, size - wave_trailer - index_offset);
+                uint_type position = 0;
+                count = getVarint(encoded, position);
+                if (count > (encoded.size() - position) / 7) return this->fail(filename);
+                this->index.resize(count);
+                for (uint_type i = 0; i < this->index.size(); i++) {
+                    WaveBlock& block = this->index[i];
+                    block.signal = getVarint(encoded, position);
+                    block.first_time = getVarint(encoded, position);
+                    block.last_time = block.first_time + getVarint(encoded, position);
+                    block.offset = getVarint(encoded, position);
+                    block.bytes = getVarint(encoded, position);
+                    block.changes = getVarint(encoded, position);
+                    if (position >= encoded.size()) return this->fail(filename);
+                    block.first_value = encoded[position++] != 0;
+                    if (block.changes == 0 || block.signal >= this->names.size() || (i > 0 && block.signal < this->index[i - 1].signal)) return this->fail(filename);
+                    if (block.offset < blocks_start || block.bytes > index_offset || block.offset > index_offset - block.bytes) return this->fail(filename);
+                }
+                this->signal_blocks.assign(this->names.size() + 1, 0);
+                for (auto& block : this->index) this->signal_blocks[block.signal + 1]++;
+                for (uint_type signal = 0; signal < this->names.size(); signal++) this->signal_blocks[signal + 1] += this->signal_blocks[signal];
+                return true;
+            }
+
+        public:
+            std::vector<std::string> names;
+            std::string scope;
+
+            WaveformReader(const std::string& filename) : in(filename.c_str(), std::ios::in | std::ios::binary), index(), signal_blocks(), loaded(false), names(), scope() {
+                this->loaded = this->load(filename);
+            }
+
+            bool valid() const {
+                return this->loaded;
+            }
+
+            uint_type signals() const {
+                return this->names.size();
+            }
+
+            uint64_t endTime() const {
+                uint64_t end = 0;
+                for (auto& block : this->index) end = std::max(end, block.last_time);
+                return end;
+            }
+
+            int valueAt(uint32_t signal, uint64_t time) const {
+                /*
+                    Value of a signal at a time, or -1 before its first sample. Found
+                    from the index alone.
+                */
+                auto begin = this->index.begin() + this->signal_blocks[signal];
+                auto end = this->index.begin() + this->signal_blocks[signal + 1];
+                auto after = std::upper_bound(begin, end, time, [](uint64_t t, const WaveBlock& block) { return t < block.first_time; });
+                if (after == begin) return -1;
+                --after;
+                if (time >= after->last_time) return after->lastValue();
+                std::vector<std::pair<uint64_t,bool> > within;
+                this->decode(*after, within);
+                int value = -1;
+                for (auto& change : within) {
+                    if (change.first > time) break;
+                    value = change.second;
+                }
+                return value;
+            }
+
+            void decode(const WaveBlock& block, std::vector<std::pair<uint64_t,bool> >& out) const {
+                /*
+                    Never more than the changes the index gives for the block, however
+                    long the runs in a corrupt file claim to be.
+                */
+                std::string encoded = this->readAt(block.offset, block.bytes);
+                uint64_t time = block.first_time;
+                bool value = block.first_value;
+                out.push_back(std::make_pair(time, value));
+                uint64_t decoded = 1;
+                uint_type at = 0;
+                while (at < encoded.size() && decoded < block.changes) {
+                    uint64_t delta = getVarint(encoded, at);
+                    uint64_t run = std::min(getVarint(encoded, at), block.changes - decoded);
+                    decoded += run;
+                    for (uint64_t i = 0; i < run; i++) {
+                        time += delta;
+                        value = !value;
+                        out.push_back(std::make_pair(time, value));
+                    }
+                }
+            }
+
+            std::vector<std::pair<uint64_t,bool> > changes(uint32_t signal, uint64_t from, uint64_t to) const {
+                /*
+                    Changes of a signal with from <= time <= to.
+                */
+                std::vector<std::pair<uint64_t,bool> > result;
+                auto begin = this->index.begin() + this->signal_blocks[signal];
+                auto end = this->index.begin() + this->signal_blocks[signal + 1];
+                auto first = std::lower_bound(begin, end, from, [](const WaveBlock& block, uint64_t t) { return block.last_time < t; });
+                for (auto block = first; block != end && block->first_time <= to; ++block) {
+                    uint_type kept = result.size();
+                    this->decode(*block, result);
+                    auto drop = std::remove_if(result.begin() + kept, result.end(), [&](const std::pair<uint64_t,bool>& change) {
+                        return change.first < from || change.first > to;
+                    });
+                    result.erase(drop, result.end());
+                }
+                return result;
+            }
+
+            void writeVCD(std::ostream& out, uint64_t from = 0, uint64_t to = uint64_t(-1)) const {
+                /*
+                    Value change dump of a time range, one time unit per step. Values
+                    at from go in $dumpvars, x for signals not sampled yet.
+                */
+                std::vector<std::string> codes(this->names.size());
+                for (uint_type signal = 0; signal < this->names.size(); signal++) {
+                    uint_type n = signal;
+                    do {
+                        codes[signal] += char(33 + n % 94);
+                        n /= 94;
+                    } while (n > 0);
+                }
+                out << "$comment Generated by LLace $end\n$timescale 1ns $end\n$scope module " << this->scope << " $end\n";
+                for (uint_type signal = 0; signal < this->names.size(); signal++) {
+                    out << "$var wire 1 " << codes[signal] << " " << this->names[signal] << " $end\n";
+                }
+                out << "$upscope $end\n$enddefinitions $end\n#" << from << "\n$dumpvars\n";
+                std::vector<std::pair<uint64_t,uint32_t> > events;
+                std::vector<std::vector<std::pair<uint64_t,bool> > > changed(this->names.size());
+                for (uint32_t signal = 0; signal < this->names.size(); signal++) {
+                    int value = this->valueAt(signal, from);
+                    out << (value < 0 ? 'x' : char('0' + value)) << codes[signal] << '\n';
+                    if (to <= from) continue;
+                    changed[signal] = this->changes(signal, from + 1, to);
+                    for (uint_type i = 0; i < changed[signal].size(); i++) events.push_back(std::make_pair(changed[signal][i].first, signal));
+                }
+                out << "$end\n";
+                std::vector<uint_type> next(this->names.size(), 0);
+                std::stable_sort(events.begin(), events.end(), [](const std::pair<uint64_t,uint32_t>& a, const std::pair<uint64_t,uint32_t>& b) { return a.first < b.first; });
+                for (uint_type i = 0; i < events.size(); i++) {
+                    if (i == 0 || events[i].first != events[i - 1].first) out << '#' << events[i].first << '\n';
+                    uint32_t signal = events[i].second;
+                    out << char('0' + changed[signal][next[signal]++].second) << codes[signal] << '\n';
+                }
+            }
+    };
+
+    bool traceReport(const netlist::Netlist& design, uint_type steps, const std::string& filename, const std::string& vcd_filename = "", std::ostream& out = std::cout) {
+        /*
+            Drives a design with random inputs for a number of steps, recording
+            lane 0 of every net, and optionally converts the trace to VCD. Nets
+            without a name are called after their handle.
+        */
+        LevelizedSimulator<1> simulator(design);
+        if (!simulator.valid()) return false;
+        std::vector<std::string> names(design.nets());
+        for (netlist::Handle net = 0; net < design.nets(); net++) {
+            names[net] = (design.net_name[net] != netlist::none) ? design.names[design.net_name[net]] : "_n" + std::to_string(net);
+        }
+        std::mt19937_64 random(0x11ace);
+        auto started = std::chrono::steady_clock::now();
+        WaveformWriter writer(filename, names, design.top);
+        if (!writer.valid()) return false;
+        for (uint_type step = 0; step < steps; step++) {
+            for (uint_type i = 0; i < simulator.inputs(); i++) simulator.setInput(i, (random() & 1) != 0);
+            simulator.settle();
+            for (netlist::Handle net = 0; net < design.nets(); net++) writer.record(step, net, (simulator.netValue(net)[0] & 1) != 0);
+        }
+        writer.finish();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        out << "traced " << design.nets() << " nets of " << design.top << " over " << steps << " steps: " << writer.recorded()
+            << " value changes in " << writer.blocks() << " blocks, " << writer.bytes() << " bytes in " << std::fixed
+            << std::setprecision(6) << seconds << "s" << '\n';
+        out << "Wrote waveform to: " << filename << '\n';
+        if (!vcd_filename.empty()) {
+            WaveformReader reader(filename);
+            if (!reader.valid()) return false;
+            std::fstream vcd(vcd_filename.c_str(), std::ios::out | std::ios::trunc);
+            if (!vcd.is_open()) {
+                SIM_ERROUT << "cannot write VCD to " << vcd_filename << "." << std::endl;
+                return false;
+            }
+            reader.writeVCD(vcd);
+            vcd.close();
+            if (vcd.fail()) {
+                SIM_ERROUT << "was not able to write VCD to " << vcd_filename << "." << std::endl;
+                return false;
+            }
+            out << "Wrote VCD to: " << vcd_filename << '\n';
+        }
+        out.flush();
+        return true;
+    }
+};
+
+#endif
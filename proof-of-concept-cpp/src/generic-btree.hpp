@@ -31,12 +31,25 @@ class BNode {
         }
         
         BNode(const BNode<T>& copy) : BNode() {
-            this->self = new T(*copy.value);
-            if (copy.left != nullptr) {
-                this->left = new BNode<T>(*copy.left);
-            }
-            if (copy.right != nullptr) {
-                this->right = new BNode<T>(*copy.right);
+            /*
+                Copies level by level with an explicit work list so deep trees
+                can't overflow the native stack.
+            */
+            std::vector<std::pair<const BNode<T>*,BNode<T>*> > work;
+            work.push_back(std::make_pair(&copy, this));
+            while (!work.empty()) {
+                const BNode<T>* from = work.back().first;
+                BNode<T>* to = work.back().second;
+                work.pop_back();
+                if (from->self != nullptr) to->self = new T(*from->self);
+                if (from->left != nullptr) {
+                    to->left = new BNode<T>();
+                    work.push_back(std::make_pair(from->left, to->left));
+                }
+                if (from->right != nullptr) {
+                    to->right = new BNode<T>();
+                    work.push_back(std::make_pair(from->right, to->right));
+                }
             }
         }
         
@@ -50,28 +63,41 @@ class BNode {
         }
         
         ~BNode() {
-            delete this->self;
-            this->self = nullptr;
-            delete this->left;
+            /*
+                Children are detached onto a heap allocated work list before being
+                deleted, so each delete only ever frees a leaf.
+            */
+            std::vector<BNode<T>*> work;
+            if (this->left != nullptr) work.push_back(this->left);
+            if (this->right != nullptr) work.push_back(this->right);
             this->left = nullptr;
-            delete this->right;
             this->right = nullptr;
+            while (!work.empty()) {
+                BNode<T>* node = work.back();
+                work.pop_back();
+                if (node->left != nullptr) work.push_back(node->left);
+                if (node->right != nullptr) work.push_back(node->right);
+                node->left = nullptr;
+                node->right = nullptr;
+                delete node;
+            }
+            delete this->self;
+            this->self = nullptr;
         }
         
         size_t size() const {
-            if (this->self != nullptr) {
-                size_t total = 1;
-                if (this->left != nullptr) {
-                    total += this->left->size();
-                }
-                if (this->right != nullptr) {
-                    total += this->right->size();
-                }
-                return total;
-            }
-            else {
-                return 0;
+            size_t total = 0;
+            std::vector<const BNode<T>*> work;
+            work.push_back(this);
+            while (!work.empty()) {
+                const BNode<T>* node = work.back();
+                work.pop_back();
+                if (node->self == nullptr) continue;
+                total++;
+                if (node->left != nullptr) work.push_back(node->left);
+                if (node->right != nullptr) work.push_back(node->right);
             }
+            return total;
         }
 };
 
@@ -81,7 +107,7 @@ class Trie {
         T self;
         std::vector<Trie<T> > data;
         
-        Trie() : self(T()), data(std::vector<Trie<T> >()) {
+        Trie() : self(T()), data(std::vector<Trie<T> >()), cached_size(0) {
         }
         
         Trie(const T& value) : Trie() {
@@ -89,17 +115,31 @@ class Trie {
         }
         
         Trie(const Trie<T>& copy) : Trie() {
-            this->self = copy.self;
-            this->data = copy.data;
+            this->copyFrom(copy);
         }
         
         Trie(Trie<T>&& move) : Trie() {
             std::swap(this->self,move.self);
             std::swap(this->data,move.data);
+            std::swap(this->cached_size,move.cached_size);
         }
         
         ~Trie() {
-            
+            /*
+                Descendants are moved out onto a heap allocated work list and
+                destroyed one at a time once they have no children of their own,
+                so destroying a deep tree doesn't recurse.
+            */
+            if (this->data.empty()) return;
+            std::vector<Trie<T> > work;
+            for (size_t i = 0; i < this->data.size(); i++) work.push_back(std::move(this->data[i]));
+            this->data.clear();
+            while (!work.empty()) {
+                Trie<T> node(std::move(work.back()));
+                work.pop_back();
+                for (size_t i = 0; i < node.data.size(); i++) work.push_back(std::move(node.data[i]));
+                node.data.clear();
+            }
         }
         
         Trie<T>& leftmost() {
@@ -113,11 +153,32 @@ class Trie {
         }
         
         size_t size() const {
-            size_t total_size = 1;
-            for (size_t i = 0; i < this->data.size(); i++) {
-                total_size += this->data[i].size();
+            /*
+                Number of nodes in the tree. Computed once with an explicit stack
+                and cached in every node, call invalidateSize() on a node and its
+                ancestors after changing its children.
+            */
+            if (this->cached_size != 0) return this->cached_size;
+            std::vector<std::pair<const Trie<T>*,size_t> > work;
+            work.push_back(std::make_pair(this, size_t(0)));
+            while (!work.empty()) {
+                const Trie<T>* node = work.back().first;
+                size_t& next_child = work.back().second;
+                if (next_child < node->data.size()) {
+                    const Trie<T>* child = &node->data[next_child++];
+                    if (child->cached_size == 0) work.push_back(std::make_pair(child, size_t(0)));
+                    continue;
+                }
+                size_t total = 1;
+                for (size_t i = 0; i < node->data.size(); i++) total += node->data[i].cached_size;
+                node->cached_size = total;
+                work.pop_back();
             }
-            return total_size;
+            return this->cached_size;
+        }
+        
+        void invalidateSize() {
+            this->cached_size = 0;
         }
         
         bool isterminal() {
@@ -125,12 +186,92 @@ class Trie {
         }
         
         Trie<T>& operator= (const Trie<T>& copy) {
-            this->self = copy.self;
-            this->data = copy.data;
+            if (this != &copy) {
+                Trie<T> copied(copy);
+                std::swap(this->self,copied.self);
+                std::swap(this->data,copied.data);
+                std::swap(this->cached_size,copied.cached_size);
+            }
             return *this;
         }
+        
+        Trie<T>& operator= (Trie<T>&& move) {
+            std::swap(this->self,move.self);
+            std::swap(this->data,move.data);
+            std::swap(this->cached_size,move.cached_size);
+            return *this;
+        }
+        
+    private:
+        mutable size_t cached_size;
+        
+        void copyFrom(const Trie<T>& copy) {
+            /*
+                Copies with an explicit work list. Each node's child vector is sized
+                before any child is queued, so the queued pointers stay valid.
+            */
+            std::vector<std::pair<const Trie<T>*,Trie<T>*> > work;
+            work.push_back(std::make_pair(&copy, this));
+            while (!work.empty()) {
+                const Trie<T>* from = work.back().first;
+                Trie<T>* to = work.back().second;
+                work.pop_back();
+                to->self = from->self;
+                to->cached_size = from->cached_size;
+                to->data.resize(from->data.size());
+                for (size_t i = 0; i < from->data.size(); i++) {
+                    work.push_back(std::make_pair(&from->data[i], &to->data[i]));
+                }
+            }
+        }
 };
 
+template<class T, class Visitor>
+void preorder(const Trie<T>& tree, Visitor visit) {
+    /*
+        Calls visit(node, depth) for every node, parents before children and
+        children in order, without recursing.
+    */
+    std::vector<std::pair<const Trie<T>*,size_t> > work;
+    work.push_back(std::make_pair(&tree, size_t(0)));
+    while (!work.empty()) {
+        const Trie<T>* node = work.back().first;
+        size_t depth = work.back().second;
+        work.pop_back();
+        visit(*node, depth);
+        for (size_t i = node->data.size(); i > 0; i--) {
+            work.push_back(std::make_pair(&node->data[i - 1], depth + 1));
+        }
+    }
+}
+
+template<class T, class Enter, class Leave>
+void walk(const Trie<T>& tree, Enter enter, Leave leave) {
+    /*
+        Calls enter(node, depth) before a node's children and leave(node, depth)
+        after them, without recursing.
+    */
+    std::vector<std::pair<const Trie<T>*,size_t> > work;
+    std::vector<size_t> depths;
+    work.push_back(std::make_pair(&tree, size_t(0)));
+    depths.push_back(0);
+    while (!work.empty()) {
+        const Trie<T>* node = work.back().first;
+        size_t& next_child = work.back().second;
+        size_t depth = depths.back();
+        if (next_child == 0) enter(*node, depth);
+        if (next_child < node->data.size()) {
+            const Trie<T>* child = &node->data[next_child++];
+            work.push_back(std::make_pair(child, size_t(0)));
+            depths.push_back(depth + 1);
+            continue;
+        }
+        leave(*node, depth);
+        work.pop_back();
+        depths.pop_back();
+    }
+}
+
 template<class T>
 class Stack {
     private:
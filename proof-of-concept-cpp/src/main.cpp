@@ -8,29 +8,252 @@
 #define EBNF_GIVE_UP_EASILY
 #include "EBNF.hpp"
 #include "BuildSyntaxTree.hpp"
+#include "Lexer.hpp"
+#include "StreamParse.hpp"
+#include "BinaryTree.hpp"
+#include "ParseCache.hpp"
+#include "CompileServer.hpp"
+#include "Netlist.hpp"
+#include "Simulator.hpp"
+#include "ParallelSimulator.hpp"
+#include "ImportResolver.hpp"
+#include "TreeIndex.hpp"
+#include "TreeWriter.hpp"
+#include "Preprocess.hpp"
+#include "LazyParse.hpp"
+#include "NativeBackend.hpp"
+#include "Waveform.hpp"
+#include "TreeHash.hpp"
 
 int main(int argc, char** args) {
     std::cout << "LLace compiler." << std::endl;
     std::cout << "using pcre version: " << pcre_version() << std::endl;
     std::cout << "compiled at " << __TIME__ << " on " << __DATE__ << std::endl;
     std::string ebnf_filename;
+    std::vector<std::string> ebnf_filenames;
     std::string source_filename = "source_file_example.txt";
+    std::string emit_binary_filename;
+    std::string load_binary_filename;
+    std::string cache_directory;
+    uint_type cache_megabytes = 256;
+    std::string serve_socket;
+    std::string connect_socket;
+    std::string folded_filename;
+    std::string netlist_top;
+    uint_type sim_lanes = 64;
+    uint_type sim_threads = 0;
+    uint_type native_steps = 0;
+    std::string wave_filename;
+    std::string vcd_filename;
+    uint_type wave_steps = 1000;
+    std::vector<std::string> import_paths;
+    uint_type import_threads = 0;
+    std::vector<std::string> start_rules;
+    uint_type grammar_threads = 1;
+    std::string query_path;
+    syntree::formats::Format tree_format = syntree::formats::text;
+    syntree::contents::Content tree_content = syntree::contents::full;
+    uint_type content_limit = 40;
+    std::string tree_filename;
+    std::string diff_filename;
     for (int i = 0; i < argc - 1; i++) {
         if (strcmp(args[i], "-ebnf") == 0) {
             ebnf_filename = args[i + 1];
+            ebnf_filenames.push_back(ebnf_filename);
         }
         if (strcmp(args[i],"-src") == 0) {
             source_filename = args[i + 1];
         }
+        if (strcmp(args[i],"-emit-binary") == 0) {
+            emit_binary_filename = args[i + 1];
+        }
+        if (strcmp(args[i],"-load-binary") == 0) {
+            load_binary_filename = args[i + 1];
+        }
+        if (strcmp(args[i],"-cache") == 0) {
+            cache_directory = args[i + 1];
+        }
+        if (strcmp(args[i],"-cache-size") == 0) {
+            cache_megabytes = std::strtoull(args[i + 1], nullptr, 10);
+        }
+        if (strcmp(args[i],"-serve") == 0) {
+            serve_socket = args[i + 1];
+        }
+        if (strcmp(args[i],"-connect") == 0) {
+            connect_socket = args[i + 1];
+        }
+        if (strcmp(args[i],"-profile-folded") == 0) {
+            folded_filename = args[i + 1];
+        }
+        if (strcmp(args[i],"-netlist") == 0) {
+            netlist_top = args[i + 1];
+        }
+        if (strcmp(args[i],"-sim-lanes") == 0) {
+            sim_lanes = std::strtoull(args[i + 1], nullptr, 10);
+        }
+        if (strcmp(args[i],"-sim-threads") == 0) {
+            sim_threads = std::strtoull(args[i + 1], nullptr, 10);
+        }
+        if (strcmp(args[i],"-native") == 0) {
+            native_steps = std::strtoull(args[i + 1], nullptr, 10);
+        }
+        if (strcmp(args[i],"-diff") == 0) {
+            diff_filename = args[i + 1];
+        }
+        if (strcmp(args[i],"-wave") == 0) {
+            wave_filename = args[i + 1];
+        }
+        if (strcmp(args[i],"-wave-steps") == 0) {
+            wave_steps = std::strtoull(args[i + 1], nullptr, 10);
+        }
+        if (strcmp(args[i],"-vcd") == 0) {
+            vcd_filename = args[i + 1];
+        }
+        if (strcmp(args[i],"-I") == 0) {
+            import_paths.push_back(args[i + 1]);
+        }
+        if (strcmp(args[i],"-import-threads") == 0) {
+            import_threads = std::strtoull(args[i + 1], nullptr, 10);
+        }
+        if (strcmp(args[i],"-query") == 0) {
+            query_path = args[i + 1];
+        }
+        if (strcmp(args[i],"-j") == 0) {
+            grammar_threads = std::strtoull(args[i + 1], nullptr, 10);
+        }
+        if (strcmp(args[i],"-format") == 0) {
+            if (strcmp(args[i + 1],"json") == 0) tree_format = syntree::formats::json;
+            else if (strcmp(args[i + 1],"dot") == 0) tree_format = syntree::formats::dot;
+            else tree_format = syntree::formats::text;
+        }
+        if (strcmp(args[i],"-content") == 0) {
+            /*
+                full, span or truncate, optionally with a byte limit as truncate:N.
+            */
+            if (strcmp(args[i + 1],"span") == 0) tree_content = syntree::contents::span;
+            else if (strncmp(args[i + 1],"truncate",8) == 0) {
+                tree_content = syntree::contents::truncated;
+                if (args[i + 1][8] == ':') content_limit = std::strtoull(args[i + 1] + 9, nullptr, 10);
+            }
+            else tree_content = syntree::contents::full;
+        }
+        if (strcmp(args[i],"-o") == 0) {
+            tree_filename = args[i + 1];
+        }
+        if (strcmp(args[i],"-start") == 0) {
+            /*
+                Comma separated list of the rules that become tree nodes.
+            */
+            std::stringstream rules(args[i + 1]);
+            std::string rule_id;
+            while (std::getline(rules, rule_id, ',')) {
+                if (rule_id.size() > 0) start_rules.push_back(rule_id);
+            }
+        }
     }
     bool runtest = false;
-    for (int i = 0; i < argc && !runtest; i++) {
+    bool lex = false;
+    bool stream = false;
+    bool shutdown = false;
+    bool recover = false;
+    bool profile_rules = false;
+    bool regex_opt = true;
+    bool simulate = false;
+    bool resolve_imports = false;
+    bool run_preprocess = false;
+    bool lazy = false;
+    for (int i = 0; i < argc; i++) {
         if (strcmp(args[i],"-test") == 0) {
             runtest = true;
         }
+        if (strcmp(args[i],"-lex") == 0) {
+            lex = true;
+        }
+        if (strcmp(args[i],"-stream") == 0) {
+            stream = true;
+        }
+        if (strcmp(args[i],"-shutdown") == 0) {
+            shutdown = true;
+        }
+        if (strcmp(args[i],"-recover") == 0) {
+            recover = true;
+        }
+        if (strcmp(args[i],"-profile-rules") == 0) {
+            profile_rules = true;
+        }
+        if (strcmp(args[i],"-no-regex-opt") == 0) {
+            regex_opt = false;
+        }
+        if (strcmp(args[i],"-simulate") == 0) {
+            simulate = true;
+        }
+        if (strcmp(args[i],"-imports") == 0) {
+            resolve_imports = true;
+        }
+        if (strcmp(args[i],"-preprocess") == 0) {
+            run_preprocess = true;
+        }
+        if (strcmp(args[i],"-lazy") == 0) {
+            lazy = true;
+        }
+    }
+    std::fstream tree_file;
+    if (tree_filename.size() > 0) {
+        tree_file.open(tree_filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!tree_file.is_open()) {
+            std::cerr << "Was not able to open tree output file: " << tree_filename << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& tree_out = tree_file.is_open() ? tree_file : std::cout;
+    uint_type grammar_flags = EBNF::flag_file | (regex_opt ? 0 : EBNF::flag_no_regex_opt);
+    if (connect_socket.size() > 0) {
+        /*
+            Thin client mode, forward the request to a running compile server.
+            Grammars are named by their absolute path on both ends.
+        */
+        server::Client client(connect_socket);
+        if (!client.connected()) {
+            std::cerr << "Was not able to connect to compile server at: " << connect_socket << std::endl;
+            return 1;
+        }
+        std::string response;
+        bool ok = false;
+        if (shutdown) {
+            ok = client.request(server::request_shutdown,"","",response);
+        }
+        else {
+            char* grammar_path = ebnf_filename.size() > 0 ? realpath(ebnf_filename.c_str(), nullptr) : nullptr;
+            char* source_path = realpath(source_filename.c_str(), nullptr);
+            ok = client.request(server::request_path, grammar_path != nullptr ? grammar_path : "",
+                                source_path != nullptr ? source_path : source_filename, response, lex ? server::flag_lex : 0);
+            free(grammar_path);
+            free(source_path);
+        }
+        (ok ? std::cout : std::cerr) << response << std::endl;
+        return ok ? 0 : 1;
+    }
+    if (serve_socket.size() > 0) {
+        server::CompileServer compile_server(serve_socket);
+        for (uint_type i = 0; i < ebnf_filenames.size(); i++) {
+            char* grammar_path = realpath(ebnf_filenames[i].c_str(), nullptr);
+            bool added = grammar_path != nullptr && compile_server.addGrammar(grammar_path, ebnf_filenames[i], grammar_flags, start_rules, grammar_threads);
+            free(grammar_path);
+            if (!added) return 1;
+        }
+        return compile_server.serve() ? 0 : 1;
+    }
+    if (load_binary_filename.size() > 0) {
+        bintree::MappedTree mapped(load_binary_filename);
+        if (!mapped.valid()) return 1;
+        std::cout << "Loaded binary syntax tree with " << mapped.size() << " nodes and " << mapped.rules() << " rules." << std::endl;
+        syntree::TreeWriter writer(tree_out, tree_format, tree_content, content_limit);
+        writer.write(mapped.toTrie());
+        writer.finish();
+        if (tree_file.is_open()) std::cout << "Wrote syntax tree to: " << tree_filename << std::endl;
     }
     if (ebnf_filename.size() > 0) {
-        EBNF ebnf(ebnf_filename, EBNF::flag_file);
+        EBNF ebnf(ebnf_filename, grammar_flags, start_rules, grammar_threads);
         std::cout << "Loaded EBNF file from source: " << ebnf_filename << std::endl;
         std::cout << "Grammar evaluated to:" << std::endl;
         for (auto& elem : ebnf.regex_map) {
@@ -40,9 +263,167 @@ int main(int argc, char** args) {
             //std::cout << "\t\t" << elem.second.assemble(ebnf.regex_map) << std::endl;
         }
         std::cout << "Parsing file with generated Regexes..." << std::endl;
-        auto trie = syntree::buildTree(ebnf,loadIntoString(source_filename));
+        if (stream) {
+            std::fstream source_stream(source_filename.c_str(), std::ios::in | std::ios::binary);
+            if (!source_stream.is_open()) {
+                std::cerr << "(File loading) Was not able to load file: " << source_filename << std::endl;
+                return 1;
+            }
+            syntree::TreeWriter writer(tree_out, tree_format, tree_content, content_limit);
+            writer.incremental(true);
+            uint_type constructs = syntree::streamParse(ebnf,source_stream,writer);
+            writer.finish();
+            if (tree_file.is_open()) std::cout << "Wrote syntax tree to: " << tree_filename << std::endl;
+            std::cout << "Streaming parse complete. Parsed " << constructs << " top-level constructs." << std::endl;
+            return 0;
+        }
+        std::string source = loadIntoString(source_filename);
+        /*
+            When preprocessing, the parse runs over the source without comments and
+            with whitespace collapsed, and the tree and diagnostics are mapped back
+            onto the source afterwards.
+        */
+        preprocess::Preprocessed preprocessed;
+        if (run_preprocess) {
+            preprocessed = preprocess::preprocess(source);
+            std::cout << "Preprocessed " << source.size() << " bytes to " << preprocessed.text.size() << " bytes with "
+                      << preprocessed.map.size() << " offset map entries." << std::endl;
+        }
+        const std::string& parsed = run_preprocess ? preprocessed.text : source;
+        Trie<syntree::SyntaxElement> trie;
+        std::unique_ptr<cache::ParseCache> parse_cache;
+        if (cache_directory.size() > 0) parse_cache.reset(new cache::ParseCache(cache_directory, cache_megabytes << 20));
+        syntree::ParseContext context;
+        lexer::TokenArray tokens;
+        std::vector<syntree::Diagnostic> diagnostics;
+        if (lex) {
+            lexer::Lexer lexer(ebnf);
+            tokens = lexer.tokenize(parsed);
+            std::cout << "Lexed " << tokens.size() << " tokens with a " << lexer.states() << " state table." << std::endl;
+            context.tokens = &tokens;
+        }
+        if (recover) context.recoverWith(ebnf,diagnostics);
+        context.hashing = diff_filename.size() > 0;
+        std::unique_ptr<profile::RuleProfiler> profiler;
+        if (profile_rules) {
+            /*
+                Profiling needs every rule to actually be matched, so the cache is
+                bypassed.
+            */
+            profiler.reset(new profile::RuleProfiler(ebnf));
+            context.profiler = profiler.get();
+            trie = syntree::buildTree(ebnf,parsed,context);
+        }
+        else if (lazy) {
+            /*
+                Bodies are left unparsed, the tree dumped is the signature skeleton.
+            */
+            syntree::LazyTree lazy_tree(ebnf,parsed,context);
+            trie = lazy_tree.tree();
+            std::cout << "Lazy parse left " << lazy_tree.placeholders() << " bodies unparsed." << std::endl;
+        }
+        else if (parse_cache) trie = syntree::buildTree(ebnf,parsed,context,*parse_cache);
+        else trie = syntree::buildTree(ebnf,parsed,context);
+        if (run_preprocess) {
+            preprocess::restore(trie,preprocessed.map,source);
+            preprocess::restore(diagnostics,preprocessed.map,source);
+        }
+        for (uint_type i = 0; i < diagnostics.size(); i++) {
+            std::cerr << source_filename << ":" << diagnostics[i].line << ":" << diagnostics[i].column << ": " << diagnostics[i].message << std::endl;
+        }
+        if (diff_filename.size() > 0) {
+            /*
+                The old source is lexed and preprocessed like the new one but parsed
+                without recovery. Lazy trees are hashed with their bodies unparsed.
+            */
+            if (trie.self.hash == 0) syntree::hashTree(trie);
+            std::string old_source = loadIntoString(diff_filename);
+            preprocess::Preprocessed old_preprocessed;
+            if (run_preprocess) old_preprocessed = preprocess::preprocess(old_source);
+            const std::string& old_parsed = run_preprocess ? old_preprocessed.text : old_source;
+            syntree::ParseContext old_context;
+            old_context.hashing = true;
+            lexer::TokenArray old_tokens;
+            if (lex) {
+                old_tokens = lexer::Lexer(ebnf).tokenize(old_parsed);
+                old_context.tokens = &old_tokens;
+            }
+            Trie<syntree::SyntaxElement> old_trie = syntree::buildTree(ebnf,old_parsed,old_context);
+            if (run_preprocess) preprocess::restore(old_trie,old_preprocessed.map,old_source);
+            std::cout << "Compared with " << diff_filename << ":" << std::endl;
+            syntree::diffReport(old_trie,trie);
+        }
+        if (parse_cache) std::cout << "Parse cache " << (parse_cache->hits() > 0 ? "hit" : "miss") << " in " << cache_directory << std::endl;
         std::cout << "Parsing complete. Size of tree is: " << trie.size() << std::endl;
-        syntree::treeSummary(trie);
+        if (emit_binary_filename.size() > 0) {
+            if (!bintree::write(emit_binary_filename,trie,&source)) return 1;
+            std::cout << "Wrote binary syntax tree to: " << emit_binary_filename << std::endl;
+        }
+        {
+            syntree::TreeWriter writer(tree_out, tree_format, tree_content, content_limit);
+            writer.write(trie);
+            writer.finish();
+            if (tree_file.is_open()) std::cout << "Wrote syntax tree to: " << tree_filename << std::endl;
+        }
+        /*
+            Passes over the tree share one index rather than walking it each.
+        */
+        std::unique_ptr<syntree::TreeIndex> index;
+        if (query_path.size() > 0 || netlist_top.size() > 0) index.reset(new syntree::TreeIndex(trie));
+        if (query_path.size() > 0) {
+            std::vector<syntree::NodeId> found = index->select(query_path);
+            std::cout << "Query \"" << query_path << "\" matched " << found.size() << " nodes:" << std::endl;
+            for (auto id : found) {
+                const syntree::SyntaxElement& element = index->element(id);
+                std::cout << "\t" << element.identifier << " index:" << element.index << " depth:" << index->depth(id)
+                          << " content:\"" << element.content.substr(0, 40) << (element.content.size() > 40 ? "...\"" : "\"") << std::endl;
+            }
+        }
+        if (profile_rules) {
+            std::cout << "Rule profile:" << std::endl;
+            profiler->report();
+            if (folded_filename.size() > 0 && profiler->writeFolded(folded_filename)) {
+                std::cout << "Wrote folded rule stacks to: " << folded_filename << std::endl;
+            }
+        }
+        std::vector<std::shared_ptr<const imports::Module> > modules;
+        if (resolve_imports) {
+            lexer::Lexer module_lexer;
+            if (lex) module_lexer = lexer::Lexer(ebnf);
+            imports::ImportResolver resolver(ebnf, import_threads, lex ? &module_lexer : nullptr);
+            for (auto& path : import_paths) resolver.addSearchPath(path);
+            if (!resolver.resolve(source_filename,source)) return 1;
+            modules = resolver.modules();
+            for (auto& module : modules) {
+                std::cout << "Imported \"" << module->name << "\" from " << module->path << ", size of tree is: " << module->tree.size() << std::endl;
+            }
+        }
+        if (netlist_top.size() > 0) {
+            /*
+                Grammars that don't produce declaration nodes yet still get their
+                source elaborated, declarations are then found by scanning it.
+                Imported declarations come first so the file's own take precedence.
+            */
+            netlist::Elaborator elaborator;
+            for (auto& module : modules) {
+                if (elaborator.declareTree(module->tree,module->source) == 0) elaborator.declareAll(module->source);
+            }
+            if (elaborator.declareTree(*index,source) == 0) elaborator.declareAll(source);
+            std::shared_ptr<const netlist::Module> top_module = elaborator.module(netlist_top);
+            if (top_module == nullptr) return 1;
+            std::cout << "Elaborated " << netlist_top << " with " << top_module->instances << " instances of "
+                      << elaborator.cachedModules() << " shared modules." << std::endl;
+            netlist::Netlist design;
+            elaborator.flatten(*top_module,design);
+            design.summary();
+            if (simulate) {
+                bool simulated = (sim_lanes == 256) ? sim::exhaustiveReport<4>(design) : sim::exhaustiveReport<1>(design);
+                if (!simulated) return 1;
+            }
+            if (sim_threads > 0 && !sim::parallelReport(design, sim_threads, 256)) return 1;
+            if (native_steps > 0 && !sim::nativeReport(design, native_steps)) return 1;
+            if (!wave_filename.empty() && !sim::traceReport(design, wave_steps, wave_filename, vcd_filename)) return 1;
+        }
     }
     if (runtest) {
         EBNF::testProgram();